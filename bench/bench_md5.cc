@@ -0,0 +1,120 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/base64.h"
+#include "../src/md5.h"
+
+// Source lines of about 40 bytes, the typical input of the checksum pass.
+static std::vector<std::string> MakeLines(size_t n)
+{
+    std::mt19937 rng(1);
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < n; i++)
+        lines.push_back(std::string(rng() % 80, 'x') + "\n");
+    return lines;
+}
+
+static void BM_MD5LineByLine(benchmark::State& state)
+{
+    auto lines = MakeLines(state.range(0));
+    uint8_t digest[MD5Hash::Length];
+    size_t bytes = 0;
+    for (const auto& line : lines)
+        bytes += line.size();
+
+    for (auto _ : state) {
+        for (const auto& line : lines) {
+            MD5Hash md5hash;
+            md5hash.Update(line.data(), line.size());
+            md5hash.Finalize(digest);
+            benchmark::DoNotOptimize(digest);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lines.size());
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+static void BM_MD5HashMany(benchmark::State& state)
+{
+    auto lines = MakeLines(state.range(0));
+    std::vector<std::string_view> views(lines.begin(), lines.end());
+    std::vector<uint8_t> digests(views.size() * MD5Hash::Length);
+    size_t bytes = 0;
+    for (const auto& line : lines)
+        bytes += line.size();
+
+    for (auto _ : state) {
+        MD5Hash::HashMany(views.data(), views.size(), reinterpret_cast<uint8_t (*)[MD5Hash::Length]>(digests.data()));
+        benchmark::DoNotOptimize(digests.data());
+    }
+    state.SetItemsProcessed(state.iterations() * lines.size());
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetLabel(MD5Hash::GetHashManyName());
+}
+
+// Checksums as found in DA records.
+static void BM_MD5ToBase64(benchmark::State& state)
+{
+    std::vector<uint8_t> digests(state.range(0) * MD5Hash::Length);
+    std::mt19937 rng(1);
+    for (auto& b : digests)
+        b = rng();
+    char encoded[MD5Hash::Base64PaddedLength + 1];
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < digests.size(); i += MD5Hash::Length) {
+            MD5Hash::ToBase64(&digests[i], encoded);
+            benchmark::DoNotOptimize(encoded);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * digests.size());
+}
+
+static void BM_Base64ToMD5(benchmark::State& state)
+{
+    std::vector<std::string> encoded;
+    std::mt19937 rng(1);
+    for (int64_t i = 0; i < state.range(0); i++) {
+        uint8_t digest[MD5Hash::Length];
+        char buf[MD5Hash::Base64PaddedLength + 1];
+        for (auto& b : digest)
+            b = rng();
+        MD5Hash::ToBase64(digest, buf);
+        encoded.push_back(buf);
+    }
+    uint8_t digest[MD5Hash::Length];
+
+    for (auto _ : state) {
+        for (const auto& s : encoded) {
+            if (!MD5Hash::Base64ToMD5(s.data(), digest, s.size()))
+                state.SkipWithError("invalid checksum");
+            benchmark::DoNotOptimize(digest);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * encoded.size());
+    state.SetBytesProcessed(state.iterations() * encoded.size() * MD5Hash::Base64PaddedLength);
+}
+
+BENCHMARK(BM_MD5LineByLine)->Arg(4096);
+BENCHMARK(BM_MD5HashMany)->Arg(4096);
+BENCHMARK(BM_MD5ToBase64)->Arg(4096);
+BENCHMARK(BM_Base64ToMD5)->Arg(4096);
@@ -0,0 +1,221 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "lcovgen.h"
+#include "../src/lcovmerge.h"
+
+static const char* kTracefile = "/bench/trace.info";
+
+struct GeneratedInput {
+    GeneratedInput(const LcovGenOptions& opts) {
+        tracefile_ = GenerateTracefile(opts, &fs_, &nrecords_, &source_bytes_);
+        fs_.PutFile(kTracefile, tracefile_);
+    }
+
+    MemoryFilesystem fs_;
+    std::string tracefile_;
+    size_t nrecords_ = 0;
+    size_t source_bytes_ = 0;
+};
+
+static void SetThroughput(benchmark::State& state, size_t bytes, size_t records)
+{
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.SetItemsProcessed(state.iterations() * records);
+}
+
+static void BM_LineParser(benchmark::State& state)
+{
+    GeneratedInput input(LcovGenOptions{});
+    LcovRecordArgList args;
+    std::string err;
+
+    for (auto _ : state) {
+        LineReader reader(input.tracefile_);
+        std::string_view line;
+        LineFields fields;
+        while (reader.NextLine(&line, &fields, &err) > 0) {
+            LineParser lp(line, fields);
+            LcovRecordType type = lp.ParseRecordType();
+            if (type != LcovRecordType::UNKNOWN && !lp.ParseRecordArguments(&args, &err))
+                state.SkipWithError(err.c_str());
+            benchmark::DoNotOptimize(args.data());
+        }
+    }
+    SetThroughput(state, input.tracefile_.size(), input.nrecords_);
+}
+
+// Parses the generated tracefile into a new parser on every iteration.
+static void RunParse(benchmark::State& state, const LcovGenOptions& opts, LcovParser::Config config)
+{
+    GeneratedInput input(opts);
+
+    for (auto _ : state) {
+        LcovParser parser(config);
+        if (!parser.Parse(&input.fs_, kTracefile)) {
+            state.SkipWithError("parse failed");
+            break;
+        }
+    }
+    SetThroughput(state, input.tracefile_.size(), input.nrecords_);
+}
+
+// The handler benchmarks parse tracefiles made mostly of one kind of record.
+
+static void BM_HandlerSF(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.nfiles_ = 8192;
+    opts.lines_per_file_ = 1;
+    opts.da_density_ = opts.brda_density_ = opts.fn_density_ = 0;
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    RunParse(state, opts, config);
+}
+
+static void BM_HandlerFN(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.fn_density_ = 1;
+    opts.da_density_ = opts.brda_density_ = 0;
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    RunParse(state, opts, config);
+}
+
+// Arg: checksums in the DA records, verified against the sources.
+static void BM_HandlerDA(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.da_density_ = 1;
+    opts.brda_density_ = opts.fn_density_ = 0;
+    opts.checksums_ = state.range(0);
+    LcovParser::Config config;
+    config.lazy_source_ = !opts.checksums_;
+    RunParse(state, opts, config);
+}
+
+static void BM_HandlerBRDA(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.brda_density_ = 1;
+    opts.da_density_ = opts.fn_density_ = 0;
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    RunParse(state, opts, config);
+}
+
+// Args: test names, checksums.
+static void BM_Parse(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.ntests_ = state.range(0);
+    opts.checksums_ = state.range(1);
+    LcovParser::Config config;
+    RunParse(state, opts, config);
+}
+
+static void BM_LoadLineMap(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.nfiles_ = 1;
+    opts.lines_per_file_ = state.range(0);
+    GeneratedInput input(opts);
+    std::string path = "/bench/src/dir0/file0.cc";
+    std::string err;
+
+    for (auto _ : state) {
+        // The source cache drops the content together with the last arena.
+        Arena arena;
+        SourceFileInfo sf(&arena, path);
+        if (!sf.LoadLineMap(&input.fs_, &err) || !sf.GetLineChecksum(1)) {
+            state.SkipWithError(err.c_str());
+            break;
+        }
+    }
+    SetThroughput(state, input.source_bytes_, opts.lines_per_file_);
+}
+
+// Args: jobs, sorted.
+static void BM_Export(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.nfiles_ = 256;
+    opts.ntests_ = 4;
+    GeneratedInput input(opts);
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.sorted_output_ = state.range(1);
+    LcovParser parser(config);
+    if (!parser.Parse(&input.fs_, kTracefile)) {
+        state.SkipWithError("parse failed");
+        return;
+    }
+
+    MemoryOutputSink sink;
+    size_t bytes = 0;
+    for (auto _ : state) {
+        sink.Clear();
+        if (!parser.Export(&sink, state.range(0)) || !sink.Flush()) {
+            state.SkipWithError("export failed");
+            break;
+        }
+        bytes = sink.GetContent().size();
+    }
+    SetThroughput(state, bytes, input.nrecords_);
+}
+
+// Arg: jobs. Merges 8 parsers holding the same source files.
+static void BM_MergeParallel(benchmark::State& state)
+{
+    LcovGenOptions opts;
+    opts.nfiles_ = 512;
+    GeneratedInput input(opts);
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    std::string err;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        LcovParser parser(config);
+        std::vector<LcovParser*> others;
+        for (int i = 0; i < 7; i++) {
+            others.push_back(new LcovParser(config));
+            (void)others.back()->Parse(&input.fs_, kTracefile);
+        }
+        (void)parser.Parse(&input.fs_, kTracefile);
+        state.ResumeTiming();
+        if (!parser.MergeParallel(others, state.range(0), &err))
+            state.SkipWithError(err.c_str());
+        state.PauseTiming();
+        for (auto* other : others)
+            delete other;
+        state.ResumeTiming();
+    }
+    SetThroughput(state, input.tracefile_.size() * 8, input.nrecords_ * 8);
+}
+
+BENCHMARK(BM_LineParser);
+BENCHMARK(BM_HandlerSF);
+BENCHMARK(BM_HandlerFN);
+BENCHMARK(BM_HandlerDA)->Arg(0)->Arg(1);
+BENCHMARK(BM_HandlerBRDA);
+BENCHMARK(BM_Parse)->Args({1, 0})->Args({16, 0})->Args({1, 1});
+BENCHMARK(BM_LoadLineMap)->Arg(4096);
+BENCHMARK(BM_Export)->Args({1, 0})->Args({1, 1})->Args({4, 1})->UseRealTime();
+BENCHMARK(BM_MergeParallel)->Arg(1)->Arg(4)->UseRealTime();
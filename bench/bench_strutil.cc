@@ -0,0 +1,75 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/strutil.h"
+
+// The strtoul() based conversion ParseUnsigned32() replaced, kept as baseline.
+static uint32_t LegacyStrToUnsigned32(std::string_view str, uint32_t fallback)
+{
+    char buf[11];
+    char* endp = nullptr;
+    uint32_t res;
+
+    if (str.size() > 10 || str.at(0) == '-')
+        return fallback;
+    (void)memcpy(buf, str.data(), str.size());
+    buf[str.size()] = '\0';
+    res = strtoul(buf, &endp, 10);
+
+    return static_cast<size_t>(endp - buf) == str.length() ? res : fallback;
+}
+
+// Argument pairs of DA records: line numbers and execution counts, where the
+// counts of hot lines are long.
+static std::vector<std::string> MakeDAFields(bool large_counts)
+{
+    std::mt19937 rng(1);
+    std::vector<std::string> fields;
+    for (int i = 0; i < 4096; i++) {
+        fields.push_back(std::to_string(rng() % 20000 + 1));
+        fields.push_back(std::to_string(large_counts ? rng() % 4000000000u : rng() % 10));
+    }
+    return fields;
+}
+
+template<uint32_t (*Parse)(std::string_view, uint32_t)>
+static void BM_ParseDAFields(benchmark::State& state)
+{
+    auto fields = MakeDAFields(state.range(0));
+    for (auto _ : state) {
+        for (size_t i = 0; i < fields.size(); i += 2) {
+            benchmark::DoNotOptimize(Parse(fields[i], 0));
+            benchmark::DoNotOptimize(Parse(fields[i + 1], UINT32_MAX));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * fields.size() / 2);
+    state.SetLabel("records");
+}
+
+static uint32_t FastStrToUnsigned32(std::string_view str, uint32_t fallback)
+{
+    uint32_t res;
+    return ParseUnsigned32(str, &res) ? res : fallback;
+}
+
+BENCHMARK_TEMPLATE(BM_ParseDAFields, LegacyStrToUnsigned32)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_ParseDAFields, FastStrToUnsigned32)->Arg(0)->Arg(1);
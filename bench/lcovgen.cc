@@ -0,0 +1,111 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "lcovgen.h"
+
+#include <random>
+#include <vector>
+
+#include "../src/md5.h"
+
+std::string GenerateTracefile(const LcovGenOptions& opts, MemoryFilesystem* fs,
+                              size_t* nrecords, size_t* nsource_bytes)
+{
+    std::mt19937 rng(opts.seed_);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::string out;
+    size_t records = 0, source_bytes = 0;
+    uint32_t ntests = opts.ntests_ ? opts.ntests_ : 1;
+    uint32_t files_per_test = (opts.nfiles_ + ntests - 1) / ntests;
+
+    auto emit = [&](const std::string& line) {
+        out += line;
+        out += '\n';
+        records++;
+    };
+
+    for (uint32_t f = 0; f < opts.nfiles_; f++) {
+        std::string path = "/bench/src/dir" + std::to_string(f % 16) + "/file" + std::to_string(f) + ".cc";
+        std::string source;
+        std::vector<std::string> lines;
+        for (uint32_t l = 1; l <= opts.lines_per_file_; l++) {
+            lines.push_back("    int v" + std::to_string(l) + " = compute(" + std::to_string(rng() % 1000) + ");\n");
+            source += lines.back();
+        }
+        source_bytes += source.size();
+        fs->PutFile(path, std::move(source));
+
+        if (f % files_per_test == 0)
+            emit("TN:test" + std::to_string(f / files_per_test));
+        emit("SF:" + path);
+
+        std::vector<uint32_t> fn_lines;
+        for (uint32_t l = 1; l <= opts.lines_per_file_; l++)
+            if (coin(rng) < opts.fn_density_)
+                fn_lines.push_back(l);
+        for (uint32_t l : fn_lines)
+            emit("FN:" + std::to_string(l) + ",function_" + std::to_string(f) + "_" + std::to_string(l));
+        uint32_t fnh = 0;
+        for (uint32_t l : fn_lines) {
+            uint32_t x = rng() % 4;
+            emit("FNDA:" + std::to_string(x) + ",function_" + std::to_string(f) + "_" + std::to_string(l));
+            fnh += x > 0;
+        }
+        emit("FNF:" + std::to_string(fn_lines.size()));
+        emit("FNH:" + std::to_string(fnh));
+
+        uint32_t brf = 0, brh = 0;
+        for (uint32_t l = 1; l <= opts.lines_per_file_; l++) {
+            if (coin(rng) >= opts.brda_density_)
+                continue;
+            for (uint32_t br = 0; br < 2; br++) {
+                uint32_t x = rng() % 8;
+                emit("BRDA:" + std::to_string(l) + ",0," + std::to_string(br) + "," + (x ? std::to_string(x - 1) : "-"));
+                brf++;
+                brh += x > 1;
+            }
+        }
+        emit("BRF:" + std::to_string(brf));
+        emit("BRH:" + std::to_string(brh));
+
+        uint32_t lf = 0, lh = 0;
+        for (uint32_t l = 1; l <= opts.lines_per_file_; l++) {
+            if (coin(rng) >= opts.da_density_)
+                continue;
+            uint32_t x = rng() % 16;
+            std::string da = "DA:" + std::to_string(l) + "," + std::to_string(x);
+            if (opts.checksums_) {
+                uint8_t digest[MD5Hash::Length];
+                char encoded[MD5Hash::Base64PaddedLength + 1];
+                MD5Hash md5hash;
+                md5hash.Update(lines[l - 1].data(), lines[l - 1].size());
+                md5hash.Finalize(digest);
+                MD5Hash::ToBase64(digest, encoded);
+                da += ",";
+                da += encoded;
+            }
+            emit(da);
+            lf++;
+            lh += x > 0;
+        }
+        emit("LF:" + std::to_string(lf));
+        emit("LH:" + std::to_string(lh));
+        emit("end_of_record");
+    }
+
+    if (nrecords)
+        *nrecords = records;
+    if (nsource_bytes)
+        *nsource_bytes = source_bytes;
+    return out;
+}
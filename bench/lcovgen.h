@@ -0,0 +1,38 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "../src/filesystem_memory.h"
+
+// Shape of a synthetic tracefile, densities are the share of source lines
+// carrying a record of the given kind.
+struct LcovGenOptions {
+    uint32_t nfiles_ = 64;
+    uint32_t lines_per_file_ = 1000;
+    double da_density_ = 0.6;
+    double brda_density_ = 0.1;   // lines with a block of two branches
+    double fn_density_ = 0.02;    // lines starting a function
+    bool checksums_ = false;      // DA records carry the MD5 of their line
+    uint32_t ntests_ = 1;         // the source files are split among test names
+    uint32_t seed_ = 1;
+};
+
+// Writes the source files described by `opts` into `fs` and returns a
+// tracefile covering them. `nrecords` receives the number of lines of the
+// tracefile, `nsource_bytes` the total size of the sources; both are optional.
+std::string GenerateTracefile(const LcovGenOptions& opts, MemoryFilesystem* fs,
+                              size_t* nrecords = nullptr, size_t* nsource_bytes = nullptr);
@@ -0,0 +1,93 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// libFuzzer target for LineParser and the record handlers: the input is parsed
+// as a tracefile (or a snapshot) against a few in-memory sources, exported and
+// parsed again. The first byte selects the parser configuration. Build with
+// `make config=fuzz` and run e.g.
+//   build/fuzz/fuzz_parser -dict=fuzz/lcov.dict -rss_limit_mb=512 corpus/
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "../src/lcovmerge.h"
+#include "../src/liblcovmerge.h"
+#include "../tests/efs.h"
+
+namespace {
+
+EmuFilesystem* GetFilesystem()
+{
+    static EmuFilesystem* fs = [] {
+        ::SetErrorHandler([](std::string_view) {});
+        auto* fs = new EmuFilesystem;
+        fs->PushFile("/a.c", "int main()\n{\n    return 0;\n}\n");
+        fs->PushFile("/b.c", "");
+        fs->PushFile("/c.c", "no newline at the end");
+        return fs;
+    }();
+    return fs;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!size)
+        return 0;
+    EmuFilesystem* fs = GetFilesystem();
+    LcovParser::Config config;
+    // Most flags are bit-fields.
+    config.lazy_source_ = data[0] & 1;
+    config.generate_checksum_ = data[0] >> 1 & 1;
+    config.discard_checksum_ = data[0] >> 2 & 1;
+    config.trusted_ = data[0] >> 3 & 1;
+    config.keep_going_ = data[0] >> 4 & 1;
+    config.summary_only_ = data[0] >> 5 & 1;
+    config.streaming_ = data[0] >> 6 & 1;
+    if (data[0] >> 7) {
+        config.parse_jobs_ = 3;
+        config.min_part_size_ = 16;
+    }
+    // Without them a handful of records can take gigabytes.
+    config.max_lines_per_file_ = 1 << 16;
+    config.max_branches_per_line_ = 1 << 10;
+    fs->PushFile("/input.info", std::string(reinterpret_cast<const char*>(data) + 1, size - 1));
+
+    LcovParser parser(config);
+    if (!parser.Parse(fs, "/input.info"))
+        return 0;
+    if (config.summary_only_) {
+        (void)parser.GetSummary();
+        return 0;
+    }
+
+    // What has been exported must parse again, as text and as a snapshot.
+    MemoryOutputSink text, snapshot;
+    if (!parser.Export(&text, 1) || !parser.ExportSnapshot(&snapshot))
+        __builtin_trap();
+    // Merging blocks of a source file may exceed the limits of a single input,
+    // and snapshots are only recognized if they aren't streamed.
+    config.trusted_ = true;
+    config.streaming_ = false;
+    config.parse_jobs_ = 1;
+    config.max_lines_per_file_ = 0;
+    config.max_branches_per_line_ = 0;
+    fs->PushFile("/output.info", text.GetContent());
+    fs->PushFile("/output.snap", snapshot.GetContent());
+    LcovParser reparsed(config);
+    if (!reparsed.Parse(fs, "/output.info") || !reparsed.Parse(fs, "/output.snap"))
+        __builtin_trap();
+    return 0;
+}
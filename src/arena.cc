@@ -0,0 +1,29 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#include <cstring>
+
+std::string_view Arena::Intern(std::string_view str)
+{
+    auto it = strings_.find(str);
+    if (it != strings_.cend())
+        return *it;
+
+    char* copy = static_cast<char*>(resource_.allocate(str.size() + 1, 1));
+    (void)memcpy(copy, str.data(), str.size());
+    copy[str.size()] = '\0';
+    return *strings_.emplace(copy, str.size()).first;
+}
@@ -0,0 +1,56 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Monotonic allocator backing a coverage model. Objects created by New() are
+// never destroyed one by one, all the memory is released at once together
+// with the arena, so they must not own anything but memory of the arena.
+struct Arena {
+
+    enum { kInitialSize = 64 << 10 };
+
+    Arena() : resource_(kInitialSize) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    std::pmr::memory_resource* GetResource() { return &resource_; }
+
+    template<class T, class... Args>
+    T* New(Args&&... args) {
+        return new (resource_.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Returns a NUL-terminated copy of `str` owned by the arena, equal strings
+    // share a single copy.
+    std::string_view Intern(std::string_view str);
+    // Keep `object` alive as long as the arena.
+    void Retain(std::shared_ptr<const void> object) { retained_.push_back(std::move(object)); }
+    // Take over `other` and everything allocated from it.
+    void Adopt(std::unique_ptr<Arena> other) { adopted_.push_back(std::move(other)); }
+
+private:
+    std::pmr::monotonic_buffer_resource resource_;
+    std::pmr::unordered_set<std::string_view> strings_{&resource_};
+    std::vector<std::shared_ptr<const void>> retained_;
+    std::vector<std::unique_ptr<Arena>> adopted_;
+};
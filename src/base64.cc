@@ -26,83 +26,81 @@ static constexpr int kBase64Invs[] = {
     43, 44, 45, 46, 47, 48, 49, 50, 51
 };
 
-void Base64Encode(const uint8_t* in, size_t len, std::string* buf)
+size_t Base64Encode(const uint8_t* in, size_t len, char* out)
 {
-    assert(len > 0 && in && buf);
-    size_t esize = len * 4 / 3 + 4;
-    buf->reserve(esize);
-    buf->clear();
+    assert(in && out);
+    char* p = out;
 
     while (len >= 3) {
-        buf->append(1, kBase64Chars[*in >> 2]);
-        buf->append(1, kBase64Chars[((*in & 0x03) << 4) | (in[1] >> 4)]);
-        buf->append(1, kBase64Chars[((in[1] & 0x0f) << 2) | (in[2] >> 6)]);
-        buf->append(1, kBase64Chars[in[2] & 0x3f]);
+        *p++ = kBase64Chars[*in >> 2];
+        *p++ = kBase64Chars[((*in & 0x03) << 4) | (in[1] >> 4)];
+        *p++ = kBase64Chars[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+        *p++ = kBase64Chars[in[2] & 0x3f];
         in += 3;
         len -= 3;
     }
 
     if (len > 0) {
-        buf->append(1, kBase64Chars[*in >> 2]);
+        *p++ = kBase64Chars[*in >> 2];
         if (len == 1) {
-            buf->append(1, kBase64Chars[(in[0] & 0x03) << 4]);
-            buf->append(1, '=');
+            *p++ = kBase64Chars[(in[0] & 0x03) << 4];
+            *p++ = '=';
         } else {
-            buf->append(1, kBase64Chars[((in[0] & 0x03) << 4) | (in[1] >> 4)]);
-            buf->append(1, kBase64Chars[(in[1] & 0x0f) << 2]);
+            *p++ = kBase64Chars[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+            *p++ = kBase64Chars[(in[1] & 0x0f) << 2];
         }
-        buf->append(1, '=');
+        *p++ = '=';
     }
+    return p - out;
 }
 
-static inline bool IsValidBase64Char(int ch)
+void Base64Encode(const uint8_t* in, size_t len, std::string* buf)
 {
-    if (ch < 43 || ch > 122 || -1 == kBase64Invs[ch])
-        return false;
-    return true;
+    assert(len > 0 && in && buf);
+    buf->resize(Base64EncodeSize(len));
+    buf->resize(Base64Encode(in, len, &(*buf)[0]));
 }
 
-bool Base64Decode(const unsigned char* in, size_t inlen, uint8_t* out, size_t* outlen)
+static inline int Base64Value(unsigned char ch)
 {
-    assert(in && inlen > 0 && out && outlen && *outlen > 0);
-    size_t count = 0, olen;
+    if (ch < 43 || ch > 122)
+        return -1;
+    return kBase64Invs[ch - 43];
+}
 
-    // Validate the base64 string
-    for (size_t i = 0; i < inlen; i++) {
-        if (!IsValidBase64Char(in[i]))
-            return false;
-    }
+bool Base64Decode(const char* in, size_t inlen, uint8_t* out, size_t* outlen)
+{
+    assert(in && out && outlen);
     if (inlen % 4)
         return false;
 
-    olen = inlen / 4 * 3;
+    // Padding is only allowed at the very end.
+    size_t pad = 0;
+    if (inlen && in[inlen - 1] == '=')
+        pad++;
+    if (inlen > 1 && in[inlen - 2] == '=')
+        pad++;
+    size_t olen = inlen / 4 * 3 - pad;
     if (*outlen < olen)
         return false;
 
-    uint8_t* p = out, block[4];
-    const unsigned char* end = in + inlen;
-    int pad = 0;
-    while (in < end) {
-        if (*in == '=')
-            pad++;
-        block[count++] = kBase64Invs[*in - 43];
-        if (count == 4) {
-            count = 0;
-            *p++ = (block[0] << 2) | (block[1] >> 4);
-            *p++ = (block[1] << 4) | (block[2] >> 2);
-            *p++ = (block[2] << 6) | block[3];
-            if (pad) {
-                switch (pad) {
-                    case 2: p--;
-                    case 1: p--;
-                        break;
-                    default:
-                        // invalid padding
-                        return false;
-                }
-            }
-        }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+    uint8_t* q = out;
+    for (size_t i = 0; i < inlen; i += 4, p += 4) {
+        bool last = i + 4 == inlen;
+        int v0 = Base64Value(p[0]), v1 = Base64Value(p[1]);
+        int v2 = last && pad == 2 ? 0 : Base64Value(p[2]);
+        int v3 = last && pad ? 0 : Base64Value(p[3]);
+        if ((v0 | v1 | v2 | v3) < 0)
+            return false;
+
+        uint32_t triple = v0 << 18 | v1 << 12 | v2 << 6 | v3;
+        *q++ = triple >> 16;
+        if (!last || pad < 2)
+            *q++ = (triple >> 8) & 0xff;
+        if (!last || pad < 1)
+            *q++ = triple & 0xff;
     }
-    *outlen = p - out;
+    *outlen = q - out;
     return true;
 }
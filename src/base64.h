@@ -19,6 +19,14 @@
 constexpr size_t Base64DecodeSize(size_t inlen) {
     return inlen * 3 / 4;
 }
+constexpr size_t Base64EncodeSize(size_t inlen) {
+    return (inlen + 2) / 3 * 4;
+}
 void Base64Encode(const uint8_t* data, size_t len, std::string* buf);
-bool Base64Decode(const char* in, size_t inlen, uint8_t* out, size_t outlen);
+// Encodes into `out`, which must hold Base64EncodeSize(len) characters. No NUL
+// terminator is written, returns the number of characters.
+size_t Base64Encode(const uint8_t* data, size_t len, char* out);
+// Decodes padded base64, *outlen is the capacity of `out` on input and the
+// decoded size on return.
+bool Base64Decode(const char* in, size_t inlen, uint8_t* out, size_t* outlen);
 
@@ -0,0 +1,389 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "compress.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+
+#define ZLIB_CONST
+#include <zlib.h>
+#ifdef LCOVMERGE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+bool ParseCompression(std::string_view str, Compression* type, int* level)
+{
+    std::string_view name = str.substr(0, str.find(':'));
+    if (name == "none")
+        *type = Compression::NONE;
+    else if (name == "gzip")
+        *type = Compression::GZIP;
+    else if (name == "zstd")
+        *type = Compression::ZSTD;
+    else
+        return false;
+
+    *level = 0; // the default of the format
+    if (name.size() == str.size())
+        return true;
+    std::string_view digits = str.substr(name.size() + 1);
+    if (digits.empty() || digits.size() > 2 || digits.find_first_not_of("0123456789") != std::string_view::npos)
+        return false;
+    *level = std::stoi(std::string(digits));
+    return *type != Compression::NONE && *level > 0 && (*type != Compression::GZIP || *level <= 9);
+}
+
+bool IsCompressionSupported(Compression type)
+{
+#ifndef LCOVMERGE_HAVE_ZSTD
+    if (type == Compression::ZSTD)
+        return false;
+#endif
+    return true;
+}
+
+Compression DetectCompression(std::string_view head)
+{
+    if (head.size() >= 2 && head[0] == '\x1f' && head[1] == '\x8b')
+        return Compression::GZIP;
+    if (head.size() >= 4 && !memcmp(head.data(), "\x28\xb5\x2f\xfd", 4))
+        return Compression::ZSTD;
+    return Compression::NONE;
+}
+
+// Decompression
+
+struct DecompressingInputStream::Decoder {
+    virtual ~Decoder() {}
+    // Decodes from the front of `in` into out[0, len), *produced may be 0 if
+    // more input is needed.
+    virtual bool Decode(std::string_view* in, char* out, size_t len, size_t* produced, std::string* err) = 0;
+    // Whether the input may end here, i.e. no member or frame is incomplete.
+    virtual bool AtBoundary() const = 0;
+};
+
+namespace {
+
+struct GzipDecoder : public DecompressingInputStream::Decoder {
+    GzipDecoder() {
+        memset(&zs_, 0, sizeof(zs_));
+        ok_ = inflateInit2(&zs_, 15 + 32) == Z_OK; // gzip or zlib header
+    }
+    ~GzipDecoder() override { inflateEnd(&zs_); }
+
+    bool Decode(std::string_view* in, char* out, size_t len, size_t* produced, std::string* err) override {
+        if (!ok_) {
+            *err = "failed to initialize zlib";
+            return false;
+        }
+        if (ended_) {
+            // Another member follows.
+            inflateReset(&zs_);
+            ended_ = false;
+        }
+        zs_.next_in = reinterpret_cast<const Bytef*>(in->data());
+        zs_.avail_in = std::min<size_t>(in->size(), UINT_MAX);
+        zs_.next_out = reinterpret_cast<Bytef*>(out);
+        zs_.avail_out = std::min<size_t>(len, UINT_MAX);
+        int rc = inflate(&zs_, Z_NO_FLUSH);
+        in->remove_prefix(reinterpret_cast<const char*>(zs_.next_in) - in->data());
+        *produced = reinterpret_cast<char*>(zs_.next_out) - out;
+        if (rc == Z_STREAM_END)
+            ended_ = true;
+        else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            *err = std::string("invalid gzip data: ") + (zs_.msg ? zs_.msg : zError(rc));
+            return false;
+        }
+        started_ = true;
+        return true;
+    }
+    bool AtBoundary() const override { return ended_ || !started_; }
+
+    z_stream zs_;
+    bool ok_;
+    bool started_ = false;
+    bool ended_ = false;
+};
+
+#ifdef LCOVMERGE_HAVE_ZSTD
+struct ZstdDecoder : public DecompressingInputStream::Decoder {
+    ZstdDecoder() : ctx_(ZSTD_createDCtx()) {}
+    ~ZstdDecoder() override { ZSTD_freeDCtx(ctx_); }
+
+    bool Decode(std::string_view* in, char* out, size_t len, size_t* produced, std::string* err) override {
+        ZSTD_inBuffer input = { in->data(), in->size(), 0 };
+        ZSTD_outBuffer output = { out, len, 0 };
+        size_t rc = ZSTD_decompressStream(ctx_, &output, &input);
+        if (ZSTD_isError(rc)) {
+            *err = std::string("invalid zstd data: ") + ZSTD_getErrorName(rc);
+            return false;
+        }
+        in->remove_prefix(input.pos);
+        *produced = output.pos;
+        boundary_ = rc == 0;
+        return true;
+    }
+    bool AtBoundary() const override { return boundary_; }
+
+    ZSTD_DCtx* ctx_;
+    bool boundary_ = true;
+};
+#endif
+
+} // namespace
+
+DecompressingInputStream::DecompressingInputStream(IFilesystem::InputStream* in) : in_(in) {}
+
+DecompressingInputStream::DecompressingInputStream(std::string_view data) : view_(data) {}
+
+DecompressingInputStream::~DecompressingInputStream() {}
+
+IFilesystem::Status DecompressingInputStream::Open(std::string* err)
+{
+    if (in_) {
+        // Enough for the magic numbers, reads from pipes may come in pieces.
+        buffer_.reset(new char[kInputBufferSize]);
+        size_t n = 0;
+        while (n < 4) {
+            size_t nread;
+            if (in_->Read(buffer_.get() + n, kInputBufferSize - n, &nread, err) != IFilesystem::SUCCESS)
+                return IFilesystem::IO_ERROR;
+            if (!nread) {
+                eof_ = true;
+                break;
+            }
+            n += nread;
+        }
+        input_ = std::string_view(buffer_.get(), n);
+    } else {
+        input_ = view_;
+        view_ = {};
+        eof_ = true;
+    }
+
+    type_ = DetectCompression(input_);
+    switch (type_) {
+        case Compression::NONE:
+            break;
+        case Compression::GZIP:
+            decoder_.reset(new GzipDecoder);
+            break;
+        case Compression::ZSTD:
+#ifdef LCOVMERGE_HAVE_ZSTD
+            decoder_.reset(new ZstdDecoder);
+            break;
+#else
+            *err = "zstd compressed input is not supported by this build";
+            return IFilesystem::IO_ERROR;
+#endif
+    }
+    return IFilesystem::SUCCESS;
+}
+
+IFilesystem::Status DecompressingInputStream::FillInput(std::string* err)
+{
+    assert(in_ && input_.empty() && !eof_);
+    size_t nread;
+    if (in_->Read(buffer_.get(), kInputBufferSize, &nread, err) != IFilesystem::SUCCESS)
+        return IFilesystem::IO_ERROR;
+    eof_ = nread == 0;
+    input_ = std::string_view(buffer_.get(), nread);
+    return IFilesystem::SUCCESS;
+}
+
+IFilesystem::Status DecompressingInputStream::Decode(char* buf, size_t len, size_t* nread, std::string* err)
+{
+    *nread = 0;
+    if (!decoder_) {
+        // Pass through, what's left from Open() comes first.
+        if (!input_.empty()) {
+            *nread = input_.copy(buf, len);
+            input_.remove_prefix(*nread);
+            return IFilesystem::SUCCESS;
+        }
+        if (eof_)
+            return IFilesystem::SUCCESS;
+        return in_->Read(buf, len, nread, err);
+    }
+
+    while (len) {
+        if (input_.empty()) {
+            if (eof_) {
+                if (decoder_->AtBoundary())
+                    return IFilesystem::SUCCESS;
+                *err = "unexpected end of compressed input";
+                return IFilesystem::IO_ERROR;
+            }
+            if (FillInput(err) != IFilesystem::SUCCESS)
+                return IFilesystem::IO_ERROR;
+            continue;
+        }
+        if (!decoder_->Decode(&input_, buf, len, nread, err))
+            return IFilesystem::IO_ERROR;
+        if (*nread)
+            break;
+    }
+    return IFilesystem::SUCCESS;
+}
+
+IFilesystem::Status DecompressingInputStream::Peek(size_t len, std::string_view* head, std::string* err)
+{
+    while (peeked_.size() < len) {
+        size_t n = peeked_.size(), nread;
+        peeked_.resize(len);
+        IFilesystem::Status status = Decode(&peeked_[n], len - n, &nread, err);
+        peeked_.resize(n + nread);
+        if (status != IFilesystem::SUCCESS)
+            return status;
+        if (!nread)
+            break;
+    }
+    *head = std::string_view(peeked_).substr(0, len);
+    return IFilesystem::SUCCESS;
+}
+
+IFilesystem::Status DecompressingInputStream::Read(char* buf, size_t len, size_t* nread, std::string* err)
+{
+    if (!peeked_.empty()) {
+        *nread = peeked_.copy(buf, len);
+        peeked_.erase(0, *nread);
+        return IFilesystem::SUCCESS;
+    }
+    return Decode(buf, len, nread, err);
+}
+
+// Compression
+
+struct CompressingOutputSink::Encoder {
+    virtual ~Encoder() {}
+    // Compresses data[0, len) into `out`, `end` terminates the stream.
+    virtual bool Encode(const char* data, size_t len, bool end, OutputSink* out, std::string* err) = 0;
+
+    enum { kOutputBufferSize = 1 << 18 };
+    char buffer_[kOutputBufferSize];
+};
+
+namespace {
+
+struct GzipEncoder : public CompressingOutputSink::Encoder {
+    GzipEncoder(int level) {
+        memset(&zs_, 0, sizeof(zs_));
+        ok_ = deflateInit2(&zs_, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                           Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~GzipEncoder() override { deflateEnd(&zs_); }
+
+    bool Encode(const char* data, size_t len, bool end, OutputSink* out, std::string* err) override {
+        if (!ok_) {
+            *err = "failed to initialize zlib";
+            return false;
+        }
+        do {
+            size_t chunk = std::min<size_t>(len, UINT_MAX);
+            bool last = end && chunk == len;
+            zs_.next_in = reinterpret_cast<const Bytef*>(data);
+            zs_.avail_in = chunk;
+            int rc;
+            do {
+                zs_.next_out = reinterpret_cast<Bytef*>(buffer_);
+                zs_.avail_out = kOutputBufferSize;
+                rc = deflate(&zs_, last ? Z_FINISH : Z_NO_FLUSH);
+                if (rc == Z_STREAM_ERROR) {
+                    *err = "gzip compression failed";
+                    return false;
+                }
+                out->Write(buffer_, kOutputBufferSize - zs_.avail_out);
+            } while (zs_.avail_out == 0 || (last && rc != Z_STREAM_END));
+            data += chunk;
+            len -= chunk;
+        } while (len);
+        return true;
+    }
+
+    z_stream zs_;
+    bool ok_;
+};
+
+#ifdef LCOVMERGE_HAVE_ZSTD
+struct ZstdEncoder : public CompressingOutputSink::Encoder {
+    ZstdEncoder(int level, unsigned threads) : ctx_(ZSTD_createCCtx()) {
+        if (level)
+            (void)ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, level);
+        // Fails without multithreading support in libzstd, it's only slower then.
+        if (threads > 1)
+            (void)ZSTD_CCtx_setParameter(ctx_, ZSTD_c_nbWorkers, threads);
+    }
+    ~ZstdEncoder() override { ZSTD_freeCCtx(ctx_); }
+
+    bool Encode(const char* data, size_t len, bool end, OutputSink* out, std::string* err) override {
+        ZSTD_inBuffer input = { data, len, 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { buffer_, kOutputBufferSize, 0 };
+            remaining = ZSTD_compressStream2(ctx_, &output, &input, end ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                *err = std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining);
+                return false;
+            }
+            out->Write(buffer_, output.pos);
+        } while (end ? remaining != 0 : input.pos < input.size);
+        return true;
+    }
+
+    ZSTD_CCtx* ctx_;
+};
+#endif
+
+} // namespace
+
+CompressingOutputSink::CompressingOutputSink(OutputSink* next, Compression type, int level, unsigned threads)
+    : next_(next)
+{
+    assert(IsCompressionSupported(type) && type != Compression::NONE);
+    if (type == Compression::GZIP)
+        encoder_.reset(new GzipEncoder(level));
+#ifdef LCOVMERGE_HAVE_ZSTD
+    else
+        encoder_.reset(new ZstdEncoder(level, threads));
+#endif
+}
+
+CompressingOutputSink::~CompressingOutputSink() {}
+
+bool CompressingOutputSink::WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err)
+{
+    for (int i = 0; i < iovcnt; i++) {
+        if (!encoder_->Encode(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len, false, next_, err))
+            return false;
+    }
+    if (next_->HasFailed()) {
+        *err = next_->GetError();
+        return false;
+    }
+    return true;
+}
+
+bool CompressingOutputSink::Finish()
+{
+    std::string err;
+    if (!Flush())
+        return false;
+    if (!encoder_->Encode(nullptr, 0, true, next_, &err))
+        return Fail(err);
+    if (!next_->Finish())
+        return Fail(next_->GetError());
+    return true;
+}
@@ -0,0 +1,90 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "filesystem.h"
+#include "output.h"
+
+// Compressed tracefiles. gzip is always available, zstd only if built with
+// LCOVMERGE_HAVE_ZSTD.
+enum class Compression { NONE, GZIP, ZSTD };
+
+// Parses "none", "gzip" or "zstd", optionally followed by ":LEVEL".
+bool ParseCompression(std::string_view str, Compression* type, int* level);
+bool IsCompressionSupported(Compression type);
+// Recognizes the magic numbers of gzip and zstd frames.
+Compression DetectCompression(std::string_view head);
+
+// Decodes the content of a stream or a view, input that isn't compressed is
+// passed through as it is. Concatenated gzip members and zstd frames are
+// decoded as one stream.
+struct DecompressingInputStream : public IFilesystem::InputStream {
+
+    enum { kInputBufferSize = 1 << 18 };
+
+    // `in` must outlive the decompressor.
+    DecompressingInputStream(IFilesystem::InputStream* in);
+    DecompressingInputStream(std::string_view data);
+    ~DecompressingInputStream() override;
+
+    // Reads the first bytes of the input to detect its compression, must be
+    // called before anything else.
+    IFilesystem::Status Open(std::string* err);
+    Compression GetCompression() const { return type_; }
+    // Decodes up to `len` bytes ahead without consuming them, *head may be
+    // shorter at the end of the input.
+    IFilesystem::Status Peek(size_t len, std::string_view* head, std::string* err);
+    IFilesystem::Status Read(char* buf, size_t len, size_t* nread, std::string* err) override;
+
+    struct Decoder;
+
+private:
+    IFilesystem::Status FillInput(std::string* err);
+    IFilesystem::Status Decode(char* buf, size_t len, size_t* nread, std::string* err);
+
+    IFilesystem::InputStream* in_ = nullptr;
+    std::string_view view_;        // unread part of the input if it's a view
+    std::unique_ptr<char[]> buffer_;
+    std::string_view input_;       // input not consumed by the decoder yet
+    bool eof_ = false;             // of the underlying input
+    std::string peeked_;           // decoded by Peek() and not read yet
+    Compression type_ = Compression::NONE;
+    std::unique_ptr<Decoder> decoder_;
+};
+
+// Compresses everything written to it into another sink. Finish() ends the
+// compressed stream, the output is incomplete without it.
+struct CompressingOutputSink : public OutputSink {
+
+    // `next` must outlive the sink. zstd compresses on `threads` workers.
+    CompressingOutputSink(OutputSink* next, Compression type, int level, unsigned threads = 1);
+    ~CompressingOutputSink() override;
+
+    bool Finish() override;
+
+    struct Encoder;
+
+protected:
+    bool WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err) override;
+
+private:
+    OutputSink* next_;
+    std::unique_ptr<Encoder> encoder_;
+};
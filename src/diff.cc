@@ -0,0 +1,252 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "diff.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "lcovmerge.h"
+
+namespace {
+
+using SourceFileIndex = std::unordered_map<std::string_view, std::vector<const SourceFileInfo*>>;
+
+SourceFileIndex IndexSourceFiles(const LcovParser& parser)
+{
+    SourceFileIndex index;
+    for (const auto& t : parser.GetTestRecords()) {
+        for (auto* sf : t.second->GetSourceFiles(false))
+            index[sf->GetSourceFilePath()].push_back(sf);
+    }
+    return index;
+}
+
+// The coverage of a source file merged over the tests of a report, sorted by
+// line (and block and branch). The buffers are reused from file to file.
+struct FlatSourceFile {
+    struct Line {
+        uint32_t lineno_;
+        bool hit_;
+        const uint8_t* checksum_; // nullptr if there's none
+    };
+    struct Branch {
+        uint32_t lineno_, blkno_, brno_;
+        bool hit_;
+        bool operator<(const Branch& o) const {
+            return lineno_ != o.lineno_ ? lineno_ < o.lineno_ :
+                   blkno_ != o.blkno_ ? blkno_ < o.blkno_ : brno_ < o.brno_;
+        }
+        bool SameBranch(const Branch& o) const {
+            return lineno_ == o.lineno_ && blkno_ == o.blkno_ && brno_ == o.brno_;
+        }
+    };
+
+    void Build(const std::vector<const SourceFileInfo*>& sfs);
+    const Line* FindLine(uint32_t lineno) const;
+    const Branch* FindBranch(const Branch& key) const;
+    // Line with the given checksum, nullptr if there's none or more than one.
+    const Line* FindChecksum(const uint8_t* checksum);
+
+    std::vector<Line> lines_;
+    std::vector<Branch> branches_;
+    std::unordered_map<std::string_view, std::pair<uint32_t, bool>> functions_; // name -> (lineno, hit)
+
+private:
+    // checksum -> index into lines_, or SIZE_MAX if ambiguous. Only built if a
+    // line doesn't match its counterpart.
+    std::unordered_map<std::string_view, size_t> checksums_;
+    bool indexed_ = false;
+};
+
+void FlatSourceFile::Build(const std::vector<const SourceFileInfo*>& sfs)
+{
+    lines_.clear();
+    branches_.clear();
+    functions_.clear();
+    checksums_.clear();
+    indexed_ = false;
+    for (auto* sf : sfs) {
+        sf->GetLineCoverage()->ForEach([this](uint32_t lineno, uint32_t xcount, const uint8_t* checksum) {
+            lines_.push_back({lineno, xcount > 0, checksum});
+        });
+        sf->GetBranchCoverage()->ForEach([this](uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount) {
+            branches_.push_back({lineno, blkno, brno, xcount && xcount != BranchCoverageTable::NEVER_EXECUTED});
+        });
+        for (const auto& f : sf->GetFunctions()) {
+            auto& v = functions_.emplace(f.first, std::make_pair(f.second.lineno_, false)).first->second;
+            v.second |= f.second.xcount_ != 0;
+        }
+    }
+    if (sfs.size() < 2)
+        return;
+
+    // Every table is in order on its own, combine the records of the tests.
+    std::stable_sort(lines_.begin(), lines_.end(), [](const Line& a, const Line& b) { return a.lineno_ < b.lineno_; });
+    size_t n = 0;
+    for (size_t i = 0; i < lines_.size(); i++) {
+        if (n && lines_[n - 1].lineno_ == lines_[i].lineno_) {
+            lines_[n - 1].hit_ |= lines_[i].hit_;
+            if (!lines_[n - 1].checksum_)
+                lines_[n - 1].checksum_ = lines_[i].checksum_;
+        } else
+            lines_[n++] = lines_[i];
+    }
+    lines_.resize(n);
+    std::sort(branches_.begin(), branches_.end());
+    n = 0;
+    for (size_t i = 0; i < branches_.size(); i++) {
+        if (n && branches_[n - 1].SameBranch(branches_[i]))
+            branches_[n - 1].hit_ |= branches_[i].hit_;
+        else
+            branches_[n++] = branches_[i];
+    }
+    branches_.resize(n);
+}
+
+const FlatSourceFile::Line* FlatSourceFile::FindLine(uint32_t lineno) const
+{
+    auto it = std::lower_bound(lines_.begin(), lines_.end(), lineno,
+                               [](const Line& l, uint32_t n) { return l.lineno_ < n; });
+    return it != lines_.end() && it->lineno_ == lineno ? &*it : nullptr;
+}
+
+const FlatSourceFile::Branch* FlatSourceFile::FindBranch(const Branch& key) const
+{
+    auto it = std::lower_bound(branches_.begin(), branches_.end(), key);
+    return it != branches_.end() && it->SameBranch(key) ? &*it : nullptr;
+}
+
+static std::string_view ChecksumKey(const uint8_t* checksum)
+{
+    return std::string_view(reinterpret_cast<const char*>(checksum), MD5Hash::Length);
+}
+
+const FlatSourceFile::Line* FlatSourceFile::FindChecksum(const uint8_t* checksum)
+{
+    if (!indexed_) {
+        for (size_t i = 0; i < lines_.size(); i++) {
+            if (!lines_[i].checksum_)
+                continue;
+            auto res = checksums_.emplace(ChecksumKey(lines_[i].checksum_), i);
+            if (!res.second)
+                res.first->second = SIZE_MAX;
+        }
+        indexed_ = true;
+    }
+    auto it = checksums_.find(ChecksumKey(checksum));
+    return it != checksums_.end() && it->second != SIZE_MAX ? &lines_[it->second] : nullptr;
+}
+
+// The line of `base` which `line` is compared with, nullptr if there's none.
+const FlatSourceFile::Line* MatchLine(const FlatSourceFile::Line& line, FlatSourceFile* base)
+{
+    auto* same = base->FindLine(line.lineno_);
+    if (same && (!same->checksum_ || !line.checksum_ || !memcmp(same->checksum_, line.checksum_, MD5Hash::Length)))
+        return same;
+    return line.checksum_ ? base->FindChecksum(line.checksum_) : nullptr;
+}
+
+void DiffSourceFile(FlatSourceFile* base, const FlatSourceFile& candidate, std::vector<CoverageChange>* changes)
+{
+    for (const auto& line : candidate.lines_) {
+        auto* match = MatchLine(line, base);
+        if (match && match->hit_ != line.hit_)
+            changes->push_back({CoverageChange::LINE, line.hit_, line.lineno_, match->lineno_});
+    }
+
+    size_t first = changes->size();
+    for (const auto& f : candidate.functions_) {
+        auto it = base->functions_.find(f.first);
+        if (it != base->functions_.end() && it->second.second != f.second.second)
+            changes->push_back({CoverageChange::FUNCTION, f.second.second, f.second.first, it->second.first, 0, 0,
+                                f.first});
+    }
+    std::sort(changes->begin() + first, changes->end(), [](const CoverageChange& a, const CoverageChange& b) {
+        return a.lineno_ != b.lineno_ ? a.lineno_ < b.lineno_ : a.function_ < b.function_;
+    });
+
+    // Branches move along with the line they are on.
+    const FlatSourceFile::Line* line = nullptr;
+    const FlatSourceFile::Line* match = nullptr;
+    for (const auto& br : candidate.branches_) {
+        if (!line || line->lineno_ != br.lineno_) {
+            line = candidate.FindLine(br.lineno_);
+            match = line ? MatchLine(*line, base) : nullptr;
+        }
+        uint32_t base_lineno = line ? (match ? match->lineno_ : 0) : br.lineno_;
+        if (!base_lineno)
+            continue;
+        auto* other = base->FindBranch({base_lineno, br.blkno_, br.brno_, false});
+        if (other && other->hit_ != br.hit_)
+            changes->push_back({CoverageChange::BRANCH, br.hit_, br.lineno_, base_lineno, br.blkno_, br.brno_});
+    }
+}
+
+} // namespace
+
+std::vector<FileCoverageDiff> DiffReports(const LcovParser& base, const LcovParser& candidate)
+{
+    auto base_index = IndexSourceFiles(base);
+    auto candidate_index = IndexSourceFiles(candidate);
+    std::vector<std::string_view> paths;
+    for (const auto& v : candidate_index) {
+        if (base_index.count(v.first))
+            paths.push_back(v.first);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<FileCoverageDiff> res;
+    FlatSourceFile a, b;
+    std::vector<CoverageChange> changes;
+    for (auto path : paths) {
+        a.Build(base_index[path]);
+        b.Build(candidate_index[path]);
+        changes.clear();
+        DiffSourceFile(&a, b, &changes);
+        if (!changes.empty())
+            res.push_back({path, changes});
+    }
+    return res;
+}
+
+void WriteDiff(OutputSink* out, const std::vector<FileCoverageDiff>& diff)
+{
+    static const char* kRecords[] = { "DA:", "FN:", "BRDA:" };
+    for (const auto& file : diff) {
+        out->Write("SF:");
+        out->Write(file.path_);
+        out->Put('\n');
+        for (const auto& c : file.changes_) {
+            out->Put(c.hit_ ? '+' : '-');
+            out->Write(kRecords[c.kind_]);
+            out->WriteUnsigned(c.lineno_);
+            if (c.kind_ == CoverageChange::FUNCTION) {
+                out->Put(',');
+                out->Write(c.function_);
+            } else if (c.kind_ == CoverageChange::BRANCH) {
+                out->Put(',');
+                out->WriteUnsigned(c.blkno_);
+                out->Put(',');
+                out->WriteUnsigned(c.brno_);
+            }
+            if (c.base_lineno_ != c.lineno_) {
+                out->Put('@');
+                out->WriteUnsigned(c.base_lineno_);
+            }
+            out->Put('\n');
+        }
+        out->Write("end_of_record\n");
+    }
+}
@@ -0,0 +1,53 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct LcovParser;
+struct OutputSink;
+
+// A line, function or branch of which the hit status differs between a base
+// report and a candidate report, both merged over all of their tests.
+struct CoverageChange {
+    enum Kind { LINE, FUNCTION, BRANCH };
+
+    Kind kind_;
+    bool hit_;             // hit in the candidate, and not in the base, or vice versa
+    uint32_t lineno_;      // in the candidate
+    uint32_t base_lineno_; // differs from lineno_ if the line moved
+    uint32_t blkno_ = 0;
+    uint32_t brno_ = 0;
+    std::string_view function_;
+};
+
+struct FileCoverageDiff {
+    std::string_view path_;
+    std::vector<CoverageChange> changes_; // lines, then functions, then branches
+};
+
+// Compare the source files which are in both reports, in order of their paths.
+// Lines are matched by their checksums where both reports have one: a line
+// which moved is compared with its old location, and a line which has been
+// edited, added or removed is not compared at all, nor are the branches on it.
+// Only the files with changes are kept, the results point into the reports.
+std::vector<FileCoverageDiff> DiffReports(const LcovParser& base, const LcovParser& candidate);
+
+// Writes every changed file as its SF record, followed by a line per change
+//   +DA:<line>     -FN:<line>,<name>     +BRDA:<line>,<block>,<branch>
+// where '+' is newly hit and '-' no longer hit, with "@<base line>" appended
+// if it moved, and an end_of_record line.
+void WriteDiff(OutputSink* out, const std::vector<FileCoverageDiff>& diff);
@@ -13,7 +13,10 @@
 // limitations under the License.
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 
 struct IFilesystem {
 
@@ -21,5 +24,67 @@ struct IFilesystem {
 
     enum Status { SUCCESS, NOT_FOUND, IO_ERROR };
     virtual Status ReadFile(const char* path, std::string* content, std::string* err) = 0;
+
+    // Read-only view of the content of a file, the data is not NUL terminated
+    // and stays valid as long as the view is alive.
+    struct FileView {
+        virtual ~FileView() {}
+        std::string_view GetData() const { return data_; }
+    protected:
+        std::string_view data_;
+    };
+
+    // Returns a view of the whole file. Implementations may map the file into
+    // memory, the default one reads the file into a buffer owned by the view.
+    virtual Status MapFile(const char* path, std::unique_ptr<FileView>* view, std::string* err) {
+        auto* buffered = new BufferedFileView;
+        view->reset(buffered);
+        Status status = ReadFile(path, &buffered->content_, err);
+        buffered->data_ = buffered->content_;
+        return status;
+    }
+
+    // Sequential reader over the content of a file.
+    struct InputStream {
+        virtual ~InputStream() {}
+        // Read up to `len` bytes into `buf`, *nread is set to 0 at the end of the file.
+        virtual Status Read(char* buf, size_t len, size_t* nread, std::string* err) = 0;
+    };
+
+    // Opens a file for sequential reading, "-" names the standard input if the
+    // filesystem has one. The default implementation reads from MapFile().
+    virtual Status OpenFile(const char* path, std::unique_ptr<InputStream>* stream, std::string* err) {
+        auto* viewed = new ViewInputStream;
+        stream->reset(viewed);
+        return MapFile(path, &viewed->view_, err);
+    }
+
+    // Returns a path that names the same file as `path`, different spellings of
+    // a path are expected to produce the same result. Falls back to `path`.
+    virtual std::string GetCanonicalPath(const char* path) { return path; }
+
+    // Stamp of the last modification of a file, which changes whenever the file
+    // is written. Implementations that can't tell report 0 for every file.
+    virtual Status GetModificationTime(const char* path, int64_t* mtime, std::string* err) {
+        *mtime = 0;
+        return SUCCESS;
+    }
+
+protected:
+    struct BufferedFileView : public FileView {
+        std::string content_;
+        friend IFilesystem;
+    };
+
+    struct ViewInputStream : public InputStream {
+        Status Read(char* buf, size_t len, size_t* nread, std::string* err) override {
+            std::string_view data = view_->GetData().substr(offset_);
+            *nread = data.copy(buf, len);
+            offset_ += *nread;
+            return SUCCESS;
+        }
+        std::unique_ptr<FileView> view_;
+        size_t offset_ = 0;
+    };
 };
 
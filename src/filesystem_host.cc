@@ -16,7 +16,12 @@
 #include "filesystem.h"
 
 #include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdlib>
 
 #include <cassert>
 #include <cerrno>
@@ -58,3 +63,112 @@ HostFilesystem::Status HostFilesystem::ReadFile(const char* path, std::string* c
     return SUCCESS;
 }
 
+
+namespace {
+
+struct MappedFileView : public IFilesystem::FileView {
+    MappedFileView(void* addr, size_t size) : addr_(addr), size_(size) {
+        data_ = std::string_view(static_cast<const char*>(addr), size);
+    }
+    ~MappedFileView() override { munmap(addr_, size_); }
+
+    void* addr_;
+    size_t size_;
+};
+
+struct FdInputStream : public IFilesystem::InputStream {
+    FdInputStream(int fd, bool owned) : fd_(fd), owned_(owned) {}
+    ~FdInputStream() override {
+        if (owned_)
+            close(fd_);
+    }
+
+    IFilesystem::Status Read(char* buf, size_t len, size_t* nread, std::string* err) override {
+        ssize_t rlen;
+        do {
+            rlen = read(fd_, buf, len);
+        } while (rlen == -1 && errno == EINTR);
+        if (rlen == -1) {
+            *nread = 0;
+            err->assign(strerror(errno));
+            return IFilesystem::IO_ERROR;
+        }
+        *nread = rlen;
+        return IFilesystem::SUCCESS;
+    }
+
+    int fd_;
+    bool owned_;
+};
+
+} // namespace
+
+HostFilesystem::Status HostFilesystem::OpenFile(const char* path, std::unique_ptr<InputStream>* stream, std::string* err)
+{
+    assert(path != nullptr && stream != nullptr && err != nullptr);
+    err->clear();
+    if (!strcmp(path, "-")) {
+        stream->reset(new FdInputStream(STDIN_FILENO, false));
+        return SUCCESS;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        err->assign(strerror(errno));
+        return errno == ENOENT ? NOT_FOUND : IO_ERROR;
+    }
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    stream->reset(new FdInputStream(fd, true));
+    return SUCCESS;
+}
+
+HostFilesystem::Status HostFilesystem::MapFile(const char* path, std::unique_ptr<FileView>* view, std::string* err)
+{
+    assert(path != nullptr && view != nullptr && err != nullptr);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    err->clear();
+    if (fd == -1) {
+        err->assign(strerror(errno));
+        return errno == ENOENT ? NOT_FOUND : IO_ERROR;
+    }
+
+    struct stat sb;
+    if (-1 == fstat(fd, &sb)) {
+        err->assign(strerror(errno));
+        close(fd);
+        return IO_ERROR;
+    }
+
+    // Pipes, empty files and small files go through the buffered path.
+    void* addr = MAP_FAILED;
+    if (S_ISREG(sb.st_mode) && sb.st_size >= kMinMappedFileSize)
+        addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return IFilesystem::MapFile(path, view, err);
+
+    (void)madvise(addr, sb.st_size, MADV_SEQUENTIAL);
+    view->reset(new MappedFileView(addr, sb.st_size));
+    return SUCCESS;
+}
+
+std::string HostFilesystem::GetCanonicalPath(const char* path)
+{
+    char resolved[PATH_MAX];
+    if (!realpath(path, resolved))
+        return path;
+    return resolved;
+}
+
+HostFilesystem::Status HostFilesystem::GetModificationTime(const char* path, int64_t* mtime, std::string* err)
+{
+    struct stat sb;
+    err->clear();
+    if (-1 == stat(path, &sb)) {
+        err->assign(strerror(errno));
+        return errno == ENOENT ? NOT_FOUND : IO_ERROR;
+    }
+    *mtime = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    return SUCCESS;
+}
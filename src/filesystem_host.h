@@ -17,5 +17,14 @@
 
 struct HostFilesystem : public IFilesystem {
     Status ReadFile(const char* path, std::string* content, std::string* err) override;
+    Status MapFile(const char* path, std::unique_ptr<FileView>* view, std::string* err) override;
+    Status OpenFile(const char* path, std::unique_ptr<InputStream>* stream, std::string* err) override;
+    std::string GetCanonicalPath(const char* path) override;
+    // In nanoseconds since the epoch.
+    Status GetModificationTime(const char* path, int64_t* mtime, std::string* err) override;
+
+    // Files smaller than this are read into memory instead of being mapped,
+    // which keeps the number of mappings low when loading many source files.
+    enum { kMinMappedFileSize = 1 << 16 };
 };
 
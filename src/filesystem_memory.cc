@@ -0,0 +1,96 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "filesystem_memory.h"
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+struct MemoryFileView : public IFilesystem::FileView {
+    MemoryFileView(std::shared_ptr<const std::string> content) : content_(std::move(content)) {
+        data_ = *content_;
+    }
+
+    std::shared_ptr<const std::string> content_;
+};
+
+} // namespace
+
+const MemoryFilesystem::Entry* MemoryFilesystem::Find(const char* path) const
+{
+    auto it = files_.find(std::string_view(path));
+    return it == files_.cend() ? nullptr : &it->second;
+}
+
+MemoryFilesystem::Status MemoryFilesystem::ReadFile(const char* path, std::string* content, std::string* err)
+{
+    err->clear();
+    if (const Entry* entry = Find(path)) {
+        content->assign(*entry->content_);
+        return SUCCESS;
+    }
+    if (fallback_)
+        return fallback_->ReadFile(path, content, err);
+    content->clear();
+    err->assign(strerror(ENOENT));
+    return NOT_FOUND;
+}
+
+MemoryFilesystem::Status MemoryFilesystem::MapFile(const char* path, std::unique_ptr<FileView>* view, std::string* err)
+{
+    err->clear();
+    if (const Entry* entry = Find(path)) {
+        view->reset(new MemoryFileView(entry->content_));
+        return SUCCESS;
+    }
+    if (fallback_)
+        return fallback_->MapFile(path, view, err);
+    err->assign(strerror(ENOENT));
+    return NOT_FOUND;
+}
+
+MemoryFilesystem::Status MemoryFilesystem::OpenFile(const char* path, std::unique_ptr<InputStream>* stream, std::string* err)
+{
+    if (!Find(path) && fallback_)
+        return fallback_->OpenFile(path, stream, err);
+    return IFilesystem::OpenFile(path, stream, err);
+}
+
+std::string MemoryFilesystem::GetCanonicalPath(const char* path)
+{
+    if (!Find(path) && fallback_)
+        return fallback_->GetCanonicalPath(path);
+    return path;
+}
+
+MemoryFilesystem::Status MemoryFilesystem::GetModificationTime(const char* path, int64_t* mtime, std::string* err)
+{
+    err->clear();
+    if (const Entry* entry = Find(path)) {
+        *mtime = entry->version_;
+        return SUCCESS;
+    }
+    if (fallback_)
+        return fallback_->GetModificationTime(path, mtime, err);
+    err->assign(strerror(ENOENT));
+    return NOT_FOUND;
+}
+
+void MemoryFilesystem::PutFile(const std::string& path, std::string content)
+{
+    Entry& entry = files_[path];
+    entry.content_ = std::make_shared<const std::string>(std::move(content));
+    entry.version_++;
+}
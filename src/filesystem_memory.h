@@ -0,0 +1,52 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "filesystem.h"
+
+// Files held in memory, e.g. tracefiles produced in-process. MapFile() returns
+// views of the stored contents without copying them, a view stays valid after
+// its file has been replaced or removed. Paths that aren't stored are looked up
+// in `fallback` if there's one, so the sources named by an in-memory tracefile
+// can still be read from disk. Files must not be stored or removed while
+// other threads read from the filesystem.
+struct MemoryFilesystem : public IFilesystem {
+
+    MemoryFilesystem(IFilesystem* fallback = nullptr) : fallback_(fallback) {}
+
+    Status ReadFile(const char* path, std::string* content, std::string* err) override;
+    Status MapFile(const char* path, std::unique_ptr<FileView>* view, std::string* err) override;
+    Status OpenFile(const char* path, std::unique_ptr<InputStream>* stream, std::string* err) override;
+    std::string GetCanonicalPath(const char* path) override;
+    // Counts the times a stored file has been replaced.
+    Status GetModificationTime(const char* path, int64_t* mtime, std::string* err) override;
+
+    void PutFile(const std::string& path, std::string content);
+    void RemoveFile(const std::string& path) { files_.erase(path); }
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::string> content_;
+        int64_t version_ = 0;
+    };
+    const Entry* Find(const char* path) const;
+
+    IFilesystem* fallback_;
+    std::map<std::string, Entry, std::less<>> files_;
+};
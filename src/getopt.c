@@ -137,8 +137,10 @@ permute (char **argv, int len1, int len2)
 static int
 is_option (char *argv_element, int only)
 {
+  /* a lone "-" is an operand, it usually stands for the standard input */
   return ((argv_element == NULL)
-          || (argv_element[0] == '-') || (only && argv_element[0] == '+'));
+          || (argv_element[0] == '-' && argv_element[1] != '\0')
+          || (only && argv_element[0] == '+'));
 }
 
 /* getopt_internal:  the function that does all the dirty work */
@@ -316,7 +318,10 @@ getopt_internal (int argc, char **argv, char *shortopts,
           optwhere = 1;
         }
       else
-        optarg = NULL;
+        {
+          optarg = NULL;
+          optwhere = 1;
+        }
       break;
     case required_argument:
       if (*possible_arg == '=')
@@ -11,630 +11,2108 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include "lcovmerge.h"
 
-#include <alloca.h>
-#include <cassert>
-#include <climits>
-#include <cstddef>
-#include <cstdint>
-#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
-#include <string>
-#include <string_view>
-#include <unordered_map>
+#include <thread>
+#include <unordered_set>
 #include <utility>
-#include <vector>
 
 #include "base64.h"
-#include "filesystem.h"
-#include "md5.h"
+#include "compress.h"
+#include "parallel.h"
+#include "scanner.h"
 
-#define MAX_NDIGITS 10
-#define INVALID_UNSIGNED_INTEGER    UINT32_MAX
-#define ERROR(...) fprintf(stderr, __VA_ARGS__)
+// Helper functions
+static inline uint32_t StrToUnsigned32(std::string_view str, uint32_t fallback)
+{
+    uint32_t res;
+    return ::ParseUnsigned32(str, &res) ? res : fallback;
+}
 
-// lcov format definition
-struct LcovTestRecord;
-struct SourceFileInfo;
-struct FunctionCoverageInfo;
-struct LineCoverageInfo;
-struct LcovParser;
+// Insert n clear bits before bit `pos` of a bitmap of `nbits` bits.
+static void BitmapInsert(std::pmr::vector<uint64_t>* bits, size_t nbits, size_t pos, size_t n)
+{
+    bits->resize((nbits + n + 63) / 64, 0);
+    if (pos == nbits)
+        return; // appended, the new bits are clear already
+    for (size_t i = nbits + n; i-- > pos + n; ) {
+        uint64_t mask = uint64_t(1) << (i % 64);
+        if (BitmapTest(*bits, i - n))
+            (*bits)[i / 64] |= mask;
+        else
+            (*bits)[i / 64] &= ~mask;
+    }
+    for (size_t i = pos; i < pos + n; i++)
+        (*bits)[i / 64] &= ~(uint64_t(1) << (i % 64));
+}
 
-typedef enum {
-    UNKNOWN = 0, TN, SF, VER, FN, FNDA, FNF, FNH, DA, BRDA, BRF, BRH, LF, LH, END_OF_RECORD,
-    LAST_RECORD_TYPE
-} LcovRecordType;
-using LcovRecordArgList = std::vector<std::string_view>;
+// Resize a vector to `n` zero-initialized elements. Grows geometrically, arena
+// memory of outgrown buffers is never reused.
+template<typename Vec>
+static void GrowTo(Vec* vec, size_t n)
+{
+    if (n > vec->capacity())
+        vec->reserve(std::max(n, vec->capacity() * 2));
+    vec->resize(n, 0);
+}
 
-struct LcovTestRecord {
+const char* RecordType2Str(LcovRecordType type)
+{
+    switch (type) {
+        case LcovRecordType::UNKNOWN: return "<unknown>";
+        case LcovRecordType::TN: return "<TN>";
+        case LcovRecordType::SF: return "<SF>";
+        case LcovRecordType::VER: return "<VER>";
+        case LcovRecordType::FN: return "<FN>";
+        case LcovRecordType::FNDA: return "<FNDA>";
+        case LcovRecordType::FNF: return "<FNF>";
+        case LcovRecordType::FNH: return "<FNH>";
+        case LcovRecordType::DA: return "<DA>";
+        case LcovRecordType::BRDA: return "<BRDA>";
+        case LcovRecordType::BRF: return "<BRF>";
+        case LcovRecordType::BRH: return "<BRH>";
+        case LcovRecordType::LF: return "<LF>";
+        case LcovRecordType::LH: return "<LH>";
+        case LcovRecordType::END_OF_RECORD: return "<end_of_record>";
+        default:
+            break;
+    }
+    return nullptr;
+}
 
-    LcovTestRecord(const std::string& tn, IFilesystem* fs) : tn_(tn), fs_(fs) {}
-    ~LcovTestRecord();
-    const std::string& GetTestName() const { return tn_; }
-    int Export(FILE* fp);
+// Main implementation
 
-private:
-    SourceFileInfo* GetCurrentSourceFileInfo() const { return cursf_; }
-    void SetCurrentSourceFileInfo(SourceFileInfo* sf) { cursf_ = sf; }
-    IFilesystem* GetFilesystemInterface() const { return fs_; }
+void LcovTestRecord::ExportTestName(OutputSink* out) const
+{
+    if (!tn_.empty()) {
+        out->Write("TN:");
+        out->Write(tn_);
+        out->Put('\n');
+    }
+}
 
-private:
-    std::string tn_;
-    // fullpath -> SourceFileInfo
-    std::unordered_map<std::string, SourceFileInfo*> sfs_;
-    SourceFileInfo* cursf_= nullptr;
-    IFilesystem* fs_;
+std::vector<SourceFileInfo*> LcovTestRecord::GetSourceFiles(bool sorted) const
+{
+    std::vector<SourceFileInfo*> res;
+    res.reserve(sfs_.size());
+    for (const auto& v : sfs_)
+        res.push_back(v.second);
+    if (sorted) {
+        std::sort(res.begin(), res.end(), [](const SourceFileInfo* a, const SourceFileInfo* b) {
+            return a->GetSourceFilePath() < b->GetSourceFilePath();
+        });
+    }
+    return res;
+}
 
-    friend LcovParser;
-};
+int LcovTestRecord::Export(OutputSink* out, bool sorted)
+{
+    assert(out != nullptr);
+    ExportTestName(out);
+    for (auto* sf : GetSourceFiles(sorted)) {
+        if (sf->Export(out, sorted))
+            return 1;
+    }
+    return out->HasFailed() ? 1 : 0;
+}
 
-struct LineBranchCoverage {
-    enum { NEVER_EXECUTED = UINT32_MAX - 1 };
-    struct BranchExecInfo {
-        uint32_t xcount_ = NEVER_EXECUTED;
-        bool is_defined_ = false;
-    };
+int SourceFileInfo::Export(OutputSink* out, bool sorted)
+{
+    using FunctionRecord = std::pair<const std::string_view, FunctionCoverageInfo>;
+    std::vector<const FunctionRecord*> funcs;
+    funcs.reserve(funcs_.size());
+    for (const auto& rec : funcs_)
+        funcs.push_back(&rec);
+    if (sorted) {
+        std::sort(funcs.begin(), funcs.end(), [](const FunctionRecord* a, const FunctionRecord* b) {
+            if (a->second.lineno_ != b->second.lineno_)
+                return a->second.lineno_ < b->second.lineno_;
+            return a->first < b->first;
+        });
+    }
 
-    std::vector<std::vector<BranchExecInfo>> blocks_;
-    bool is_defined_ = false;
-};
+    out->Write("SF:");
+    out->Write(fullpath_);
+    out->Put('\n');
 
-struct SourceFileInfo {
+    // Export function definitions
+    for (const auto* rec : funcs) {
+        const auto& func = rec->second;
+        out->Write("FN:");
+        out->WriteUnsigned(func.lineno_);
+        out->Put(',');
+        if (func.is_private_) {
+            out->Write(GetSourceFileName());
+            out->Put(':');
+        }
+        out->Write(rec->first);
+        out->Put('\n');
+    }
 
-    SourceFileInfo(std::string_view fullpath) {
-        sfname_ = fullpath.substr(fullpath.find_last_of("/\\") + 1);
-        fullpath_ = fullpath;
-        linemap_.push_back(LINEMAP_UNKNOWN);
+    // Export function coverage records
+    size_t fnh = 0;
+    for (const auto* rec : funcs) {
+        const auto& func = rec->second;
+        if (func.xcount_ != 0)
+            fnh++;
+        out->Write("FNDA:");
+        out->WriteUnsigned(func.xcount_);
+        out->Put(',');
+        if (func.is_private_) {
+            out->Write(GetSourceFileName());
+            out->Put(':');
+        }
+        out->Write(rec->first);
+        out->Put('\n');
     }
+    out->Write("FNF:");
+    out->WriteUnsigned(funcs_.size());
+    out->Write("\nFNH:");
+    out->WriteUnsigned(fnh);
+    out->Put('\n');
+
+    // llvm-cov generates line coverage records after FN*s, so do we.
+    uint32_t lf = 0, lh = 0;
+    das_.ForEach([&](uint32_t lineno, uint32_t xcount, const uint8_t* checksum) {
+        assert(lineno > 0);
+        out->Write("DA:");
+        out->WriteUnsigned(lineno);
+        out->Put(',');
+        out->WriteUnsigned(xcount);
+        if (checksum) {
+            char encoded_checksum[MD5Hash::Base64PaddedLength + 1];
+            MD5Hash::ToBase64(checksum, encoded_checksum);
+            out->Put(',');
+            out->Write(encoded_checksum, MD5Hash::Base64PaddedLength);
+        }
+        out->Put('\n');
+        if (xcount > 0)
+            lh++;
+        lf++;
+    });
+
+    // Export branch coverage records
+    uint32_t brf = 0, brh = 0;
+    branches_.ForEach([&](uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount) {
+        assert(lineno > 0);
+        out->Write("BRDA:");
+        out->WriteUnsigned(lineno);
+        out->Put(',');
+        out->WriteUnsigned(blkno);
+        out->Put(',');
+        out->WriteUnsigned(brno);
+        if (xcount == BranchCoverageTable::NEVER_EXECUTED) {
+            out->Write(",-\n");
+        } else {
+            out->Put(',');
+            out->WriteUnsigned(xcount);
+            out->Put('\n');
+            if (xcount) brh++;
+        }
+        brf++;
+    });
+    out->Write("BRF:");
+    out->WriteUnsigned(brf);
+    out->Write("\nBRH:");
+    out->WriteUnsigned(brh);
 
-    int Export(FILE* fp);
-    const std::string& GetSourceFileName() const { return sfname_; }
-    const std::string& GetSourceFilePath() const { return fullpath_; }
+    // And finally the line summary info
+    out->Write("\nLF:");
+    out->WriteUnsigned(lf);
+    out->Write("\nLH:");
+    out->WriteUnsigned(lh);
+    out->Write("\nend_of_record\n");
 
-    bool IsLineDataAvailable() const { return linemap_[0] == LINEMAP_LOADED; }
-    bool LoadLineMap(IFilesystem* fs, std::string* err);
-    std::string_view ReadLineData(uint32_t lineno, bool no_newline);
+    return 0;
+}
 
-    FunctionCoverageInfo* LookupFunction(std::string_view name);
-    template<typename... Targs>
-    std::pair<FunctionCoverageInfo*, bool> GetFunction(std::string_view name, Targs &&...args);
-    LineCoverageInfo* GetLineCoverage(uint32_t lineno);
+bool LcovTestRecord::Merge(LcovTestRecord* other, std::string* err, std::vector<QuarantineRecord>* quarantine)
+{
+    for (auto it = other->sfs_.begin(); it != other->sfs_.end(); ) {
+        auto mine = sfs_.find(it->first);
+        if (mine == sfs_.cend()) {
+            sfs_.emplace(it->first, it->second);
+            it = other->sfs_.erase(it);
+            continue;
+        }
+        if (quarantine && !mine->second->CheckMerge(*it->second, err)) {
+            QuarantineRecord rec;
+            rec.source_file_ = std::string(it->first);
+            rec.error_ = rec.source_file_ + ": " + *err;
+            ERROR("%s\n", rec.error_.c_str());
+            quarantine->push_back(std::move(rec));
+            ++it;
+            continue;
+        }
+        if (!mine->second->Merge(*it->second, err)) {
+            *err = std::string(it->first) + ": " + *err;
+            return false;
+        }
+        ++it;
+    }
+    return true;
+}
 
-    enum { INVALID_BLOCK_ID = UINT16_MAX, INVALID_BRANCH_ID = UINT16_MAX };
-    LineBranchCoverage::BranchExecInfo* GetBranchCoverage(uint32_t lineno, uint32_t blkId, uint32_t branchId);
+bool SourceFileInfo::Merge(const SourceFileInfo& other, std::string* err)
+{
+    if (other.version_ != VERSION_UNSET && !SetVersionID(other.version_) && !IsCompatible(other.version_)) {
+        *err = "conflicting version IDs";
+        return false;
+    }
 
-    bool IsLineNumberInRange(uint32_t lineno) const {
-        if (IsLineDataAvailable())
-            return lineno > 0 && lineno <= linemap_.size() - 2;
-        return lineno > 0;
+    for (const auto& rec : other.funcs_) {
+        auto rp = GetFunction(rec.first, rec.second);
+        if (rp.second == false) {
+            auto* func = rp.first;
+            if (func->lineno_ != rec.second.lineno_ || func->is_private_ != rec.second.is_private_) {
+                *err = "conflicting function definitions";
+                return false;
+            }
+            func->xcount_ += rec.second.xcount_;
+        }
     }
-    bool SetVersionID(int version) {
-        assert(version != VERSION_UNSET && version != VERSION_INVALID);
-        if (version_ == VERSION_UNSET) {
-            version_ = version;
-            return true;
+
+    bool conflict = false;
+    other.das_.ForEach([&](uint32_t lineno, uint32_t xcount, const uint8_t* checksum) {
+        uint32_t slot = das_.Define(lineno);
+        if (checksum) {
+            const uint8_t* mine = das_.GetChecksum(slot);
+            if (!mine)
+                das_.SetChecksum(slot, checksum);
+            else if (!MD5Hash::Equals(mine, checksum))
+                conflict = true;
         }
+        das_.AddCount(slot, xcount);
+    });
+    if (conflict) {
+        *err = "conflicting checksum";
         return false;
     }
-    bool IsCompatible(int version) const {
-        return version_ == VERSION_UNSET || (version_ != VERSION_UNSET && version_ == version);
+
+    branches_.Merge(other.branches_);
+    // The content is shared with a copy, which may be the only record left of
+    // the file, so that it's found by DropChangedSources() as well.
+    if (!src_ && other.src_) {
+        src_ = other.src_;
+        arena_->Retain(src_->shared_from_this());
+    }
+    return true;
+}
+
+bool SourceFileInfo::CheckMerge(const SourceFileInfo& other, std::string* err) const
+{
+    if (other.version_ != VERSION_UNSET && !IsCompatible(other.version_)) {
+        *err = "conflicting version IDs";
+        return false;
     }
-    enum { VERSION_UNSET = -1, VERSION_INVALID = INT_MAX };
 
-private:
-    std::string sfname_; // basename
-    std::string fullpath_;
-    std::string content_;
-    std::unordered_map<std::string, FunctionCoverageInfo> funcs_;
-    std::vector<LineCoverageInfo> das_;
-    std::vector<LineBranchCoverage> branches_;
-    enum { LINEMAP_UNKNOWN, LINEMAP_LOADED, LINEMAP_ON_ERROR };
-    std::vector<uint32_t> linemap_;
-    int version_ = -1;
-};
+    for (const auto& rec : other.funcs_) {
+        auto it = funcs_.find(rec.first);
+        if (it != funcs_.cend() &&
+            (it->second.lineno_ != rec.second.lineno_ || it->second.is_private_ != rec.second.is_private_)) {
+            *err = "conflicting function definitions";
+            return false;
+        }
+    }
 
-struct FunctionCoverageInfo {
-    FunctionCoverageInfo() = default;
+    bool conflict = false;
+    other.das_.ForEach([&](uint32_t lineno, uint32_t, const uint8_t* checksum) {
+        uint32_t xcount;
+        const uint8_t* mine;
+        if (checksum && das_.Lookup(lineno, &xcount, &mine) && mine && !MD5Hash::Equals(mine, checksum))
+            conflict = true;
+    });
+    if (conflict) {
+        *err = "conflicting checksum";
+        return false;
+    }
+    return true;
+}
 
-    uint32_t lineno_ = 0;
-    uint32_t xcount_ = 0;
-    bool is_private_ = false;
-};
+void LineCoverageTable::Save(SnapshotWriter* w) const
+{
+    w->WriteU32(dense_);
+    w->WriteArray(lines_);
+    w->WriteArray(counts_);
+    w->WriteArray(defined_);
+    w->WriteArray(has_checksum_);
+    w->WriteArray(checksums_);
+}
+
+bool LineCoverageTable::Load(SnapshotReader* r, bool discard_checksum)
+{
+    uint32_t dense;
+    if (!r->ReadU32(&dense) || !r->ReadArray(&lines_) || !r->ReadArray(&counts_) || !r->ReadArray(&defined_) ||
+        !r->ReadArray(&has_checksum_) || !r->ReadArray(&checksums_))
+        return false;
 
-struct LineCoverageInfo {
-    LineCoverageInfo() {
-        xcount_ = 0;
-        is_defined_ = false;
-        has_checksum_ = false;
+    size_t nwords = (counts_.size() + 63) / 64;
+    if (dense > 1 || has_checksum_.size() != nwords ||
+        (!checksums_.empty() && checksums_.size() != counts_.size() * MD5Hash::Length))
+        return false;
+    dense_ = dense;
+    if (dense_) {
+        if (!lines_.empty() || defined_.size() != nwords || (nwords && BitmapTest(defined_, 0)))
+            return false;
+        size_ = 0;
+        for (uint64_t word : defined_)
+            size_ += __builtin_popcountll(word);
+    } else {
+        if (!defined_.empty() || lines_.size() != counts_.size())
+            return false;
+        for (size_t i = 0; i < lines_.size(); i++) {
+            if (lines_[i] == 0 || (i > 0 && lines_[i - 1] >= lines_[i]))
+                return false;
+        }
+        size_ = lines_.size();
     }
-    uint32_t xcount_;
-    uint8_t checksum_[MD5Hash::Length];
-    uint8_t is_defined_:1;
-    uint8_t has_checksum_:1;
-};
+    // Bits past the last slot must be clear, a line with a checksum has one.
+    for (size_t i = counts_.size(); i < nwords * 64; i++) {
+        if (BitmapTest(has_checksum_, i) || (dense_ && BitmapTest(defined_, i)))
+            return false;
+    }
+    if (checksums_.empty() && std::any_of(has_checksum_.begin(), has_checksum_.end(), [](uint64_t w) { return w; }))
+        return false;
+    if (discard_checksum) {
+        std::fill(has_checksum_.begin(), has_checksum_.end(), 0);
+        checksums_.clear();
+    }
+    hint_ = 0;
+    return true;
+}
 
-// lcov parser
-struct LcovParser {
+void BranchCoverageTable::Save(SnapshotWriter* w) const
+{
+    w->WriteArray(rows_);
+    w->WriteArray(offsets_);
+    w->WriteArray(counts_);
+    w->WriteArray(defined_);
+    w->WriteArray(executed_);
+}
 
-    struct Config {
-        Config() : discard_checksum_(false), generate_checksum_(false) {}
-        uint32_t discard_checksum_:1;
-        uint32_t generate_checksum_:1;
-    };
+bool BranchCoverageTable::Load(SnapshotReader* r)
+{
+    if (!r->ReadArray(&rows_) || !r->ReadArray(&offsets_) || !r->ReadArray(&counts_) ||
+        !r->ReadArray(&defined_) || !r->ReadArray(&executed_))
+        return false;
 
-    LcovParser(Config& config) : cfg_(config) {};
-    ~LcovParser() {
-        for (auto tp : tests_)
-            delete tp.second;
+    size_t nwords = (counts_.size() + 63) / 64;
+    if (offsets_.size() != rows_.size() + 1 || offsets_[0] != 0 || offsets_.back() != counts_.size() ||
+        defined_.size() != nwords || executed_.size() != nwords)
+        return false;
+    for (size_t i = 0; i < rows_.size(); i++) {
+        if (offsets_[i] > offsets_[i + 1] || rows_[i].lineno_ == 0 || (i > 0 && !(rows_[i - 1] < rows_[i])))
+            return false;
+    }
+    // Bits past the last slot must be clear, as in LineCoverageTable::Load().
+    for (size_t i = counts_.size(); i < nwords * 64; i++) {
+        if (BitmapTest(defined_, i) || BitmapTest(executed_, i))
+            return false;
     }
+    hint_ = 0;
+    return true;
+}
 
-    bool Parse(IFilesystem* fs, const char* fpath);
-    const std::unordered_map<std::string_view,LcovTestRecord*>& GetTestRecords() const { return tests_; }
+void SourceFileInfo::Save(SnapshotWriter* w) const
+{
+    w->WriteU32(static_cast<uint32_t>(version_));
+    w->WriteU32(funcs_.size());
+    for (const auto& rec : funcs_) {
+        w->WriteString(rec.first);
+        w->WriteU32(rec.second.lineno_);
+        w->WriteU32(rec.second.xcount_);
+        w->WriteU32(rec.second.is_private_);
+    }
+    das_.Save(w);
+    branches_.Save(w);
+}
 
-private:
-    typedef bool (*RecordHandler)(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerSF(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerFN(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerFNDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerBRDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerEOR(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-    static bool HandlerVER(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-
-    // NOTE: FNF, FNH, BRF, BRH, LF and LH take only one integer argument and we don't really
-    // care about their values, cause those records will be recalculated anyway.
-    // This special handler does nothing more than basic validation.
-    static bool HandlerNFNH(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
-
-    static constexpr RecordHandler kHandlers_[LcovRecordType::LAST_RECORD_TYPE] = {
-        nullptr, // UNKNOWN
-        nullptr, // TN
-        HandlerSF,
-        HandlerVER,
-        HandlerFN,
-        HandlerFNDA,
-        HandlerNFNH, //HandlerFNF,
-        HandlerNFNH, //HandlerFNH,
-        HandlerDA,
-        HandlerBRDA,
-        HandlerNFNH, //HandlerBRF,
-        HandlerNFNH, //HandlerBRH,
-        HandlerNFNH, //HandlerLF,
-        HandlerNFNH, //HandlerLH,
-        HandlerEOR,
-    };
+bool SourceFileInfo::Load(SnapshotReader* r, bool discard_checksum)
+{
+    uint32_t version, nfuncs;
+    if (!r->ReadU32(&version) || !r->ReadU32(&nfuncs))
+        return false;
+    version_ = static_cast<int>(version);
+    funcs_.reserve(nfuncs);
+    for (uint32_t i = 0; i < nfuncs; i++) {
+        std::string_view name;
+        uint32_t is_private;
+        FunctionCoverageInfo func;
+        if (!r->ReadString(&name) || !r->ReadU32(&func.lineno_) || !r->ReadU32(&func.xcount_) ||
+            !r->ReadU32(&is_private) || is_private > 1)
+            return false;
+        func.is_private_ = is_private;
+        if (!GetFunction(name, func).second)
+            return false;
+    }
+    return das_.Load(r, discard_checksum) && branches_.Load(r);
+}
 
-    LcovTestRecord* current_test_ = nullptr;
-    std::unordered_map<std::string_view,LcovTestRecord*> tests_;
-    Config cfg_;
-};
+void SourceFileInfo::AddTableStats(RecordTableStats* ts) const
+{
+    ts->functions_.Add(funcs_);
+    ts->lines_ += das_.GetLineCount();
+    ts->dense_line_tables_ += das_.IsDense();
+    branches_.ForEach([ts](uint32_t, uint32_t, uint32_t, uint32_t) { ts->branches_++; });
+}
 
-struct LineParser {
+void SourceFileInfo::AddToSummary(SourceFileSummary* summary) const
+{
+    for (const auto& rec : funcs_)
+        summary->AddFunction(rec.first, rec.second.xcount_ != 0);
+    das_.ForEach([summary](uint32_t lineno, uint32_t xcount, const uint8_t*) { summary->AddLine(lineno, xcount); });
+    branches_.ForEach([summary](uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount) {
+        summary->AddBranch({lineno, blkno, brno}, xcount && xcount != BranchCoverageTable::NEVER_EXECUTED);
+    });
+}
 
-    LineParser(const char* buf, size_t len) : p_(buf), q_(buf+len) {}
+void CoverageCounts::Add(const CoverageCounts& other)
+{
+    lines_found_ += other.lines_found_;
+    lines_hit_ += other.lines_hit_;
+    functions_found_ += other.functions_found_;
+    functions_hit_ += other.functions_hit_;
+    branches_found_ += other.branches_found_;
+    branches_hit_ += other.branches_hit_;
+}
 
-    LcovRecordType ParseRecordType();
-    bool ParseRecordArguments(LcovRecordArgList* args, std::string* err);
+void SourceFileSummary::AddLine(uint32_t lineno, bool hit)
+{
+    if (lineno >= kMaxBitmapLine) {
+        far_lines_[lineno] |= hit;
+        return;
+    }
+    if (lineno / 64 >= found_lines_.size()) {
+        GrowTo(&found_lines_, lineno / 64 + 1);
+        GrowTo(&hit_lines_, lineno / 64 + 1);
+    }
+    BitmapSet(&found_lines_, lineno);
+    if (hit)
+        BitmapSet(&hit_lines_, lineno);
+}
 
-private:
-    const char* p_;
-    const char* q_;
-};
+void SourceFileSummary::AddFunction(std::string_view name, bool hit)
+{
+    auto it = functions_.find(name);
+    if (it == functions_.end())
+        functions_.emplace(arena_->Intern(name), hit);
+    else
+        it->second |= hit;
+}
 
-#ifndef LCOVMERGE_DEFINITION_ONLY
+bool SourceFileSummary::HitFunction(std::string_view name)
+{
+    auto it = functions_.find(name);
+    if (it == functions_.end())
+        return false;
+    it->second = true;
+    return true;
+}
 
-// Helper functions
-static uint32_t StrToUnsigned32(std::string_view str, uint32_t fallback)
+void SourceFileSummary::Merge(const SourceFileSummary& other)
 {
-    char* endp = nullptr;
-    uint32_t res;
+    if (other.found_lines_.size() > found_lines_.size()) {
+        found_lines_.resize(other.found_lines_.size(), 0);
+        hit_lines_.resize(other.found_lines_.size(), 0);
+    }
+    for (size_t i = 0; i < other.found_lines_.size(); i++) {
+        found_lines_[i] |= other.found_lines_[i];
+        hit_lines_[i] |= other.hit_lines_[i];
+    }
+    for (const auto& rec : other.far_lines_)
+        far_lines_[rec.first] |= rec.second;
+    for (const auto& rec : other.functions_)
+        AddFunction(rec.first, rec.second);
+    for (const auto& rec : other.branches_)
+        AddBranch(rec.first, rec.second);
+}
 
-    if (str.size() > MAX_NDIGITS || str.at(0) == '-')
-        return fallback;
-    res = strtoul(str.data(), &endp, 10);
+CoverageCounts SourceFileSummary::GetCounts() const
+{
+    CoverageCounts counts;
+    for (size_t i = 0; i < found_lines_.size(); i++) {
+        counts.lines_found_ += __builtin_popcountll(found_lines_[i]);
+        counts.lines_hit_ += __builtin_popcountll(hit_lines_[i]);
+    }
+    counts.lines_found_ += far_lines_.size();
+    for (const auto& rec : far_lines_)
+        counts.lines_hit_ += rec.second;
+    counts.functions_found_ = functions_.size();
+    for (const auto& rec : functions_)
+        counts.functions_hit_ += rec.second;
+    counts.branches_found_ = branches_.size();
+    for (const auto& rec : branches_)
+        counts.branches_hit_ += rec.second;
+    return counts;
+}
 
-    return endp - str.data() == str.length() ? res : fallback;
+SourceCache& SourceCache::Instance()
+{
+    static SourceCache cache;
+    return cache;
 }
 
-static int FindChar(const char* p, size_t len, char ch)
+std::shared_ptr<SourceContent> SourceCache::Get(IFilesystem* fs, std::string_view sfpath)
 {
-    int res;
-    for (res = 0; res < len; res++) {
-        if (p[res] == ch)
+    std::shared_ptr<SourceContent> res;
+    std::string path(sfpath);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = namespaces_[fs].paths_.find(path);
+        if (it != namespaces_[fs].paths_.cend() && (res = it->second.lock()))
             return res;
     }
-    return -1;
+
+    // Resolve the path without holding the lock, this may hit the filesystem.
+    std::string canonical = fs->GetCanonicalPath(path.c_str());
+
+    std::lock_guard<std::mutex> guard(lock_);
+    Namespace& ns = namespaces_[fs];
+    auto& entry = ns.canonical_[canonical];
+    res = entry.lock();
+    if (!res) {
+        res = std::make_shared<SourceContent>();
+        entry = res;
+    }
+    ns.paths_[path] = res;
+    return res;
+}
+
+void SourceCache::Forget(IFilesystem* fs)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    namespaces_.erase(fs);
 }
 
-template<class Tv, class... Args>
-static typename std::vector<Tv>::iterator VectorExtendToPos(std::vector<Tv>* vec, size_t pos, Args&& ...args)
+void SourceCache::Invalidate(IFilesystem* fs, std::vector<std::shared_ptr<SourceContent>>* stale)
 {
-    if (pos < vec->size())
-        return vec->begin() + pos;
-    vec->reserve(pos + 1);
-    size_t n = pos - vec->size() + 1;
-    while (n--) {
-        vec->push_back({args...});
+    std::vector<std::pair<std::string, std::shared_ptr<SourceContent>>> cached;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (const auto& entry : namespaces_[fs].canonical_) {
+            if (auto content = entry.second.lock())
+                cached.emplace_back(entry.first, std::move(content));
+        }
+    }
+
+    // Check the files without holding the lock, this hits the filesystem.
+    std::unordered_set<SourceContent*> changed;
+    for (const auto& entry : cached) {
+        if (entry.second->HasChanged(fs, entry.first.c_str()))
+            changed.insert(entry.second.get());
+    }
+    if (changed.empty())
+        return;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    Namespace& ns = namespaces_[fs];
+    for (Table* table : { &ns.paths_, &ns.canonical_ }) {
+        for (auto it = table->begin(); it != table->end(); ) {
+            auto content = it->second.lock();
+            if (!content || changed.count(content.get()))
+                it = table->erase(it);
+            else
+                ++it;
+        }
+    }
+    for (auto& entry : cached) {
+        if (changed.count(entry.second.get()))
+            stale->push_back(std::move(entry.second));
     }
-    return vec->end() - 1;
 }
 
-static const char* RecordType2Str(LcovRecordType type)
+bool SourceContent::Load(IFilesystem* fs, const char* path, std::string* err)
 {
-    switch (type) {
-        case LcovRecordType::UNKNOWN: return "<unknown>";
-        case LcovRecordType::TN: return "<TN>";
-        case LcovRecordType::SF: return "<SF>";
-        case LcovRecordType::VER: return "<VER>";
-        case LcovRecordType::FN: return "<FN>";
-        case LcovRecordType::FNDA: return "<FNDA>";
-        case LcovRecordType::FNF: return "<FNF>";
-        case LcovRecordType::FNH: return "<FNH>";
-        case LcovRecordType::DA: return "<DA>";
-        case LcovRecordType::BRDA: return "<BRDA>";
-        case LcovRecordType::BRF: return "<BRF>";
-        case LcovRecordType::BRH: return "<BRH>";
-        case LcovRecordType::LF: return "<LF>";
-        case LcovRecordType::LH: return "<LH>";
-        case LcovRecordType::END_OF_RECORD: return "<end_of_record>";
-        default:
-            break;
+    std::call_once(load_once_, [&]() {
+        ScopedStatsTimer timer(Stats::SOURCE_LOAD_NS);
+        linemap_.push_back(0); // unused
+        // Taken before reading, a write in between is seen as a change later.
+        if (fs->GetModificationTime(path, &mtime_, &error_) != IFilesystem::SUCCESS)
+            mtime_ = -1;
+        switch (fs->MapFile(path, &view_, &error_)) {
+            case IFilesystem::SUCCESS:
+                break;
+            case IFilesystem::NOT_FOUND:
+            case IFilesystem::IO_ERROR:
+                view_.reset();
+                status_ = ON_ERROR;
+                return;
+        }
+        content_ = view_->GetData();
+        Stats::Add(Stats::SOURCE_FILES, 1);
+        Stats::Add(Stats::SOURCE_BYTES, content_.size());
+
+        const char* p = content_.data();
+        const char* q = p + content_.size();
+
+        linemap_.push_back(0); // the first line always begins at offset 0
+        while (p < q) {
+            const char* nl = static_cast<const char*>(::memchr(p, '\n', q - p));
+            p = nl ? nl + 1 : q; // 1 for newline itself
+            linemap_.push_back(p - content_.data());
+        }
+        status_ = LOADED;
+    });
+
+    if (status_ != LOADED) {
+        err->assign(error_);
+        return false;
+    }
+    err->clear();
+    return true;
+}
+
+bool SourceContent::HasChanged(IFilesystem* fs, const char* path) const
+{
+    if (status_ == UNKNOWN)
+        return false;
+    int64_t mtime;
+    std::string err;
+    if (fs->GetModificationTime(path, &mtime, &err) != IFilesystem::SUCCESS)
+        mtime = -1;
+    return mtime != mtime_;
+}
+
+std::string_view SourceContent::ReadLineData(uint32_t lineno, bool no_newline) const
+{
+    assert(IsLoaded() && lineno > 0 && lineno <= GetLineCount());
+    auto line = content_.substr(linemap_[lineno], linemap_[lineno + 1] - linemap_[lineno]);
+    if (no_newline)
+        line = line.substr(0, line.find_first_of("\r\n"));
+    return line;
+}
+
+const uint8_t* SourceContent::GetLineChecksum(uint32_t lineno)
+{
+    assert(IsLoaded() && lineno > 0 && lineno <= GetLineCount());
+    std::call_once(checksum_once_, [this]() {
+        ScopedStatsTimer timer(Stats::CHECKSUM_NS);
+        std::vector<std::string_view> lines;
+        lines.reserve(GetLineCount() + 1);
+        lines.push_back({}); // there's no line 0, hash it anyway to keep the table indexed by lineno
+        for (uint32_t l = 1; l <= GetLineCount(); l++)
+            lines.push_back(ReadLineData(l, /* no_newline? */false));
+        checksums_.resize(lines.size() * MD5Hash::Length);
+        MD5Hash::HashMany(lines.data(), lines.size(),
+                          reinterpret_cast<uint8_t (*)[MD5Hash::Length]>(checksums_.data()));
+    });
+    return &checksums_[lineno * MD5Hash::Length];
+}
+
+// Reads the sources named by the SF records of a tracefile on a WorkQueue while
+// it is being parsed. The parser loads a source through the same SourceContent,
+// so it only waits for one whose read is in progress. The prefetched contents
+// are held until the prefetcher goes away, the parser retains its own. The
+// tracefile is scanned for SF records on a thread of its own, so that all
+// threads of the queue read sources from the start.
+struct SourcePrefetcher {
+
+    SourcePrefetcher(IFilesystem* fs, std::string_view data, const LcovParser::Config& config)
+        : fs_(fs), queue_(config.prefetch_jobs_), scanner_([this, data, config]() { Scan(data, config); }) {}
+    ~SourcePrefetcher() {
+        done_ = true;
+        scanner_.join();
+    }
+
+private:
+    void Scan(std::string_view data, const LcovParser::Config& config) {
+        for (size_t pos = 0; pos < data.size() && !done_.load(std::memory_order_relaxed); ) {
+            size_t eol = data.find('\n', pos);
+            if (eol == std::string_view::npos)
+                eol = data.size();
+            std::string_view line = data.substr(pos, eol - pos);
+            pos = eol + 1;
+            if (line.substr(0, 3) != "SF:")
+                continue;
+            line = line.substr(3, line.find_last_not_of('\r') - 2);
+            std::string buf;
+            if (line.empty() || !config.SelectSourceFile(&line, &buf))
+                continue;
+            queue_.Submit([this, path = std::string(line)]() { Load(path); });
+        }
+    }
+
+    void Load(const std::string& path) {
+        auto src = SourceCache::Instance().Get(fs_, path);
+        std::string err;
+        (void)src->Load(fs_, path.c_str(), &err); // failures are reported by the parser
+        std::lock_guard<std::mutex> guard(lock_);
+        loaded_.push_back(std::move(src));
+    }
+
+    IFilesystem* fs_;
+    std::mutex lock_;
+    std::vector<std::shared_ptr<SourceContent>> loaded_;
+    WorkQueue queue_; // the tasks use the members above
+    std::atomic<bool> done_{false}; // the parser is done
+    std::thread scanner_;
+};
+
+std::string_view SourceFileInfo::ReadLineData(uint32_t lineno, bool no_newline) const
+{
+    assert(IsLineDataAvailable() == true);
+    assert(IsLineNumberInRange(lineno) == true);
+    return src_->ReadLineData(lineno, no_newline);
+}
+
+const uint8_t* SourceFileInfo::GetLineChecksum(uint32_t lineno) const
+{
+    assert(IsLineDataAvailable() == true);
+    assert(IsLineNumberInRange(lineno) == true);
+    return src_->GetLineChecksum(lineno);
+}
+
+bool SourceFileInfo::LoadLineMap(IFilesystem* fs, std::string* err)
+{
+    assert(fs != nullptr);
+    if (!src_) {
+        auto src = SourceCache::Instance().Get(fs, fullpath_);
+        src_ = src.get();
+        arena_->Retain(std::move(src));
+    }
+    return src_->Load(fs, fullpath_.data(), err);
+}
+
+
+FunctionCoverageInfo* SourceFileInfo::LookupFunction(std::string_view name)
+{
+    auto it = funcs_.find(name);
+    if (it != funcs_.cend())
+        return &it->second;
+    return nullptr;
+}
+
+template<typename... Targs>
+std::pair<FunctionCoverageInfo*, bool> SourceFileInfo::GetFunction(std::string_view name, Targs &&...args)
+{
+    auto it = funcs_.find(name);
+    if (it != funcs_.cend())
+        return std::make_pair(&it->second, false);
+    // `name` usually points into the tracefile, keep a copy of it.
+    auto v = funcs_.emplace(arena_->Intern(name), args...);
+    return std::make_pair(&v.first->second, true);
+}
+
+size_t LineCoverageTable::FindSlot(uint32_t lineno) const
+{
+    assert(!dense_);
+    if (hint_ < lines_.size() && lines_[hint_] == lineno)
+        return hint_;
+    if (hint_ + 1 < lines_.size() && lines_[hint_ + 1] == lineno)
+        return hint_ + 1;
+    if (lines_.empty() || lines_.back() < lineno)
+        return lines_.size();
+    return std::lower_bound(lines_.begin(), lines_.end(), lineno) - lines_.begin();
+}
+
+void LineCoverageTable::InsertSlot(size_t pos, uint32_t lineno)
+{
+    BitmapInsert(&has_checksum_, counts_.size(), pos, 1);
+    lines_.insert(lines_.begin() + pos, lineno);
+    counts_.insert(counts_.begin() + pos, 0);
+    if (!checksums_.empty())
+        checksums_.insert(checksums_.begin() + pos * MD5Hash::Length, MD5Hash::Length, 0);
+}
+
+void LineCoverageTable::Resize(size_t nlines)
+{
+    assert(dense_ && nlines >= counts_.size());
+    GrowTo(&counts_, nlines);
+    defined_.resize((nlines + 63) / 64, 0);
+    has_checksum_.resize((nlines + 63) / 64, 0);
+    if (!checksums_.empty())
+        GrowTo(&checksums_, nlines * MD5Hash::Length);
+}
+
+void LineCoverageTable::Relayout(bool dense)
+{
+    LineCoverageTable res(counts_.get_allocator().resource());
+
+    res.dense_ = dense;
+    if (dense)
+        res.Resize(lines_.back() + 1);
+    else {
+        res.lines_.reserve(size_);
+        res.counts_.reserve(size_);
+    }
+    ForEach([&](uint32_t lineno, uint32_t xcount, const uint8_t* checksum) {
+        uint32_t slot = lineno;
+        if (dense)
+            BitmapSet(&res.defined_, lineno);
+        else {
+            slot = res.counts_.size();
+            res.InsertSlot(slot, lineno);
+        }
+        res.counts_[slot] = xcount;
+        if (checksum)
+            res.SetChecksum(slot, checksum);
+    });
+    res.size_ = size_;
+    *this = std::move(res);
+}
+
+uint32_t LineCoverageTable::Define(uint32_t lineno)
+{
+    assert(lineno != 0 && "bug: invalid lineno");
+    if (dense_) {
+        if (lineno >= counts_.size()) {
+            // Stay dense as long as a quarter of the lines are defined.
+            if (static_cast<uint64_t>(size_ + 1) * 4 > lineno)
+                Resize(lineno + 1);
+            else
+                Relayout(false);
+        }
+    }
+    if (dense_) {
+        if (!BitmapTest(defined_, lineno)) {
+            BitmapSet(&defined_, lineno);
+            size_++;
+        }
+        return lineno;
+    }
+
+    size_t pos = FindSlot(lineno);
+    if (pos == lines_.size() || lines_[pos] != lineno) {
+        InsertSlot(pos, lineno);
+        size_++;
+        if (size_ >= kMinDenseLines && static_cast<uint64_t>(size_) * 2 > lines_.back()) {
+            Relayout(true);
+            return lineno;
+        }
+    }
+    hint_ = pos;
+    return pos;
+}
+
+bool LineCoverageTable::Lookup(uint32_t lineno, uint32_t* xcount, const uint8_t** checksum) const
+{
+    size_t slot = lineno;
+    if (dense_) {
+        if (lineno >= counts_.size() || !BitmapTest(defined_, lineno))
+            return false;
+    } else {
+        slot = FindSlot(lineno);
+        if (slot == lines_.size() || lines_[slot] != lineno)
+            return false;
+    }
+    *xcount = counts_[slot];
+    if (checksum)
+        *checksum = GetChecksum(slot);
+    return true;
+}
+
+void LineCoverageTable::SetChecksum(uint32_t slot, const uint8_t* checksum)
+{
+    if (checksums_.empty())
+        checksums_.resize(counts_.size() * MD5Hash::Length, 0);
+    (void)memcpy(&checksums_[slot * MD5Hash::Length], checksum, MD5Hash::Length);
+    BitmapSet(&has_checksum_, slot);
+}
+
+void SourceFileInfo::AddBranchCoverage(uint32_t lineno, uint32_t blkId, uint32_t branchId, uint32_t xcount)
+{
+    assert(IsLineNumberInRange(lineno) && "bug: invalid line number");
+    assert(blkId < INVALID_BLOCK_ID && branchId < INVALID_BRANCH_ID);
+    branches_.Add(lineno, blkId, branchId, xcount);
+}
+
+size_t BranchCoverageTable::FindRow(uint32_t lineno, uint32_t blkno) const
+{
+    Row key{lineno, blkno};
+    if (hint_ < rows_.size() && rows_[hint_] == key)
+        return hint_;
+    if (hint_ + 1 < rows_.size() && rows_[hint_ + 1] == key)
+        return hint_ + 1;
+    if (rows_.empty() || rows_.back() < key)
+        return rows_.size();
+    return std::lower_bound(rows_.begin(), rows_.end(), key) - rows_.begin();
+}
+
+size_t BranchCoverageTable::GetSlot(uint32_t lineno, uint32_t blkno, uint32_t brno)
+{
+    Row key{lineno, blkno};
+    size_t r = FindRow(lineno, blkno);
+    if (r == rows_.size() || !(rows_[r] == key)) {
+        rows_.insert(rows_.begin() + r, key);
+        offsets_.insert(offsets_.begin() + r, offsets_[r]);
+    }
+    hint_ = r;
+
+    uint32_t width = offsets_[r + 1] - offsets_[r];
+    if (brno >= width) {
+        // Widen the row, the slots after it move back.
+        size_t pos = offsets_[r + 1], n = brno + 1 - width;
+        BitmapInsert(&defined_, counts_.size(), pos, n);
+        BitmapInsert(&executed_, counts_.size(), pos, n);
+        counts_.insert(counts_.begin() + pos, n, 0);
+        for (size_t i = r + 1; i < offsets_.size(); i++)
+            offsets_[i] += n;
+    }
+    return offsets_[r] + brno;
+}
+
+void BranchCoverageTable::Add(uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount)
+{
+    size_t i = GetSlot(lineno, blkno, brno);
+    BitmapSet(&defined_, i);
+    if (xcount == NEVER_EXECUTED)
+        return;
+    if (BitmapTest(executed_, i))
+        counts_[i] += xcount;
+    else {
+        counts_[i] = xcount;
+        BitmapSet(&executed_, i);
+    }
+}
+
+size_t BranchCoverageTable::CountLineSlots(uint32_t lineno, uint32_t blkno, uint32_t brno) const
+{
+    size_t n = 0;
+    bool found = false;
+    for (size_t r = FindRow(lineno, 0); r < rows_.size() && rows_[r].lineno_ == lineno; r++) {
+        size_t width = offsets_[r + 1] - offsets_[r];
+        if (rows_[r].blkno_ == blkno) {
+            width = std::max<size_t>(width, brno + 1);
+            found = true;
+        }
+        n += width;
+    }
+    return found ? n : n + brno + 1;
+}
+
+bool BranchCoverageTable::Lookup(uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t* xcount) const
+{
+    size_t r = FindRow(lineno, blkno);
+    if (r == rows_.size() || !(rows_[r] == Row{lineno, blkno}) || brno >= offsets_[r + 1] - offsets_[r])
+        return false;
+    size_t i = offsets_[r] + brno;
+    if (!BitmapTest(defined_, i))
+        return false;
+    *xcount = BitmapTest(executed_, i) ? counts_[i] : static_cast<uint32_t>(NEVER_EXECUTED);
+    return true;
+}
+
+void BranchCoverageTable::Merge(const BranchCoverageTable& other)
+{
+    other.ForEach([this](uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount) {
+        Add(lineno, blkno, brno, xcount);
+    });
+}
+
+LcovRecordType LineParser::ParseRecordType()
+{
+    int sep = fields_.colon_;
+    const char* p = line_.data();
+    LcovRecordType res = LcovRecordType::UNKNOWN;
+
+    switch (sep) {
+        case 2:
+            if (p[0] == 'T' && p[1] == 'N')
+                res = LcovRecordType::TN;
+            else if (p[0] == 'S' && p[1] == 'F')
+                res = LcovRecordType::SF;
+            else if (p[0] == 'F' && p[1] == 'N')
+                res = LcovRecordType::FN;
+            else if (p[0] == 'D' && p[1] == 'A')
+                res = LcovRecordType::DA;
+            else if (p[0] == 'L' && p[1] == 'F')
+                res = LcovRecordType::LF;
+            else if (p[0] == 'L' && p[1] == 'H')
+                res = LcovRecordType::LH;
+            break;
+
+        case 3:
+            if (!strncmp(p, "FNF", 3))
+                res = LcovRecordType::FNF;
+            else if (!strncmp(p, "FNH", 3))
+                res = LcovRecordType::FNH;
+            else if (!strncmp(p, "BRF", 3))
+                res = LcovRecordType::BRF;
+            else if (!strncmp(p, "BRH", 3))
+                res = LcovRecordType::BRH;
+            else if (!strncmp(p, "VER", 3))
+                res = LcovRecordType::VER;
+            break;
+
+        case 4:
+            if (!strncmp(p, "FNDA", 4))
+                res = LcovRecordType::FNDA;
+            else if (!strncmp(p, "BRDA", 4))
+                res = LcovRecordType::BRDA;
+            break;
+
+        default:
+            break;
+    }
+
+    if (res == LcovRecordType::UNKNOWN && line_.size() >= 13 && !strncmp(p, "end_of_record", 13)) {
+        pos_ = 13;
+        return LcovRecordType::END_OF_RECORD;
+    }
+
+    pos_ = sep + 1;
+    return res;
+}
+
+bool LineParser::ParseRecordArguments(LcovRecordArgList* args, std::string* err)
+{
+    args->clear();
+    *err = "";
+    if (pos_ < line_.size() && line_[pos_] == ':') {
+        *err = "unexpected ':' after the record type";
+        return false;
+    }
+
+    // Only the commas after the beginning of the arguments separate them.
+    uint32_t c = 0;
+    uint32_t ncommas = std::min<uint32_t>(fields_.ncommas_, LineFields::kMaxCommas);
+    while (c < ncommas && fields_.commas_[c] < pos_)
+        c++;
+
+    for (size_t start = pos_; start < line_.size(); ) {
+        if (args->size() == 4) {
+            *err = "too many arguments (max: 4)";
+            return false;
+        }
+        size_t end = c < ncommas ? fields_.commas_[c++] : line_.size();
+        if (end == start) {
+            *err = "trailing commas";
+            return false;
+        }
+        args->push_back(line_.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+bool LineReader::Refill(std::string* err)
+{
+    // Move the incomplete line to the front and fill up the rest of the buffer.
+    size_t keep = data_.size();
+    size_t offset = keep ? data_.data() - buffer_.data() : 0;
+    if (buffer_.empty())
+        buffer_.resize(chunk_size_);
+    else if (keep == buffer_.size()) {
+        if (buffer_.size() >= kMaxLineLength) {
+            *err = "line too long";
+            return false;
+        }
+        buffer_.resize(buffer_.size() * 2);
+    }
+    if (offset)
+        (void)memmove(buffer_.data(), buffer_.data() + offset, keep);
+
+    size_t nread = 0;
+    if (stream_->Read(buffer_.data() + keep, buffer_.size() - keep, &nread, err) != IFilesystem::SUCCESS)
+        return false;
+    eof_ = nread == 0;
+    bytes_read_ += nread;
+    data_ = std::string_view(buffer_.data(), keep + nread);
+    return true;
+}
+
+int LineReader::NextLine(std::string_view* line, LineFields* fields, std::string* err)
+{
+    const char* start = data_.data();
+    size_t len;
+
+    fields->Reset();
+    for (;;) {
+        while (!mask_) {
+            const char* end = data_.data() + data_.size();
+            if (scan_ < end) {
+                size_t blklen = std::min<size_t>(end - scan_, kScanBlockSize);
+                block_ = scan_;
+                mask_ = ::ScanStructural(scan_, blklen);
+                scan_ += blklen;
+                continue;
+            }
+            if (!stream_ || eof_) {
+                // The last line has no line terminator.
+                if (data_.empty())
+                    return 0;
+                len = data_.size();
+                goto found;
+            }
+            // The line continues in the next chunk, classify it again once it
+            // has been moved to the front of the buffer.
+            if (!Refill(err))
+                return -1;
+            start = scan_ = data_.data();
+            fields->Reset();
+        }
+
+        const char* ch = block_ + __builtin_ctzll(mask_);
+        uint32_t off = ch - start;
+        mask_ &= mask_ - 1;
+        if (*ch == '\n') {
+            len = off;
+            break;
+        } else if (*ch == ':') {
+            if (fields->colon_ < 0) {
+                fields->colon_ = off;
+                fields->ncommas_ = 0;
+            }
+        } else {
+            if (fields->ncommas_ < LineFields::kMaxCommas)
+                fields->commas_[fields->ncommas_] = off;
+            fields->ncommas_++;
+        }
+    }
+
+found:
+    *line = data_.substr(0, len);
+    data_.remove_prefix(std::min(data_.size(), len + 1));
+    if (!line->empty() && line->back() == '\r')
+        line->remove_suffix(1);
+    return 1;
+}
+
+bool LcovParser::Parse(IFilesystem* fs, const char* fpath)
+{
+    // A bad input is dropped as a whole in keep-going mode, so it's parsed on
+    // its own first. Like in the parts of a tracefile, its records before the
+    // first TN belong to our current test.
+    if (cfg_.KeepsGoing() && !isolated_) {
+        LcovParser input(cfg_);
+        input.isolated_ = true;
+        input.continuation_ = true;
+        if (!input.Parse(fs, fpath)) {
+            QuarantineRecord rec;
+            rec.input_ = fpath;
+            rec.error_ = GetLastReportedError();
+            quarantine_.push_back(std::move(rec));
+            return true;
+        }
+        std::string err;
+        LcovTestRecord* current = current_test_;
+        quarantine_.insert(quarantine_.end(), input.quarantine_.begin(), input.quarantine_.end());
+        input.quarantine_.clear();
+        size_t first = quarantine_.size();
+        if (input.inherited_) {
+            if (!current)
+                current = GetRecordBeforeTN(fs);
+            current->Merge(input.inherited_, &err, &quarantine_);
+        }
+        std::string_view tn;
+        bool named = input.current_test_ && input.current_test_ != input.inherited_;
+        if (named)
+            tn = input.current_test_->GetTestName();
+        if (!Merge(&input, &err)) {
+            ERROR("%s: %s\n", fpath, err.c_str());
+            return false;
+        }
+        for (size_t i = first; i < quarantine_.size(); i++)
+            quarantine_[i].input_ = fpath;
+        auto it = named ? tests_.find(tn) : tests_.end();
+        current_test_ = it != tests_.end() ? it->second : current;
+        return true;
+    }
+
+    std::string errmsg;
+    std::unique_ptr<IFilesystem::FileView> view;
+    std::unique_ptr<IFilesystem::InputStream> stream;
+    IFilesystem::Status status;
+
+    if (cfg_.streaming_ || !strcmp(fpath, "-"))
+        status = fs->OpenFile(fpath, &stream, &errmsg);
+    else
+        status = fs->MapFile(fpath, &view, &errmsg);
+    switch (status) {
+        case IFilesystem::SUCCESS:
+            break;
+        case IFilesystem::NOT_FOUND:
+        case IFilesystem::IO_ERROR:
+            ERROR("%s: %s\n", fpath, errmsg.c_str());
+            return false;
+    }
+    Stats::Add(Stats::TRACEFILE_FILES, 1);
+
+    // Streams may be compressed as well, which is only known once they're opened.
+    std::unique_ptr<DecompressingInputStream> decoded;
+    if (stream)
+        decoded.reset(new DecompressingInputStream(stream.get()));
+    else if (DetectCompression(view->GetData()) != Compression::NONE)
+        decoded.reset(new DecompressingInputStream(view->GetData()));
+    if (decoded) {
+        if (decoded->Open(&errmsg) != IFilesystem::SUCCESS) {
+            ERROR("%s: %s\n", fpath, errmsg.c_str());
+            return false;
+        }
+        std::string_view head;
+        if (decoded->GetCompression() != Compression::NONE &&
+            decoded->Peek(sizeof(kSnapshotMagic), &head, &errmsg) == IFilesystem::SUCCESS &&
+            SnapshotReader::IsSnapshot(head))
+            return LoadCompressedSnapshot(fs, fpath, decoded.get());
+        LineReader reader(decoded.get());
+        return ParseLines(fs, fpath, &reader);
+    }
+    if (SnapshotReader::IsSnapshot(view->GetData())) {
+        Stats::Add(Stats::TRACEFILE_BYTES, view->GetData().size());
+        if (!LoadSnapshot(fs, view->GetData(), &errmsg)) {
+            ERROR("%s: %s\n", fpath, errmsg.c_str());
+            return false;
+        }
+        return true;
+    }
+    std::unique_ptr<SourcePrefetcher> prefetcher;
+    if (cfg_.prefetch_jobs_ && cfg_.LoadsSourcesEagerly())
+        prefetcher.reset(new SourcePrefetcher(fs, view->GetData(), cfg_));
+    size_t nparts = std::min<size_t>(cfg_.parse_jobs_, view->GetData().size() / cfg_.min_part_size_);
+    if (nparts > 1)
+        return ParseParts(fs, fpath, SplitAtRecords(view->GetData(), nparts));
+    LineReader reader(view->GetData());
+    return ParseLines(fs, fpath, &reader);
+}
+
+std::vector<std::string_view> SplitAtRecords(std::string_view data, size_t nparts)
+{
+    static constexpr std::string_view kEndOfRecord = "\nend_of_record";
+    std::vector<std::string_view> parts;
+    size_t begin = 0;
+
+    for (size_t i = 1; i < nparts && begin < data.size(); i++) {
+        size_t pos = std::max(begin, data.size() / nparts * i);
+        // The line has to be end_of_record and nothing else.
+        for (;;) {
+            pos = data.find(kEndOfRecord, pos);
+            if (pos == std::string_view::npos)
+                break;
+            pos += kEndOfRecord.size();
+            if (pos < data.size() && data[pos] == '\r')
+                pos++;
+            if (pos == data.size() || data[pos] == '\n')
+                break;
+        }
+        if (pos == std::string_view::npos || pos + 1 >= data.size())
+            break;
+        parts.push_back(data.substr(begin, pos + 1 - begin));
+        begin = pos + 1;
+    }
+    parts.push_back(data.substr(begin));
+    return parts;
+}
+
+LcovTestRecord* LcovParser::GetTestRecord(std::string_view name, IFilesystem* fs)
+{
+    auto it = tests_.find(name);
+    if (it != tests_.cend())
+        return it->second;
+    auto* tr = arena_->New<LcovTestRecord>(arena_.get(), name, fs);
+    tests_[tr->GetTestName()] = tr;
+    return tr;
+}
+
+bool LcovParser::ParseParts(IFilesystem* fs, const char* fpath, const std::vector<std::string_view>& parts)
+{
+    // Line numbers in error messages count from the beginning of the file.
+    std::vector<uint32_t> first_lineno(parts.size(), 1);
+    ParallelFor(parts.size() - 1, cfg_.parse_jobs_, [&](unsigned, size_t i) {
+        first_lineno[i + 1] = std::count(parts[i].begin(), parts[i].end(), '\n');
+    });
+    for (size_t i = 1; i < parts.size(); i++)
+        first_lineno[i] += first_lineno[i - 1];
+
+    std::vector<LcovParser*> workers;
+    for (size_t i = 0; i < parts.size(); i++) {
+        workers.push_back(new LcovParser(cfg_));
+        workers.back()->continuation_ = true;
+    }
+    std::atomic<bool> failed{false};
+    ParallelFor(parts.size(), cfg_.parse_jobs_, [&](unsigned, size_t i) {
+        LineReader reader(parts[i]);
+        if (!failed.load(std::memory_order_relaxed) && !workers[i]->ParseLines(fs, fpath, &reader, first_lineno[i]))
+            failed = true;
+    });
+
+    std::string err;
+    bool ok = !failed;
+    if (ok && !MergeContinuations(fs, workers, cfg_.parse_jobs_, &err)) {
+        ERROR("%s: %s\n", fpath, err.c_str());
+        ok = false;
+    }
+    for (auto* worker : workers)
+        delete worker;
+    return ok;
+}
+
+bool LcovParser::ParseFiles(IFilesystem* fs, char* const* inputs, size_t ninputs, unsigned jobs)
+{
+    // Runs of consecutive inputs are parsed by parsers of their own, each of
+    // them continues where the run before it ends like the parts of a file in
+    // ParseParts(). A few runs per thread balance inputs of different sizes.
+    size_t nruns = std::min<size_t>(ninputs, static_cast<size_t>(jobs) * kRunsPerJob);
+    std::vector<LcovParser*> workers;
+    for (size_t i = 0; i < nruns; i++) {
+        workers.push_back(new LcovParser(cfg_));
+        workers.back()->continuation_ = true;
+    }
+    std::atomic<bool> failed{false};
+    ParallelFor(nruns, jobs, [&](unsigned, size_t run) {
+        for (size_t i = ninputs * run / nruns; i < ninputs * (run + 1) / nruns; i++) {
+            if (failed.load(std::memory_order_relaxed) || !workers[run]->Parse(fs, inputs[i])) {
+                failed = true;
+                return;
+            }
+        }
+    });
+
+    std::string err;
+    bool ok = !failed;
+    if (ok && !MergeContinuations(fs, workers, jobs, &err)) {
+        ERROR("E: %s\n", err.c_str());
+        ok = false;
+    }
+    for (auto* worker : workers)
+        delete worker;
+    return ok;
+}
+
+LcovTestRecord* LcovParser::GetRecordBeforeTN(IFilesystem* fs)
+{
+    if (!continuation_)
+        return GetTestRecord("", fs);
+    if (!inherited_)
+        inherited_ = arena_->New<LcovTestRecord>(arena_.get(), "", fs);
+    return inherited_;
+}
+
+bool LcovParser::MergeContinuations(IFilesystem* fs, const std::vector<LcovParser*>& workers, unsigned jobs,
+                                    std::string* err)
+{
+    // The records before the first TN of a worker belong to the test which is
+    // current at the end of the workers before it, or to the current one of
+    // ours. Without one they are ours to inherit if we continue a parse
+    // ourselves, they are merged into inherited_ once the workers are.
+    bool inherit = continuation_ && (!current_test_ || current_test_ == inherited_);
+    std::string_view tn = current_test_ && !inherit ? current_test_->GetTestName() : "";
+    std::vector<LcovParser*> heirs;
+    for (auto* worker : workers) {
+        if (worker->inherited_) {
+            if (inherit)
+                heirs.push_back(worker);
+            else if (!worker->GetTestRecord(tn, fs)->Merge(worker->inherited_, err,
+                                                           cfg_.KeepsGoing() ? &worker->quarantine_ : nullptr))
+                return false;
+        }
+        if (worker->current_test_ && worker->current_test_ != worker->inherited_) {
+            tn = worker->current_test_->GetTestName();
+            inherit = false;
+        }
+    }
+    if (!MergeParallel(workers, jobs, err))
+        return false;
+    // The arenas of the workers are ours now.
+    for (auto* worker : heirs) {
+        if (!GetRecordBeforeTN(fs)->Merge(worker->inherited_, err, cfg_.KeepsGoing() ? &quarantine_ : nullptr))
+            return false;
+    }
+    if (inherit) {
+        if (inherited_)
+            current_test_ = inherited_;
+    } else {
+        auto it = tests_.find(tn);
+        if (it != tests_.cend())
+            current_test_ = it->second;
+    }
+    return true;
+}
+
+bool LcovParser::LoadCompressedSnapshot(IFilesystem* fs, const char* fpath, IFilesystem::InputStream* in)
+{
+    std::string errmsg, data;
+    size_t nread;
+    do {
+        size_t n = data.size();
+        data.resize(n + LineReader::kChunkSize);
+        if (in->Read(&data[n], LineReader::kChunkSize, &nread, &errmsg) != IFilesystem::SUCCESS) {
+            ERROR("%s: %s\n", fpath, errmsg.c_str());
+            return false;
+        }
+        data.resize(n + nread);
+    } while (nread);
+
+    Stats::Add(Stats::TRACEFILE_BYTES, data.size());
+    if (!LoadSnapshot(fs, data, &errmsg)) {
+        ERROR("%s: %s\n", fpath, errmsg.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LcovParser::ParseLines(IFilesystem* fs, const char* fpath, LineReader* reader, uint32_t first_lineno)
+{
+    std::string errmsg;
+    std::string_view line;
+    LineFields fields;
+    LcovRecordArgList args;
+    uint32_t lineno = first_lineno;
+    int rc;
+
+    args.reserve(4);
+    skipping_ = false;
+    for (; (rc = reader->NextLine(&line, &fields, &errmsg)) > 0; lineno++) {
+        if (!ParseLine(fs, fpath, lineno, line, fields, &args, &errmsg)) {
+            if (!cfg_.KeepsGoing())
+                return false;
+            // An SF record fails if the block before it has no end_of_record,
+            // the block it starts is parsed nevertheless.
+            bool restart = block_lineno_ && LineParser(line, fields).ParseRecordType() == LcovRecordType::SF;
+            Quarantine(fpath, lineno);
+            if (restart) {
+                skipping_ = false;
+                records_[LcovRecordType::SF]--;
+                if (!ParseLine(fs, fpath, lineno, line, fields, &args, &errmsg))
+                    Quarantine(fpath, lineno);
+            }
+        }
+    }
+    Stats::Add(Stats::TRACEFILE_BYTES, reader->GetBytesRead());
+    if (rc < 0) {
+        ERROR("%s:%u: %s\n", fpath, lineno, errmsg.c_str());
+        return false;
+    }
+    // Like any other, a last block without end_of_record is kept.
+    if (block_lineno_) {
+        staging_->SetCurrentSourceFileInfo(nullptr);
+        CommitBlock(fpath);
+    }
+    return true;
+}
+
+bool LcovParser::ParseLine(IFilesystem* fs, const char* fpath, uint32_t lineno, std::string_view line,
+                           const LineFields& fields, LcovRecordArgList* args, std::string* errmsg)
+{
+    if (line.empty() || line[0] == '#')
+        return true;
+
+    LineParser lp(line, fields);
+    LcovRecordType type = lp.ParseRecordType();
+
+    // Records of source files which aren't selected are dropped unseen.
+    if (skipping_) {
+        if (type == LcovRecordType::END_OF_RECORD)
+            skipping_ = false;
+        return true;
+    }
+    if (type == LcovRecordType::UNKNOWN) {
+        ERROR("%s:%u: unknown record type\n", fpath, lineno);
+        return false;
+    }
+    records_[type]++;
+
+    if (!lp.ParseRecordArguments(args, errmsg)) {
+        ERROR("%s:%u: %s\n", fpath, lineno, errmsg->c_str());
+        return false;
+    }
+
+    if (type == LcovRecordType::SF && args->size() == 1 && !cfg_.SelectSourceFile(&args->at(0), &mapped_path_)) {
+        skipping_ = true;
+        return true;
+    }
+
+    if (cfg_.summary_only_) {
+        if (type > LcovRecordType::SF && !cursummary_) {
+            ERROR("%s:%u a TN and/or SF record is missing\n", fpath, lineno);
+            return false;
+        }
+        errmsg->clear();
+        if (!ParseSummaryRecord(type, args, errmsg)) {
+            ERROR("%s:%u: %s %s\n", fpath, lineno, ::RecordType2Str(type), errmsg->c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Handle TN and end_of_record record here.
+    if (type == LcovRecordType::TN) {
+        if (args->size() != 1) {
+            ERROR("%s:%u: expected one test name\n", fpath, lineno);
+            return false;
+        }
+
+        current_test_ = GetTestRecord(args->at(0), fs);
+        return true;
+    }
+
+    // Note that TN record is optional, if a TN record doesn't appear before SF,
+    // allocate an anonymous test record instead.
+    if (type == LcovRecordType::SF && !current_test_)
+        current_test_ = GetRecordBeforeTN(fs);
+    // In keep-going mode the records of an SF block go to a test record of
+    // their own, which is merged into the current one at the end of the block.
+    LcovTestRecord* tr = current_test_;
+    if (cfg_.KeepsGoing()) {
+        if (!staging_)
+            staging_ = arena_->New<LcovTestRecord>(arena_.get(), "", fs);
+        if (type == LcovRecordType::SF && !block_lineno_) {
+            block_lineno_ = lineno;
+            staged_test_ = current_test_;
+        }
+        tr = staging_;
+    }
+    if (type > LcovRecordType::SF && (!tr || !tr->GetCurrentSourceFileInfo())) {
+        ERROR("%s:%u a TN and/or SF record is missing\n", fpath, lineno);
+        return false;
+    }
+    errmsg->clear();
+    if (!kHandlers_[type](tr, args, &cfg_, errmsg)) {
+        ERROR("%s:%u: %s %s\n", fpath, lineno, ::RecordType2Str(type), errmsg->c_str());
+        return false;
     }
-    return nullptr;
+    if (tr == staging_ && type == LcovRecordType::END_OF_RECORD)
+        CommitBlock(fpath);
+    return true;
 }
 
-// Main implementation
-
-LcovTestRecord::~LcovTestRecord()
+void LcovParser::Quarantine(const char* fpath, uint32_t lineno)
 {
-    for (auto v : sfs_)
-        delete v.second;
+    QuarantineRecord rec;
+    rec.input_ = fpath;
+    rec.lineno_ = lineno;
+    rec.error_ = GetLastReportedError();
+    if (block_lineno_) {
+        // Nothing of the block has been merged yet, the rest of it is skipped.
+        auto* sf = staging_->GetCurrentSourceFileInfo();
+        if (sf)
+            rec.source_file_ = std::string(sf->GetSourceFilePath());
+        rec.lineno_ = block_lineno_;
+        staging_->sfs_.clear();
+        staging_->SetCurrentSourceFileInfo(nullptr);
+        block_lineno_ = 0;
+        skipping_ = true;
+    }
+    quarantine_.push_back(std::move(rec));
 }
 
-
-int LcovTestRecord::Export(FILE* fp)
+void LcovParser::CommitBlock(const char* fpath)
 {
-    assert(fp != nullptr);
-    if (!tn_.empty())
-        fprintf(fp, "TN:%s\n", tn_.c_str());
-    for (auto& v : sfs_) {
-        fprintf(fp, "SF:%s\n", v.first.c_str());
-        if (v.second->Export(fp))
-            return 1;
+    std::string err;
+    auto* sf = staging_->sfs_.begin()->second;
+    uint32_t lineno = block_lineno_;
+    staging_->sfs_.clear();
+    block_lineno_ = 0;
+
+    auto mine = staged_test_->sfs_.find(sf->GetSourceFilePath());
+    if (mine == staged_test_->sfs_.cend()) {
+        staged_test_->sfs_.emplace(sf->GetSourceFilePath(), sf);
+        return;
     }
-    return 0;
+    if (mine->second->CheckMerge(*sf, &err) && mine->second->Merge(*sf, &err))
+        return;
+    ERROR("%s:%u: %s: %s\n", fpath, lineno, sf->GetSourceFilePath().data(), err.c_str());
+    QuarantineRecord rec;
+    rec.input_ = fpath;
+    rec.lineno_ = lineno;
+    rec.source_file_ = std::string(sf->GetSourceFilePath());
+    rec.error_ = GetLastReportedError();
+    quarantine_.push_back(std::move(rec));
 }
 
-int SourceFileInfo::Export(FILE* fp)
+bool LcovParser::ParseSummaryRecord(LcovRecordType type, LcovRecordArgList* args, std::string* err)
 {
-    // Export function definitions
-    for (const auto& rec : funcs_) {
-        const auto& func = rec.second;
-        if (!func.is_private_)
-            fprintf(fp, "FN:%u,%s\n", func.lineno_, rec.first.c_str());
-        else
-            fprintf(fp, "FN:%u,%s:%s\n", func.lineno_, GetSourceFileName().c_str(), rec.first.c_str());
-    }
-
-    // Export function coverage records
-    size_t fnh = 0;
-    for (const auto& rec : funcs_) {
-        const auto& func = rec.second;
-        if (func.xcount_ != 0)
-            fnh++;
-        if (!func.is_private_)
-            fprintf(fp, "FNDA:%u,%s\n", func.xcount_, rec.first.c_str());
-        else
-            fprintf(fp, "FNDA:%u,%s:%s\n", func.xcount_, GetSourceFileName().c_str(), rec.first.c_str());
-    }
-    fprintf(fp, "FNF:%zu\nFNH:%zu\n", funcs_.size(), fnh);
+    // Only the arguments the summary depends on are validated.
+    auto function_name = [](std::string_view name) {
+        size_t pos = name.find_first_of(':');
+        return pos == std::string_view::npos ? name : name.substr(pos + 1);
+    };
+    uint32_t lineno, xcount = 0;
 
-    // llvm-cov generates line coverage records after FN*s, so do we.
-    uint32_t lf = 0, lh = 0, l = 0;
-    for (const LineCoverageInfo& li : das_) {
-        if (li.is_defined_) {
-            assert(l > 0);
-            fprintf(fp, "DA:%u,%u", l, li.xcount_);
-            if (li.has_checksum_) {
-                fputc(',', fp);
-                std::string encoded_checksum;
-                Base64Encode(li.checksum_, MD5Hash::Length, &encoded_checksum);
-                fputs(encoded_checksum.c_str(), fp);
+    switch (type) {
+        case LcovRecordType::TN:
+            if (args->size() != 1) {
+                *err = "expected one test name";
+                return false;
+            }
+            return true;
+        case LcovRecordType::SF: {
+            if (args->size() != 1) {
+                *err = "expected 1 argument";
+                return false;
+            } else if (cursummary_) {
+                *err = "expected end_of_record";
+                return false;
+            }
+            auto it = summaries_.find(args->at(0));
+            if (it != summaries_.cend())
+                cursummary_ = it->second;
+            else {
+                cursummary_ = arena_->New<SourceFileSummary>(arena_.get());
+                summaries_.emplace(arena_->Intern(args->at(0)), cursummary_);
             }
-            fputc('\n', fp);
-            if (li.xcount_ > 0)
-                lh++;
-            lf++;
+            return true;
         }
-        l++;
-    }
-
-    // Export branch coverage records
-    l = 0;
-    uint32_t brf = 0, brh = 0;
-    for (const LineBranchCoverage& lbr : branches_) {
-        if (lbr.is_defined_) {
-            uint32_t blkno = 0;
-
-            assert(l > 0);
-            for (const auto& branches : lbr.blocks_) {
-                uint32_t brno = 0;
-                for (const auto& branch : branches) {
-                    if (branch.is_defined_) {
-                        if (branch.xcount_ == LineBranchCoverage::NEVER_EXECUTED) {
-                            fprintf(fp, "BRDA:%u,%u,%u,-\n", l, blkno, brno);
-                        } else {
-                            fprintf(fp, "BRDA:%u,%u,%u,%u\n", l, blkno, brno, branch.xcount_);
-                            if (branch.xcount_) brh++;
-                        }
-                        brf++;
-                    }
-                    brno++;
-                }
-                blkno++;
+        case LcovRecordType::END_OF_RECORD:
+            cursummary_ = nullptr;
+            return true;
+        case LcovRecordType::FN:
+            if (args->size() != 2) {
+                *err = "expected 2 arguments";
+                return false;
+            }
+            cursummary_->AddFunction(function_name(args->at(1)), false);
+            return true;
+        case LcovRecordType::FNDA:
+            if (args->size() != 2) {
+                *err = "expected 2 arguments";
+                return false;
+            }
+            xcount = StrToUnsigned32(args->at(0), INVALID_UNSIGNED_INTEGER);
+            if (xcount == INVALID_UNSIGNED_INTEGER) {
+                *err = "invalid execution count";
+                return false;
+            }
+            if (xcount)
+                return cursummary_->HitFunction(function_name(args->at(1))) ||
+                       (*err = "function coverage info references to an undefined function", false);
+            return true;
+        case LcovRecordType::DA:
+            if (args->size() != 2 && args->size() != 3) {
+                *err = "expected two arguments";
+                return false;
+            }
+            lineno = StrToUnsigned32(args->at(0), 0);
+            xcount = StrToUnsigned32(args->at(1), INVALID_UNSIGNED_INTEGER);
+            if (!lineno) {
+                *err = "invalid line number";
+                return false;
+            } else if (xcount == INVALID_UNSIGNED_INTEGER) {
+                *err = "invalid execution count";
+                return false;
+            }
+            cursummary_->AddLine(lineno, xcount);
+            return true;
+        case LcovRecordType::BRDA: {
+            if (args->size() != 4) {
+                *err = "expected 4 arguments";
+                return false;
+            }
+            SourceFileSummary::BranchKey key{StrToUnsigned32(args->at(0), 0),
+                                             StrToUnsigned32(args->at(1), SourceFileInfo::INVALID_BLOCK_ID),
+                                             StrToUnsigned32(args->at(2), SourceFileInfo::INVALID_BRANCH_ID)};
+            bool taken = args->at(3) != "-";
+            if (taken && (xcount = StrToUnsigned32(args->at(3), INVALID_UNSIGNED_INTEGER)) == INVALID_UNSIGNED_INTEGER) {
+                *err = "invalid execution count";
+                return false;
+            }
+            if (!key.lineno_ || key.blkno_ >= SourceFileInfo::INVALID_BLOCK_ID ||
+                key.brno_ >= SourceFileInfo::INVALID_BRANCH_ID) {
+                *err = "arguments contains non-integers";
+                return false;
             }
+            cursummary_->AddBranch(key, taken && xcount);
+            return true;
         }
-        l++;
+        case LcovRecordType::VER:
+            if (args->size() != 1 || StrToUnsigned32(args->at(0), SourceFileInfo::VERSION_INVALID) ==
+                                     static_cast<uint32_t>(SourceFileInfo::VERSION_INVALID)) {
+                *err = "invalid version ID";
+                return false;
+            }
+            return true;
+        default:
+            return HandlerNFNH(nullptr, args, &cfg_, err);
     }
-    fprintf(fp, "BRF:%u\nBRH:%u\n", brf, brh);
-
-    // And finally the line summary info
-    fprintf(fp, "LF:%u\nLH:%u\nend_of_record\n", lf, lh);
-
-    return 0;
 }
 
-std::string_view SourceFileInfo::ReadLineData(uint32_t lineno, bool no_newline)
+void LcovParser::SummarizeTests()
 {
-    assert(IsLineDataAvailable() == true);
-    assert(IsLineNumberInRange(lineno) == true);
-    auto offset = linemap_[lineno];
-    const char* linestart = content_.c_str() + offset;
-    size_t len = no_newline ? ::strcspn(linestart, "\r\n") : linemap_[lineno + 1] - offset;
-    
-    return std::string_view(linestart, len);
+    for (const auto& t : tests_) {
+        for (const auto& v : t.second->sfs_) {
+            auto it = summaries_.find(v.first);
+            if (it == summaries_.cend())
+                it = summaries_.emplace(v.first, arena_->New<SourceFileSummary>(arena_.get())).first;
+            v.second->AddToSummary(it->second);
+        }
+    }
+    tests_.clear();
+    current_test_ = nullptr;
 }
 
-bool SourceFileInfo::LoadLineMap(IFilesystem* fs, std::string* err)
+std::vector<std::pair<std::string_view, CoverageCounts>> LcovParser::GetSummary() const
 {
-    assert(fs != nullptr);
-    if (linemap_[0] != LINEMAP_UNKNOWN)
-        return linemap_[0] == LINEMAP_LOADED;
+    std::vector<std::pair<std::string_view, CoverageCounts>> res;
+    res.reserve(summaries_.size());
+    for (const auto& v : summaries_)
+        res.emplace_back(v.first, v.second->GetCounts());
+    std::sort(res.begin(), res.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    return res;
+}
 
-    switch (fs->ReadFile(fullpath_.c_str(), &content_, err)) {
-        case IFilesystem::SUCCESS:
-            if (content_.empty()) {
-                linemap_.push_back(0);
-                linemap_[0] = LINEMAP_LOADED;
-                return true;
-            }
-            break;
-        case IFilesystem::NOT_FOUND:
-        case IFilesystem::IO_ERROR:
-            linemap_[0] = LINEMAP_ON_ERROR;
+bool LcovParser::Merge(LcovParser* other, std::string* err)
+{
+    // The records of `other` which are moved or merged into ours keep pointing
+    // into its arena.
+    arena_->Adopt(std::move(other->arena_));
+    other->arena_.reset(new Arena);
+    quarantine_.insert(quarantine_.end(), other->quarantine_.begin(), other->quarantine_.end());
+    other->quarantine_.clear();
+    auto* quarantine = cfg_.KeepsGoing() ? &quarantine_ : nullptr;
+
+    for (auto it = other->tests_.begin(); it != other->tests_.end(); ) {
+        auto mine = tests_.find(it->first);
+        if (mine == tests_.cend()) {
+            tests_.emplace(it->first, it->second);
+            it = other->tests_.erase(it);
+            continue;
+        }
+        if (!mine->second->Merge(it->second, err, quarantine))
             return false;
+        ++it;
     }
-
-    const char* p = content_.c_str();
-    const char* q = p + content_.size();
-
-    linemap_.push_back(0); // the first line always begins at offset 0
-    size_t absoff = 0;
-    for (; p < q; ) {
-        size_t reloff = ::strcspn(p, "\n");
-        bool newline_found = p[reloff] == '\n';
-        if (newline_found)
-            reloff++;
-        absoff += reloff;
-        linemap_.push_back(absoff); // 1 for newline itself
-        p += reloff;
+    other->tests_.clear();
+    other->current_test_ = nullptr;
+    for (const auto& v : other->summaries_) {
+        auto mine = summaries_.find(v.first);
+        if (mine == summaries_.cend())
+            summaries_.emplace(v.first, v.second);
+        else
+            mine->second->Merge(*v.second);
+    }
+    other->summaries_.clear();
+    other->cursummary_ = nullptr;
+    for (int i = 0; i < LcovRecordType::LAST_RECORD_TYPE; i++) {
+        records_[i] += other->records_[i];
+        other->records_[i] = 0;
     }
-    linemap_[0] = LINEMAP_LOADED;
     return true;
 }
 
-
-FunctionCoverageInfo* SourceFileInfo::LookupFunction(std::string_view name)
-{
-    auto it = funcs_.find(std::string(name));
-    if (it != funcs_.cend())
-        return &it->second;
-    return nullptr;
-}
-
-template<typename... Targs>
-std::pair<FunctionCoverageInfo*, bool> SourceFileInfo::GetFunction(std::string_view name, Targs &&...args)
+bool LcovParser::CheckMerge(const LcovParser& other, std::string* err) const
 {
-    auto v = funcs_.emplace(name, args...);
-    return std::make_pair(&v.first->second, v.second);
+    for (const auto& t : other.tests_) {
+        auto mine = tests_.find(t.first);
+        if (mine == tests_.cend())
+            continue;
+        for (const auto& v : t.second->sfs_) {
+            auto sf = mine->second->sfs_.find(v.first);
+            if (sf != mine->second->sfs_.cend() && !sf->second->CheckMerge(*v.second, err)) {
+                *err = std::string(v.first) + ": " + *err;
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
-LineCoverageInfo* SourceFileInfo::GetLineCoverage(uint32_t lineno)
+void LcovParser::DropChangedSources(IFilesystem* fs, std::vector<std::string>* paths)
 {
-    assert(lineno != 0 && "bug: invalid lineno");
-    return VectorExtendToPos(&das_, lineno).base();
+    std::vector<std::shared_ptr<SourceContent>> stale;
+    SourceCache::Instance().Invalidate(fs, &stale);
+    std::unordered_set<const SourceContent*> changed;
+    for (const auto& content : stale)
+        changed.insert(content.get());
+
+    std::unordered_set<std::string_view> dropped;
+    for (const auto& t : tests_) {
+        auto& sfs = t.second->sfs_;
+        for (auto it = sfs.begin(); it != sfs.end(); ) {
+            if (changed.count(it->second->GetSourceContent())) {
+                if (dropped.insert(it->first).second)
+                    paths->emplace_back(it->first);
+                it = sfs.erase(it);
+            } else
+                ++it;
+        }
+        t.second->cursf_ = nullptr;
+    }
 }
 
-LineBranchCoverage::BranchExecInfo* SourceFileInfo::GetBranchCoverage(uint32_t lineno, uint32_t blkId, uint32_t branchId)
+RecordTableStats LcovParser::GetTableStats() const
 {
-    assert(IsLineNumberInRange(lineno) && "bug: invalid line number");
-    assert(blkId < INVALID_BLOCK_ID && branchId < INVALID_BRANCH_ID);
-    auto lbr = VectorExtendToPos(&branches_, lineno);
-    lbr->is_defined_ = true;
-    auto blk = VectorExtendToPos(&lbr->blocks_, blkId);
-    auto br = VectorExtendToPos(blk.base(), branchId);
-    br->is_defined_ = true;
-    return br.base();
+    RecordTableStats ts;
+    ts.tests_.Add(tests_);
+    for (const auto& t : tests_) {
+        ts.source_files_.Add(t.second->sfs_);
+        for (const auto& v : t.second->sfs_)
+            v.second->AddTableStats(&ts);
+    }
+    return ts;
 }
 
-LcovRecordType LineParser::ParseRecordType()
+bool LcovParser::MergeParallel(const std::vector<LcovParser*>& others, unsigned jobs, std::string* err)
 {
-    int sep = FindChar(p_, q_ - p_, ':');
-    LcovRecordType res = LcovRecordType::UNKNOWN;
-
-    switch (sep) {
-        case 2:
-            if (p_[0] == 'T' && p_[1] == 'N')
-                res = LcovRecordType::TN;
-            else if (p_[0] == 'S' && p_[1] == 'F')
-                res = LcovRecordType::SF;
-            else if (p_[0] == 'F' && p_[1] == 'N')
-                res = LcovRecordType::FN;
-            else if (p_[0] == 'D' && p_[1] == 'A')
-                res = LcovRecordType::DA;
-            else if (p_[0] == 'L' && p_[1] == 'F')
-                res = LcovRecordType::LF;
-            else if (p_[0] == 'L' && p_[1] == 'H')
-                res = LcovRecordType::LH;
-            break;
-
-        case 3:
-            if (!strncmp(p_, "FNF", 3))
-                res = LcovRecordType::FNF;
-            else if (!strncmp(p_, "FNH", 3))
-                res = LcovRecordType::FNH;
-            else if (!strncmp(p_, "BRF", 3))
-                res = LcovRecordType::BRF;
-            else if (!strncmp(p_, "BRH", 3))
-                res = LcovRecordType::BRH;
-            else if (!strncmp(p_, "VER", 3))
-                res = LcovRecordType::VER;
-            break;
-
-        case 4:
-            if (!strncmp(p_, "FNDA", 4))
-                res = LcovRecordType::FNDA;
-            else if (!strncmp(p_, "BRDA", 4))
-                res = LcovRecordType::BRDA;
-            break;
-
-        default:
-            break;
+    struct Entry {
+        uint32_t test;       // index into `dest`
+        SourceFileInfo* sf;
+    };
+    // Summaries are small, folding them one by one is cheap enough. Conflicts
+    // are only dropped one by one by Merge().
+    if (cfg_.summary_only_ || cfg_.KeepsGoing()) {
+        for (auto* other : others) {
+            if (!Merge(other, err))
+                return false;
+        }
+        return true;
     }
-
-    if (res == LcovRecordType::UNKNOWN && !strncmp(p_, "end_of_record", 13)) {
-        p_ += 13;
-        return LcovRecordType::END_OF_RECORD;
+    std::vector<LcovParser*> parsers = { this };
+    parsers.insert(parsers.end(), others.begin(), others.end());
+
+    // Every test ends up in one of ours.
+    std::vector<LcovTestRecord*> dest;
+    std::unordered_map<std::string_view, uint32_t> test_index;
+    for (auto* parser : parsers) {
+        for (const auto& t : parser->tests_) {
+            if (test_index.count(t.first))
+                continue;
+            auto mine = tests_.find(t.first);
+            if (mine == tests_.end()) {
+                auto* tr = arena_->New<LcovTestRecord>(arena_.get(), t.first, t.second->GetFilesystemInterface());
+                mine = tests_.emplace(tr->GetTestName(), tr).first;
+            }
+            test_index.emplace(mine->first, dest.size());
+            dest.push_back(mine->second);
+        }
     }
 
-    p_ += sep + 1;
-    return res;
-}
-
-bool LineParser::ParseRecordArguments(LcovRecordArgList* args, std::string* err)
-{
-    args->clear();
-    assert(*p_ != ':');
-    *err = "";
-    for (; p_ < q_; ) {
-        const char* start = p_;
-        size_t remlen = q_ - start;
-        size_t endpos = FindChar(start, remlen, ',');
-
-        if (!endpos) {
-            *err = "trailing commas";
-            return false;
+    uint32_t nshards = std::max(1u, jobs * kMergeShardsPerJob);
+    std::vector<std::vector<std::vector<Entry>>> buckets(parsers.size(), std::vector<std::vector<Entry>>(nshards));
+    ParallelFor(parsers.size(), jobs, [&](unsigned, size_t p) {
+        for (const auto& t : parsers[p]->tests_) {
+            uint32_t ti = test_index.at(t.first);
+            for (const auto& v : t.second->sfs_)
+                buckets[p][::GetSourceFileShard(v.first, nshards)].push_back({ti, v.second});
         }
+    });
+
+    // A source file found in a single parser keeps its record, the others are
+    // merged into a copy in the arena of the shard. The records of a parser
+    // share its arena, thus only the thread owning a shard allocates from its arena.
+    std::vector<std::unique_ptr<Arena>> arenas(nshards);
+    std::vector<std::vector<Entry>> merged(nshards);
+    std::vector<std::string> errors(nshards);
+    std::atomic<bool> failed{false};
+    ParallelFor(nshards, jobs, [&](unsigned, size_t shard) {
+        struct Slot {
+            SourceFileInfo* sf;
+            bool owned;
+        };
+        std::vector<std::unordered_map<std::string_view, Slot>> files(dest.size());
+        arenas[shard].reset(new Arena);
+        Arena* arena = arenas[shard].get();
+        for (size_t p = 0; p < parsers.size() && !failed.load(std::memory_order_relaxed); p++) {
+            for (const auto& e : buckets[p][shard]) {
+                auto it = files[e.test].find(e.sf->GetSourceFilePath());
+                if (it == files[e.test].end()) {
+                    files[e.test].emplace(e.sf->GetSourceFilePath(), Slot{e.sf, false});
+                    continue;
+                }
+                Slot& slot = it->second;
+                if (!slot.owned) {
+                    auto* copy = arena->New<SourceFileInfo>(arena, slot.sf->GetSourceFilePath());
+                    bool ok = copy->Merge(*slot.sf, &errors[shard]);
+                    assert(ok);
+                    (void)ok;
+                    slot = Slot{copy, true};
+                }
+                if (!slot.sf->Merge(*e.sf, &errors[shard])) {
+                    errors[shard] = std::string(e.sf->GetSourceFilePath()) + ": " + errors[shard];
+                    failed = true;
+                    return;
+                }
+            }
+        }
+        for (uint32_t ti = 0; ti < files.size(); ti++) {
+            for (const auto& v : files[ti])
+                merged[shard].push_back({ti, v.second.sf});
+        }
+    });
 
-        size_t len = endpos == -1 ? remlen : endpos;
-        args->push_back(std::string_view(start, len));
-        p_ += len;
-        if (endpos != -1 && start[endpos] == ',')
-            p_++;
-
-        if (args->size() > 4) {
-            *err = "too many arguments (max: 4)";
-            return false;
+    for (auto* parser : parsers) {
+        if (parser != this)
+            arena_->Adopt(std::move(parser->arena_));
+    }
+    for (auto& arena : arenas)
+        arena_->Adopt(std::move(arena));
+    for (auto* parser : others) {
+        parser->arena_.reset(new Arena);
+        parser->tests_.clear();
+        parser->current_test_ = nullptr;
+        for (int i = 0; i < LcovRecordType::LAST_RECORD_TYPE; i++) {
+            records_[i] += parser->records_[i];
+            parser->records_[i] = 0;
+        }
+    }
+    if (failed) {
+        for (const auto& error : errors) {
+            if (!error.empty())
+                *err = error;
         }
+        return false;
+    }
+    for (const auto& entries : merged) {
+        for (const auto& e : entries)
+            dest[e.test]->sfs_.insert_or_assign(e.sf->GetSourceFilePath(), e.sf);
     }
     return true;
 }
 
-bool LcovParser::Parse(IFilesystem* fs, const char* fpath)
+std::vector<std::vector<LcovParser::ExportItem>> LcovParser::GetExportItems(uint32_t nshards) const
 {
-    std::string errmsg;
-    std::string content;
-    LcovRecordArgList args;
-    uint32_t lineno = 1;
-    const char* linestart;
-    const char* content_end;
-
-    switch (fs->ReadFile(fpath, &content, &errmsg)) {
-        case IFilesystem::SUCCESS:
-            break;
-        case IFilesystem::NOT_FOUND:
-        case IFilesystem::IO_ERROR:
-            ERROR("%s: %s\n", fpath, errmsg.c_str());
-            return false;
+    std::vector<std::vector<ExportItem>> res(nshards);
+    std::vector<LcovTestRecord*> tests;
+    bool sorted = cfg_.sorted_output_;
+
+    for (const auto& v : tests_)
+        tests.push_back(v.second);
+    if (sorted) {
+        std::sort(tests.begin(), tests.end(), [](const LcovTestRecord* a, const LcovTestRecord* b) {
+            return a->GetTestName() < b->GetTestName();
+        });
     }
-    if (content.empty())
-        return true;
-    linestart = content.c_str();
-    content_end = linestart + content.size();
+    // The anonymous test has no TN line, after another test its records would
+    // be read back as records of that one.
+    auto anonymous = std::find_if(tests.begin(), tests.end(),
+                                  [](const LcovTestRecord* tr) { return tr->GetTestName().empty(); });
+    if (anonymous != tests.end())
+        std::rotate(tests.begin(), anonymous, anonymous + 1);
+    for (auto* tr : tests) {
+        auto sfs = tr->GetSourceFiles(sorted);
+        if (sfs.empty())
+            res[0].push_back({tr, nullptr, true});
+        for (auto* sf : sfs) {
+            auto& items = res[nshards > 1 ? ::GetSourceFileShard(sf->GetSourceFilePath(), nshards) : 0];
+            items.push_back({tr, sf, items.empty() || items.back().tr != tr});
+        }
+    }
+    return res;
+}
 
-    args.reserve(4);
-    for (; linestart < content_end; lineno++) {
-        size_t len = strcspn(linestart, "\r\n");
-        LineParser lp(linestart, len);
+bool LcovParser::Export(OutputSink* out, const std::vector<ExportItem>& items, unsigned jobs)
+{
+    bool sorted = cfg_.sorted_output_;
+    auto serialize = [sorted](OutputSink* sink, const ExportItem& item) {
+        if (item.header)
+            item.tr->ExportTestName(sink);
+        if (item.sf)
+            item.sf->Export(sink, sorted);
+    };
+    if (jobs <= 1 || items.size() <= 1) {
+        for (const auto& item : items)
+            serialize(out, item);
+        return !out->HasFailed();
+    }
 
-        if (linestart[0] != '#' && len) {
-            LcovRecordType type = lp.ParseRecordType();
+    // Every round serializes a batch of source files per worker, the pieces
+    // are then copied out in order.
+    struct Piece {
+        unsigned worker;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<std::unique_ptr<MemoryOutputSink>> sinks;
+    std::vector<Piece> pieces;
+    size_t round = static_cast<size_t>(jobs) * kExportBatch;
+
+    for (unsigned i = 0; i < jobs; i++)
+        sinks.emplace_back(new MemoryOutputSink);
+    for (size_t begin = 0; begin < items.size() && !out->HasFailed(); begin += round) {
+        size_t n = std::min(round, items.size() - begin);
+        pieces.resize(n);
+        ParallelFor(n, jobs, [&](unsigned worker, size_t i) {
+            MemoryOutputSink* sink = sinks[worker].get();
+            size_t offset = sink->GetBytesWritten();
+            serialize(sink, items[begin + i]);
+            pieces[i] = {worker, offset, sink->GetBytesWritten() - offset};
+        });
+        for (const auto& piece : pieces)
+            out->Write(sinks[piece.worker]->GetContent().data() + piece.offset, piece.size);
+        for (auto& sink : sinks)
+            sink->Clear();
+    }
+    return !out->HasFailed();
+}
 
-            if (type == LcovRecordType::UNKNOWN) {
-                ERROR("%s:%u: unknown record type\n", fpath, lineno);
-                return false;
+bool LcovParser::ExportSnapshot(OutputSink* out, const std::vector<ExportItem>& items)
+{
+    SnapshotWriter w(out);
+    uint32_t ntests = std::count_if(items.begin(), items.end(), [](const ExportItem& item) { return item.header; });
+
+    w.WriteHeader();
+    w.WriteU32(ntests);
+    for (size_t i = 0; i < items.size(); ) {
+        size_t end = i + 1;
+        while (end < items.size() && !items[end].header)
+            end++;
+        w.WriteString(items[i].tr->GetTestName());
+        w.WriteU32(items[i].sf ? end - i : 0);
+        for (; i < end; i++) {
+            if (items[i].sf) {
+                w.WriteString(items[i].sf->GetSourceFilePath());
+                items[i].sf->Save(&w);
             }
+        }
+    }
+    return !out->HasFailed();
+}
 
-            if (!lp.ParseRecordArguments(&args, &errmsg)) {
-                ERROR("%s:%u: %s\n", fpath, lineno, errmsg.c_str());
-                return false;
+bool LcovParser::LoadSnapshot(IFilesystem* fs, std::string_view data, std::string* err)
+{
+    // Load into a parser of our own first, the records of the snapshot may
+    // overlap with what has been parsed already.
+    LcovParser snapshot(cfg_);
+    SnapshotReader r(data);
+    uint32_t ntests;
+
+    if (!r.ReadHeader()) {
+        *err = "unsupported snapshot version";
+        return false;
+    }
+    if (!r.ReadU32(&ntests))
+        goto corrupted;
+    for (uint32_t i = 0; i < ntests; i++) {
+        std::string_view name;
+        uint32_t nsfs;
+        if (!r.ReadString(&name) || !r.ReadU32(&nsfs) || snapshot.tests_.count(name))
+            goto corrupted;
+        auto* tr = snapshot.arena_->New<LcovTestRecord>(snapshot.arena_.get(), name, fs);
+        snapshot.tests_[tr->GetTestName()] = tr;
+        std::unordered_set<std::string_view> paths; // as stored, if they're remapped
+        for (uint32_t j = 0; j < nsfs; j++) {
+            std::string_view path, mapped;
+            std::string buf;
+            if (!r.ReadString(&path) || (cfg_.path_filter_ && !paths.insert(path).second))
+                goto corrupted;
+            mapped = path;
+            if (!cfg_.SelectSourceFile(&mapped, &buf)) {
+                // Skip the record, it still has to be loaded to find the next one.
+                Arena scratch;
+                SourceFileInfo skipped(&scratch, path);
+                if (!skipped.Load(&r, cfg_.discard_checksum_))
+                    goto corrupted;
+                continue;
             }
-
-            // Handle TN and end_of_record record here.
-            if (type == LcovRecordType::TN) {
-                if (args.size() != 1) {
-                    ERROR("%s:%u: expected one test name", fpath, lineno);
-                    return false;
-                }
-
-                std::string testname(args[0]);
-                auto it = tests_.find(testname);
-                if (it == tests_.cend()) {
-                    current_test_ = new LcovTestRecord(testname, fs);
-                    tests_[current_test_->GetTestName()] = current_test_;
-                } else
-                    current_test_ = it->second;
-
-            } else {
-                // Note that TN record is optional, if a TN record doesn't appear before SF,
-                // allocate an anonymous test record instead.
-                if (type == LcovRecordType::SF && !current_test_) {
-                    auto it = tests_.find("");
-                    if (it == tests_.cend()) {
-                        current_test_ = new LcovTestRecord("", fs);
-                        tests_[""] = current_test_;
-                    } else
-                        current_test_ = it->second;
-                }
-                if (type > LcovRecordType::SF && (!current_test_ || !current_test_->GetCurrentSourceFileInfo())) {
-                    ERROR("%s:%u a TN and/or SF record is missing\n", fpath, lineno);
-                    return false;
-                }
-                errmsg.clear();
-                if (!kHandlers_[type](current_test_, &args, &cfg_, &errmsg)) {
-                    ERROR("%s:%u: %s %s\n", fpath, lineno, ::RecordType2Str(type), errmsg.c_str());
+            auto it = tr->sfs_.find(mapped);
+            if (it != tr->sfs_.end()) {
+                // Paths are unique in a snapshot, but several of them may be mapped to the same one.
+                SourceFileInfo other(tr->arena_, mapped);
+                if (!cfg_.path_filter_ || !other.Load(&r, cfg_.discard_checksum_))
+                    goto corrupted;
+                if (!it->second->Merge(other, err))
                     return false;
-                }
+                continue;
             }
+            auto* sf = tr->arena_->New<SourceFileInfo>(tr->arena_, mapped);
+            tr->sfs_.emplace(sf->GetSourceFilePath(), sf);
+            if (!sf->Load(&r, cfg_.discard_checksum_))
+                goto corrupted;
         }
-
-        if (linestart[len] == '\r')
-            len++;
-        linestart += len + 1;
     }
-
-    return true;
+    if (!r.AtEnd())
+        goto corrupted;
+    if (cfg_.summary_only_)
+        snapshot.SummarizeTests();
+    return Merge(&snapshot, err);
+
+corrupted:
+    *err = "corrupted snapshot";
+    return false;
 }
 
 bool LcovParser::HandlerSF(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err)
@@ -646,15 +2124,14 @@ bool LcovParser::HandlerSF(LcovTestRecord* tr, LcovRecordArgList* args, Config*
         *err = "expected end_of_record";
         return false;
     }
-    std::string sfpath{args->at(0)};
-    auto it = tr->sfs_.find(sfpath);
+    auto it = tr->sfs_.find(args->at(0));
     if (it != tr->sfs_.cend())
         tr->SetCurrentSourceFileInfo(it->second);
     else {
-        tr->cursf_ = new SourceFileInfo(sfpath);
-        tr->sfs_[sfpath] = tr->cursf_;
+        tr->cursf_ = tr->arena_->New<SourceFileInfo>(tr->arena_, args->at(0));
+        tr->sfs_.emplace(tr->cursf_->GetSourceFilePath(), tr->cursf_);
     }
-    if ((!config->discard_checksum_ || config->generate_checksum_) &&
+    if (config->LoadsSourcesEagerly() &&
         !tr->GetCurrentSourceFileInfo()->LoadLineMap(tr->GetFilesystemInterface(), err)) {
         // *err = "failed to load linemap";
         return false;
@@ -769,62 +2246,56 @@ bool LcovParser::HandlerDA(LcovTestRecord* tr, LcovRecordArgList* args, Config*
     uint32_t lineno = ::StrToUnsigned32(args->at(0), 0);
     uint32_t xcount = ::StrToUnsigned32(args->at(1), INVALID_UNSIGNED_INTEGER);
     bool checksum_specified = args->size() == 3 && !config->discard_checksum_;
+    bool checksum_trusted = checksum_specified && config->trusted_;
+    auto* sf = tr->GetCurrentSourceFileInfo();
+
+    // In lazy mode the source is loaded by the first record which needs a checksum.
+    if ((config->generate_checksum_ || checksum_specified) && !checksum_trusted && !sf->IsLineDataAvailable() &&
+        !sf->LoadLineMap(tr->GetFilesystemInterface(), err)) {
+        return false;
+    }
 
-    if (!tr->GetCurrentSourceFileInfo()->IsLineNumberInRange(lineno)) {
+    if (!sf->IsLineNumberInRange(lineno)) {
         *err = "invalid line number";
         return false;
     } else if (INVALID_UNSIGNED_INTEGER == xcount) {
         *err = "invalid execution count";
         return false;
-    } else if (checksum_specified && args->at(2).size() != 24) {
+    }
+    uint8_t specified_checksum[MD5Hash::Length];
+    if (checksum_specified && !MD5Hash::Base64ToMD5(args->at(2).data(), specified_checksum, args->at(2).size())) {
         *err = "invalid checksum";
         return false;
     }
 
-    auto* da = tr->GetCurrentSourceFileInfo()->GetLineCoverage(lineno);
-    if (!da->has_checksum_) {
-        MD5Hash md5hash;
-        uint8_t* line_checksum = nullptr;
-
-        if (config->generate_checksum_ || checksum_specified) {
-            line_checksum = reinterpret_cast<uint8_t*>(::alloca(MD5Hash::Length));
-            // Calculate the line checksum first.
-            {
-                auto* srcfile = tr->GetCurrentSourceFileInfo();
-                auto linedata = srcfile->ReadLineData(lineno, /* no_newline? */false);
-                md5hash.Update(linedata.data(), linedata.size());
-                md5hash.Finalize(line_checksum);
-            }
-            if (checksum_specified) {
-                auto specified_checksum_base64 = args->at(2);
-                std::string checksum_base64;
-
-                Base64Encode(line_checksum, MD5Hash::Length, &checksum_base64);
-                assert(checksum_base64.size() == 24);
-
-                if (checksum_base64.compare(specified_checksum_base64)) {
-                    *err = "checksum mismatch";
-                    return false;
-                }
+    auto* das = sf->GetLineCoverage();
+    uint32_t unused;
+    if (config->max_lines_per_file_ && das->GetLineCount() >= config->max_lines_per_file_ &&
+        !das->Lookup(lineno, &unused)) {
+        *err = "too many lines in the source file";
+        return false;
+    }
+    uint32_t slot = das->Define(lineno);
+    const uint8_t* checksum = das->GetChecksum(slot);
+    if (!checksum) {
+        if (checksum_trusted)
+            das->SetChecksum(slot, specified_checksum);
+        else if (config->generate_checksum_ || checksum_specified) {
+            const uint8_t* line_checksum = sf->GetLineChecksum(lineno);
+            if (checksum_specified && !MD5Hash::Equals(line_checksum, specified_checksum)) {
+                *err = "checksum mismatch";
+                return false;
             }
-            (void)memcpy(da->checksum_, line_checksum, MD5Hash::Length);
-            da->has_checksum_ = true;
+            das->SetChecksum(slot, line_checksum);
         }
     } else {
         // Otherwise we just need to check if the given checksum string matches with the existing one.
-        if (checksum_specified) {
-            auto specified_checksum_base64 = args->at(2);
-            std::string checksum_base64;
-            Base64Encode(da->checksum_, MD5Hash::Length, &checksum_base64);
-            assert(checksum_base64.size() == 24);
-            if (checksum_base64.compare(specified_checksum_base64)) {
-                *err = "conflicting checksum";
-                return false;
-            }
+        if (checksum_specified && !MD5Hash::Equals(checksum, specified_checksum)) {
+            *err = "conflicting checksum";
+            return false;
         }
     }
-    da->xcount_ += xcount;
-    da->is_defined_ = true;
+    das->AddCount(slot, xcount);
 
     return true;
 }
@@ -842,7 +2313,7 @@ bool LcovParser::HandlerBRDA(LcovTestRecord* tr, LcovRecordArgList* args, Config
     uint32_t xcount;
 
     if (xcount_str.size() == 1 && xcount_str[0] == '-') {
-        xcount = LineBranchCoverage::NEVER_EXECUTED;
+        xcount = BranchCoverageTable::NEVER_EXECUTED;
     } else {
         xcount = StrToUnsigned32(xcount_str, INVALID_UNSIGNED_INTEGER);
         if (xcount == INVALID_UNSIGNED_INTEGER) {
@@ -851,17 +2322,17 @@ bool LcovParser::HandlerBRDA(LcovTestRecord* tr, LcovRecordArgList* args, Config
         }
     }
     if (!tr->GetCurrentSourceFileInfo()->IsLineNumberInRange(lineno) ||
-        blkId == SourceFileInfo::INVALID_BLOCK_ID || branchId == SourceFileInfo::INVALID_BRANCH_ID) {
+        blkId >= SourceFileInfo::INVALID_BLOCK_ID || branchId >= SourceFileInfo::INVALID_BRANCH_ID) {
         *err = "arguments contains non-integers";
         return false;
     }
+    if (config->max_branches_per_line_ && tr->GetCurrentSourceFileInfo()->GetBranchCoverage()->CountLineSlots(
+                                              lineno, blkId, branchId) > config->max_branches_per_line_) {
+        *err = "too many branches on the line";
+        return false;
+    }
 
-    auto* br = tr->GetCurrentSourceFileInfo()->GetBranchCoverage(lineno, blkId, branchId);
-    if (br->xcount_ != LineBranchCoverage::NEVER_EXECUTED) {
-        if (br->xcount_ != LineBranchCoverage::NEVER_EXECUTED)
-            br->xcount_ += xcount;
-    } else
-        br->xcount_ = xcount;
+    tr->GetCurrentSourceFileInfo()->AddBranchCoverage(lineno, blkId, branchId, xcount);
 
     return true;
 }
@@ -884,101 +2355,3 @@ bool LcovParser::HandlerVER(LcovTestRecord* tr, LcovRecordArgList* args, Config*
     }
     return true;
 }
-
-#ifndef TESTMODE
-
-#include "filesystem_host.h"
-#include "getopt.h"
-
-[[noreturn]] static void usage(const char* program, int exitcode)
-{
-    fprintf(stderr, "Usage: %s [OPTIONS] <inputfile1>[inputfileN...]\n\n", program);
-    fprintf(stderr, "Options:\n"
-                    "   -h,--help               Print this help message and exit.\n"
-                    "   -d,--discard-checksum   Discard and ignore line checksums,\n"
-                    "                           checksums will not longer be validated.\n"
-                    "   -g,--generate-checksum  Generate checksum for each line record.\n"
-                    "                           If -d is specified, then the existing\n"
-                    "                           checksums from files will be ignored and\n"
-                    "                           replaced by new generated checksums.\n"
-                    "   -o,--output-file=FILE   ");
-    exit(exitcode);
-}
-
-int main(int argc, char** argv)
-{
-    LcovParser::Config config;
-    const option kLongOptions[] = {
-        { "help", no_argument, NULL, 'h' },
-        { "discard-checksum", no_argument, NULL, 'd' },
-        { "generate-checksum", no_argument, NULL, 'g'},
-        { "output-file", required_argument, NULL, 'o'},
-        { NULL, 0, NULL, 0 },
-    };
-    int opt, exitcode = EXIT_SUCCESS;
-    const char* ofile = nullptr;
-    const char* program = argv[0];
-    HostFilesystem fs;
-    FILE* fpout;
-
-    while (-1 != (opt = getopt_long(argc, argv, "dgho:", kLongOptions, NULL))) {
-        switch (opt) {
-            case 'h':
-                usage(program, EXIT_SUCCESS);
-                /*UNREACHABLE*/
-            case 'd':
-                config.discard_checksum_ = true;
-                break;
-            case 'g':
-                config.generate_checksum_ = true;
-                break;
-            case 'o':
-                ofile = optarg;
-                break;
-            default:
-                usage(program, EXIT_FAILURE);
-                /*UNREACHABLE*/
-        }
-    }
-    argc -= optind;
-    argv += optind;
-
-    if (!argc) {
-        fprintf(stderr, "%s: no input files\n", program);
-        return EXIT_FAILURE;
-    }
-
-    fpout = ofile ? fopen(ofile, "w") : stdout;
-    if (!fpout) {
-        fprintf(stderr, "%s: failed open file stream\n", program);
-        return EXIT_FAILURE;
-    }
-    rewind(fpout);
-
-    LcovParser parser(config);
-    for (int i = 0; i < argc; i++) {
-        if (!parser.Parse(&fs, argv[i])) {
-            exitcode = EXIT_FAILURE;
-            goto finished;
-        }
-    }
-    {
-        auto& tests = parser.GetTestRecords();
-        for (const auto& tr : tests) {
-            if (tr.second->Export(fpout)) {
-                ERROR("E: failed to export test record\n");
-                exitcode = EXIT_FAILURE;
-                break;
-            }
-        }
-    }
-finished:
-    fclose(fpout);
-    if (exitcode == EXIT_FAILURE && ofile)
-        std::remove(ofile);
-
-    return exitcode;
-}
-#endif // TESTMODE
-#endif // LCOVMERGE_DEFINITION_ONLY
-
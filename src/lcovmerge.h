@@ -0,0 +1,707 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "filesystem.h"
+#include "md5.h"
+#include "output.h"
+#include "pathfilter.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "strutil.h"
+
+#define INVALID_UNSIGNED_INTEGER    UINT32_MAX
+// Diagnostics go to the standard error unless an embedder installed a
+// handler, see SetErrorHandler() in liblcovmerge.h.
+void ReportError(const char* format, ...) __attribute__((format(printf, 1, 2)));
+#define ERROR(...) ::ReportError(__VA_ARGS__)
+// The last message reported on the calling thread, without its newline.
+const std::string& GetLastReportedError();
+
+// lcov format definition
+struct LcovTestRecord;
+struct QuarantineRecord;
+struct SourceContent;
+struct SourceFileInfo;
+struct FunctionCoverageInfo;
+struct LineCoverageTable;
+struct LcovParser;
+struct LineReader;
+struct LineFields;
+struct RecordTableStats;
+struct SourceFileSummary;
+
+typedef enum {
+    UNKNOWN = 0, TN, SF, VER, FN, FNDA, FNF, FNH, DA, BRDA, BRF, BRH, LF, LH, END_OF_RECORD,
+    LAST_RECORD_TYPE
+} LcovRecordType;
+using LcovRecordArgList = std::vector<std::string_view>;
+// The name of a record type in angle brackets, as used in messages.
+const char* RecordType2Str(LcovRecordType type);
+
+struct LcovTestRecord {
+
+    LcovTestRecord(Arena* arena, std::string_view tn, IFilesystem* fs)
+        : tn_(arena->Intern(tn)), sfs_(arena->GetResource()), fs_(fs), arena_(arena) {}
+    std::string_view GetTestName() const { return tn_; }
+    int Export(OutputSink* out, bool sorted);
+    void ExportTestName(OutputSink* out) const;
+    // Source files in the order they are exported.
+    std::vector<SourceFileInfo*> GetSourceFiles(bool sorted) const;
+    // Source files which conflict with ours are left in `other` and appended
+    // to `quarantine` if it's given, instead of failing the merge.
+    bool Merge(LcovTestRecord* other, std::string* err, std::vector<QuarantineRecord>* quarantine = nullptr);
+
+private:
+    SourceFileInfo* GetCurrentSourceFileInfo() const { return cursf_; }
+    void SetCurrentSourceFileInfo(SourceFileInfo* sf) { cursf_ = sf; }
+    IFilesystem* GetFilesystemInterface() const { return fs_; }
+
+private:
+    std::string_view tn_;
+    // fullpath -> SourceFileInfo
+    std::pmr::unordered_map<std::string_view, SourceFileInfo*> sfs_;
+    SourceFileInfo* cursf_= nullptr;
+    IFilesystem* fs_;
+    Arena* arena_;
+
+    friend LcovParser;
+};
+
+// Bitmaps stored in 64-bit words.
+static inline bool BitmapTest(const std::pmr::vector<uint64_t>& bits, size_t i)
+{
+    return bits[i / 64] >> (i % 64) & 1;
+}
+static inline void BitmapSet(std::pmr::vector<uint64_t>* bits, size_t i)
+{
+    (*bits)[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+// Line coverage of a source file. A few lines scattered over a large file are
+// kept in slots sorted by line number, once at least half of the lines are
+// defined the table switches to a dense layout indexed by line number (and
+// back if it becomes sparse again). The arrays are split by field, checksums
+// are only allocated once a line has one.
+struct LineCoverageTable {
+    enum { kMinDenseLines = 64 };
+
+    LineCoverageTable(std::pmr::memory_resource* mr)
+        : lines_(mr), counts_(mr), defined_(mr), has_checksum_(mr), checksums_(mr) {}
+
+    // Returns the slot of the line, which is defined if it isn't yet. Slots are
+    // only valid until the next line is defined.
+    uint32_t Define(uint32_t lineno);
+    // Returns false if the line is not defined. *checksum is set to nullptr
+    // if the line has none.
+    bool Lookup(uint32_t lineno, uint32_t* xcount, const uint8_t** checksum = nullptr) const;
+    void AddCount(uint32_t slot, uint32_t xcount) { counts_[slot] += xcount; }
+    // Returns nullptr if there's no checksum for the line.
+    const uint8_t* GetChecksum(uint32_t slot) const {
+        return BitmapTest(has_checksum_, slot) ? &checksums_[slot * MD5Hash::Length] : nullptr;
+    }
+    void SetChecksum(uint32_t slot, const uint8_t* checksum);
+    uint32_t GetLineCount() const { return size_; }
+    void Save(SnapshotWriter* w) const;
+    // Returns false if the snapshot is inconsistent.
+    bool Load(SnapshotReader* r, bool discard_checksum);
+    bool IsDense() const { return dense_; }
+
+    // Calls fn(lineno, xcount, checksum) for every defined line in order, the
+    // checksum is nullptr if there's none.
+    template<typename Fn>
+    void ForEach(Fn&& fn) const {
+        for (uint32_t i = 0; i < counts_.size(); i++) {
+            if (!dense_)
+                fn(lines_[i], counts_[i], GetChecksum(i));
+            else if (BitmapTest(defined_, i))
+                fn(i, counts_[i], GetChecksum(i));
+        }
+    }
+
+private:
+    // Position of the first slot not below lineno, sparse layout only.
+    size_t FindSlot(uint32_t lineno) const;
+    void InsertSlot(size_t pos, uint32_t lineno);
+    // Extend the dense layout to `nlines` slots.
+    void Resize(size_t nlines);
+    void Relayout(bool dense);
+
+    bool dense_ = false;
+    uint32_t size_ = 0;                       // number of defined lines
+    size_t hint_ = 0;                         // the slot touched last
+    std::pmr::vector<uint32_t> lines_;        // line number of each slot if sparse
+    std::pmr::vector<uint32_t> counts_;
+    std::pmr::vector<uint64_t> defined_;      // slots which are defined if dense
+    std::pmr::vector<uint64_t> has_checksum_;
+    std::pmr::vector<uint8_t> checksums_;     // MD5Hash::Length bytes per slot
+};
+
+// Branch coverage of a source file in compressed sparse rows. A row holds the
+// branches of one block on a line, the rows are sorted by (lineno, blkno) and
+// the counts of row i are counts_[offsets_[i], offsets_[i + 1]). Whether a
+// branch is defined or has been evaluated at all is kept in bitmaps indexed
+// like counts_. Lines without branches take no space.
+struct BranchCoverageTable {
+    enum { NEVER_EXECUTED = UINT32_MAX - 1 };
+
+    BranchCoverageTable(std::pmr::memory_resource* mr)
+        : rows_(mr), offsets_(1, 0, mr), counts_(mr), defined_(mr), executed_(mr) {}
+
+    // Define the branch and accumulate its execution count, NEVER_EXECUTED
+    // ('-') only sticks as long as no record says it has been evaluated.
+    void Add(uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount);
+    // Returns false if the branch is not defined, xcount is NEVER_EXECUTED if
+    // it has not been evaluated.
+    bool Lookup(uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t* xcount) const;
+    // Number of slots taken by the branches on the line once the branch is defined.
+    size_t CountLineSlots(uint32_t lineno, uint32_t blkno, uint32_t brno) const;
+    void Merge(const BranchCoverageTable& other);
+    void Save(SnapshotWriter* w) const;
+    bool Load(SnapshotReader* r);
+
+    // Calls fn(lineno, blkno, brno, xcount) for every defined branch in order.
+    template<typename Fn>
+    void ForEach(Fn&& fn) const {
+        for (size_t r = 0; r < rows_.size(); r++) {
+            for (uint32_t i = offsets_[r]; i < offsets_[r + 1]; i++) {
+                if (BitmapTest(defined_, i))
+                    fn(rows_[r].lineno_, rows_[r].blkno_, i - offsets_[r],
+                       BitmapTest(executed_, i) ? counts_[i] : static_cast<uint32_t>(NEVER_EXECUTED));
+            }
+        }
+    }
+
+private:
+    struct Row {
+        uint32_t lineno_;
+        uint32_t blkno_;
+        bool operator<(const Row& o) const {
+            return lineno_ < o.lineno_ || (lineno_ == o.lineno_ && blkno_ < o.blkno_);
+        }
+        bool operator==(const Row& o) const { return lineno_ == o.lineno_ && blkno_ == o.blkno_; }
+    };
+
+    size_t FindRow(uint32_t lineno, uint32_t blkno) const;
+    // Returns the index of the slot of the branch, the slot is created if needed.
+    size_t GetSlot(uint32_t lineno, uint32_t blkno, uint32_t brno);
+
+    std::pmr::vector<Row> rows_;
+    std::pmr::vector<uint32_t> offsets_;
+    std::pmr::vector<uint32_t> counts_;
+    std::pmr::vector<uint64_t> defined_;
+    std::pmr::vector<uint64_t> executed_;
+    size_t hint_ = 0; // the row touched last, records usually come in order
+};
+
+// Content, line map and line checksums of a source file. A single instance is
+// shared by every SourceFileInfo referring to the same file, see SourceCache.
+struct SourceContent : std::enable_shared_from_this<SourceContent> {
+
+    bool Load(IFilesystem* fs, const char* path, std::string* err);
+    bool IsLoaded() const { return status_ == LOADED; }
+    uint32_t GetLineCount() const { return linemap_.size() - 2; }
+    std::string_view ReadLineData(uint32_t lineno, bool no_newline) const;
+    // MD5 checksum of a line including its newline, the checksums of all lines
+    // are calculated at once the first time one of them is needed.
+    const uint8_t* GetLineChecksum(uint32_t lineno);
+    // Whether the file has been written since it was loaded, or tried to be.
+    // Must not race with Load().
+    bool HasChanged(IFilesystem* fs, const char* path) const;
+
+private:
+    enum { UNKNOWN, LOADED, ON_ERROR };
+    std::once_flag load_once_;
+    std::once_flag checksum_once_;
+    int status_ = UNKNOWN;
+    int64_t mtime_ = -1; // -1 if the file couldn't be found
+    std::string error_;
+    std::unique_ptr<IFilesystem::FileView> view_;
+    std::string_view content_;
+    // linemap_[lineno] is the offset of line `lineno`, followed by the size of
+    // the content. linemap_[0] is unused.
+    std::vector<uint32_t> linemap_;
+    std::vector<uint8_t> checksums_; // MD5Hash::Length bytes per line, indexed by lineno
+};
+
+// Process-wide cache of source file contents, keyed by the canonical path of
+// the file. Entries are reference counted and released together with the
+// last arena retaining them.
+struct SourceCache {
+
+    static SourceCache& Instance();
+    std::shared_ptr<SourceContent> Get(IFilesystem* fs, std::string_view path);
+    // Forget the contents of the files in `fs` which changed since they were
+    // loaded, the next Get() loads them again. The forgotten contents are
+    // appended to `stale`. Must not race with loading them.
+    void Invalidate(IFilesystem* fs, std::vector<std::shared_ptr<SourceContent>>* stale);
+    // Drop everything cached for `fs`, which is going away. Another filesystem
+    // may be allocated at its address later.
+    void Forget(IFilesystem* fs);
+
+private:
+    using Table = std::unordered_map<std::string, std::weak_ptr<SourceContent>>;
+    struct Namespace {
+        Table paths_;     // path as spelled in SF records
+        Table canonical_; // canonical path
+    };
+
+    std::mutex lock_;
+    std::unordered_map<IFilesystem*, Namespace> namespaces_;
+};
+
+struct SourceFileInfo {
+
+    // Everything but the contents of the source file is allocated from `arena`.
+    SourceFileInfo(Arena* arena, std::string_view fullpath)
+        : fullpath_(arena->Intern(fullpath)), funcs_(arena->GetResource()),
+          das_(arena->GetResource()), branches_(arena->GetResource()), arena_(arena) {
+        sfname_ = fullpath_.substr(fullpath_.find_last_of("/\\") + 1);
+    }
+
+    // Writes the record from SF to end_of_record, functions are ordered by
+    // line and name if `sorted`.
+    int Export(OutputSink* out, bool sorted);
+    bool Merge(const SourceFileInfo& other, std::string* err);
+    // Returns false with the error Merge() would fail with, without merging.
+    bool CheckMerge(const SourceFileInfo& other, std::string* err) const;
+    // Everything but the path, which the loader needs to create the record.
+    void Save(SnapshotWriter* w) const;
+    bool Load(SnapshotReader* r, bool discard_checksum);
+    void AddTableStats(RecordTableStats* ts) const;
+    void AddToSummary(SourceFileSummary* summary) const;
+    std::string_view GetSourceFileName() const { return sfname_; }
+    // NUL-terminated
+    std::string_view GetSourceFilePath() const { return fullpath_; }
+
+    bool IsLineDataAvailable() const { return src_ && src_->IsLoaded(); }
+    // nullptr until the line map has been asked for.
+    const SourceContent* GetSourceContent() const { return src_; }
+    bool LoadLineMap(IFilesystem* fs, std::string* err);
+    std::string_view ReadLineData(uint32_t lineno, bool no_newline) const;
+    const uint8_t* GetLineChecksum(uint32_t lineno) const;
+
+    FunctionCoverageInfo* LookupFunction(std::string_view name);
+    template<typename... Targs>
+    std::pair<FunctionCoverageInfo*, bool> GetFunction(std::string_view name, Targs &&...args);
+    LineCoverageTable* GetLineCoverage() { return &das_; }
+    const LineCoverageTable* GetLineCoverage() const { return &das_; }
+    const BranchCoverageTable* GetBranchCoverage() const { return &branches_; }
+    const std::pmr::unordered_map<std::string_view, FunctionCoverageInfo>& GetFunctions() const { return funcs_; }
+
+    enum { INVALID_BLOCK_ID = UINT16_MAX, INVALID_BRANCH_ID = UINT16_MAX };
+    void AddBranchCoverage(uint32_t lineno, uint32_t blkId, uint32_t branchId, uint32_t xcount);
+    bool LookupBranchCoverage(uint32_t lineno, uint32_t blkId, uint32_t branchId, uint32_t* xcount) const {
+        return branches_.Lookup(lineno, blkId, branchId, xcount);
+    }
+
+    bool IsLineNumberInRange(uint32_t lineno) const {
+        if (IsLineDataAvailable())
+            return lineno > 0 && lineno <= src_->GetLineCount();
+        return lineno > 0;
+    }
+    bool SetVersionID(int version) {
+        assert(version != VERSION_UNSET && version != VERSION_INVALID);
+        if (version_ == VERSION_UNSET) {
+            version_ = version;
+            return true;
+        }
+        return false;
+    }
+    bool IsCompatible(int version) const {
+        return version_ == VERSION_UNSET || (version_ != VERSION_UNSET && version_ == version);
+    }
+    enum { VERSION_UNSET = -1, VERSION_INVALID = INT_MAX };
+
+private:
+    std::string_view sfname_; // basename
+    std::string_view fullpath_;
+    SourceContent* src_ = nullptr; // retained by arena_
+    std::pmr::unordered_map<std::string_view, FunctionCoverageInfo> funcs_;
+    LineCoverageTable das_;
+    BranchCoverageTable branches_;
+    Arena* arena_;
+    int version_ = -1;
+};
+
+struct FunctionCoverageInfo {
+    FunctionCoverageInfo() = default;
+
+    uint32_t lineno_ = 0;
+    uint32_t xcount_ = 0;
+    bool is_private_ = false;
+};
+
+// A part of the inputs dropped in keep-going mode.
+struct QuarantineRecord {
+    std::string input_;       // empty if the conflict was found merging parsed inputs
+    uint32_t lineno_ = 0;     // of the SF record or of the bad line, 0 for the whole input
+    std::string source_file_; // empty if the whole input or a line outside of an SF block
+    std::string error_;
+};
+
+// Split a tracefile into at most `nparts` parts of similar size, each of them
+// but the last ends with an end_of_record line.
+std::vector<std::string_view> SplitAtRecords(std::string_view data, size_t nparts);
+
+// Source files are assigned to one of `nshards` shards by the hash of their path.
+static inline uint32_t GetSourceFileShard(std::string_view path, uint32_t nshards)
+{
+    return ::Fnv1a64(path) % nshards;
+}
+
+// Found and hit counts of a source file, or of several of them.
+struct CoverageCounts {
+    uint64_t lines_found_ = 0;
+    uint64_t lines_hit_ = 0;
+    uint64_t functions_found_ = 0;
+    uint64_t functions_hit_ = 0;
+    uint64_t branches_found_ = 0;
+    uint64_t branches_hit_ = 0;
+
+    void Add(const CoverageCounts& other);
+};
+
+// What is left of a source file in summary mode, merged over all tests: bitmaps
+// of the found and hit lines indexed by line number, and whether each function
+// and branch has been hit.
+struct SourceFileSummary {
+    // Lines from here on are kept in a hash table, which keeps the bitmaps at
+    // 2 MiB at most.
+    enum { kMaxBitmapLine = 1 << 24 };
+
+    struct BranchKey {
+        uint32_t lineno_, blkno_, brno_;
+        bool operator==(const BranchKey& other) const {
+            return lineno_ == other.lineno_ && blkno_ == other.blkno_ && brno_ == other.brno_;
+        }
+    };
+    struct BranchKeyHash {
+        size_t operator()(const BranchKey& key) const {
+            return (static_cast<uint64_t>(key.lineno_) << 32 | key.blkno_ << 16) ^ key.brno_;
+        }
+    };
+
+    SourceFileSummary(Arena* arena)
+        : found_lines_(arena->GetResource()), hit_lines_(arena->GetResource()),
+          far_lines_(arena->GetResource()), functions_(arena->GetResource()), branches_(arena->GetResource()),
+          arena_(arena) {}
+
+    void AddLine(uint32_t lineno, bool hit);
+    // `name` is interned if it's new.
+    void AddFunction(std::string_view name, bool hit);
+    // Returns false if the function is not defined.
+    bool HitFunction(std::string_view name);
+    void AddBranch(const BranchKey& key, bool hit) { branches_[key] |= hit; }
+    void Merge(const SourceFileSummary& other);
+    CoverageCounts GetCounts() const;
+
+private:
+    std::pmr::vector<uint64_t> found_lines_;
+    std::pmr::vector<uint64_t> hit_lines_;
+    std::pmr::unordered_map<uint32_t, bool> far_lines_; // lineno >= kMaxBitmapLine
+    std::pmr::unordered_map<std::string_view, bool> functions_;
+    std::pmr::unordered_map<BranchKey, bool, BranchKeyHash> branches_;
+    Arena* arena_;
+};
+
+// Sizes of the tables holding the records of a parser, for --stats.
+struct RecordTableStats {
+    HashTableStats tests_;
+    HashTableStats source_files_; // per test
+    HashTableStats functions_;    // per source file
+    uint64_t lines_ = 0;
+    uint64_t dense_line_tables_ = 0;
+    uint64_t branches_ = 0;
+};
+
+// lcov parser
+struct LcovParser {
+
+    struct Config {
+        Config() : discard_checksum_(false), generate_checksum_(false), streaming_(false), lazy_source_(false),
+                   sorted_output_(false), trusted_(false) {}
+        uint32_t discard_checksum_:1;
+        uint32_t generate_checksum_:1;
+        // Read tracefiles in fixed-size chunks instead of mapping them as a whole.
+        uint32_t streaming_:1;
+        // Load a source file only once a checksum of one of its lines is needed,
+        // line numbers are checked against the source from then on.
+        uint32_t lazy_source_:1;
+        // Export tests, source files and functions in a fixed order.
+        uint32_t sorted_output_:1;
+        // The input has been merged by lcovmerge before, its checksums are
+        // taken as they are and sources are only read to generate missing ones.
+        uint32_t trusted_:1;
+
+        // Only keep the source files in shards [shard_first_, shard_last_] of
+        // nshards_, everything else is skipped while parsing.
+        uint32_t shard_first_ = 0;
+        uint32_t shard_last_ = 0;
+        uint32_t nshards_ = 0; // 0 keeps all of them
+        // Threads reading the sources named by a tracefile ahead of the parser,
+        // 0 reads each of them when its SF record is parsed.
+        uint32_t prefetch_jobs_ = 0;
+        // Threads parsing parts of a single mapped tracefile, which is split
+        // into parts of at least min_part_size_ bytes.
+        uint32_t parse_jobs_ = 1;
+        size_t min_part_size_ = 4 << 20;
+        // Only count the found and hit lines, functions and branches of every
+        // source file, see GetSummary(). Checksums are neither verified nor
+        // generated and the source files are not read.
+        bool summary_only_ = false;
+        // Drop the SF blocks with bad records, and the input files which can't
+        // be read completely, instead of failing. See GetQuarantine(). Not
+        // supported in summary mode.
+        bool keep_going_ = false;
+        // Bound the memory a broken or hostile input can take, 0 means no
+        // limit: the lines with a DA record per source file, and the branch
+        // slots per line, which include the branch numbers a BRDA record
+        // skips. They apply to every input on its own.
+        uint32_t max_lines_per_file_ = 0;
+        uint32_t max_branches_per_line_ = 0;
+
+        bool KeepsGoing() const { return keep_going_ && !summary_only_; }
+        // Sources are read as soon as their SF record is seen.
+        bool LoadsSourcesEagerly() const {
+            return !lazy_source_ && !trusted_ && !summary_only_ && (!discard_checksum_ || generate_checksum_);
+        }
+        bool IsInShardRange(std::string_view path) const {
+            if (!nshards_)
+                return true;
+            uint32_t shard = ::GetSourceFileShard(path, nshards_);
+            return shard >= shard_first_ && shard <= shard_last_;
+        }
+
+        // Include/exclude patterns and prefix substitutions, not owned.
+        const PathFilter* path_filter_ = nullptr;
+        // Remaps the path of a source file, possibly into `buf`, and returns
+        // false if the file is filtered out or outside of the shard range.
+        bool SelectSourceFile(std::string_view* path, std::string* buf) const {
+            if (path_filter_) {
+                *path = path_filter_->Map(*path, buf);
+                if (!path_filter_->Accepts(*path))
+                    return false;
+            }
+            return IsInShardRange(*path);
+        }
+    };
+
+    // A source file to export together with its test record, `header` is set
+    // on the first source file of a test in an output.
+    struct ExportItem {
+        LcovTestRecord* tr;
+        SourceFileInfo* sf; // nullptr for a test without source files
+        bool header;
+    };
+
+    // The test records live in the arena of the parser and go away with it.
+    LcovParser(Config& config) : cfg_(config), arena_(new Arena) {};
+
+    bool Parse(IFilesystem* fs, const char* fpath);
+    // Parse `inputs` on `jobs` threads, with the same result as parsing them
+    // one by one in order. Stops at the first input which fails to parse.
+    bool ParseFiles(IFilesystem* fs, char* const* inputs, size_t ninputs, unsigned jobs);
+    // Fold every test record collected by `other` into this parser, records
+    // that only exist in `other` are moved over instead of being copied, thus
+    // the arena of `other` is adopted and `other` is left empty.
+    bool Merge(LcovParser* other, std::string* err);
+    // Fold the test records of all of `others` into this parser on `jobs`
+    // threads, with the same result as merging them one by one. The source
+    // files are partitioned by the hash of their path, each partition is
+    // reduced by one thread which owns the records it merges into.
+    bool MergeParallel(const std::vector<LcovParser*>& others, unsigned jobs, std::string* err);
+    // Returns false with the first conflict Merge() would run into, nothing
+    // is changed. Merge() can't fail after this check passed.
+    bool CheckMerge(const LcovParser& other, std::string* err) const;
+    // Forget the cached sources of `fs` which changed on disk and drop the
+    // source files referring to them, their coverage belongs to the old
+    // contents. Source files without a loaded source are kept. The paths of
+    // the dropped source files are appended to `paths`.
+    void DropChangedSources(IFilesystem* fs, std::vector<std::string>* paths);
+    const std::unordered_map<std::string_view,LcovTestRecord*>& GetTestRecords() const { return tests_; }
+    // List the source files in the order they are exported, split into
+    // `nshards` outputs by the shard of their path.
+    std::vector<std::vector<ExportItem>> GetExportItems(uint32_t nshards = 1) const;
+    // Write every test record to `out`. The source files are serialized on
+    // `jobs` workers into memory and written in order.
+    bool Export(OutputSink* out, unsigned jobs) { return Export(out, GetExportItems()[0], jobs); }
+    bool Export(OutputSink* out, const std::vector<ExportItem>& items, unsigned jobs);
+    // Write the test records as a binary snapshot, see snapshot.h. Parse()
+    // loads snapshots as they are, their records are not verified again.
+    bool ExportSnapshot(OutputSink* out) { return ExportSnapshot(out, GetExportItems()[0]); }
+    bool ExportSnapshot(OutputSink* out, const std::vector<ExportItem>& items);
+
+    // Number of records parsed per LcovRecordType, including those of merged parsers.
+    const uint64_t* GetRecordCounts() const { return records_; }
+    RecordTableStats GetTableStats() const;
+    // Counts of every source file in summary mode, merged over all tests and
+    // sorted by path.
+    std::vector<std::pair<std::string_view, CoverageCounts>> GetSummary() const;
+    // What has been dropped in keep-going mode, in the order it was found.
+    const std::vector<QuarantineRecord>& GetQuarantine() const { return quarantine_; }
+
+private:
+    bool ParseLines(IFilesystem* fs, const char* fpath, LineReader* reader, uint32_t first_lineno = 1);
+    // Parse the parts of a tracefile on a worker each, see SplitAtRecords().
+    bool ParseParts(IFilesystem* fs, const char* fpath, const std::vector<std::string_view>& parts);
+    // Fold the workers continuing one another into this parser, in order.
+    bool MergeContinuations(IFilesystem* fs, const std::vector<LcovParser*>& workers, unsigned jobs,
+                            std::string* err);
+    LcovTestRecord* GetTestRecord(std::string_view name, IFilesystem* fs);
+    // The test record of the SF blocks before the first TN line, see continuation_.
+    LcovTestRecord* GetRecordBeforeTN(IFilesystem* fs);
+    bool LoadSnapshot(IFilesystem* fs, std::string_view data, std::string* err);
+    // Snapshots are loaded from memory, compressed ones are decoded as a whole first.
+    bool LoadCompressedSnapshot(IFilesystem* fs, const char* fpath, IFilesystem::InputStream* in);
+    bool ParseLine(IFilesystem* fs, const char* fpath, uint32_t lineno, std::string_view line,
+                   const LineFields& fields, LcovRecordArgList* args, std::string* errmsg);
+    // Drop the current SF block, or only the line if there's none, for the
+    // error reported last.
+    void Quarantine(const char* fpath, uint32_t lineno);
+    // Merge the SF block parsed into staging_ at its end, unless it conflicts.
+    void CommitBlock(const char* fpath);
+    // The counterpart of the record handlers in summary mode.
+    bool ParseSummaryRecord(LcovRecordType type, LcovRecordArgList* args, std::string* err);
+    // Fold the test records into the summaries, e.g. those of a snapshot.
+    void SummarizeTests();
+
+    typedef bool (*RecordHandler)(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerSF(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerFN(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerFNDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerBRDA(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerEOR(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+    static bool HandlerVER(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+
+    // NOTE: FNF, FNH, BRF, BRH, LF and LH take only one integer argument and we don't really
+    // care about their values, cause those records will be recalculated anyway.
+    // This special handler does nothing more than basic validation.
+    static bool HandlerNFNH(LcovTestRecord* tr, LcovRecordArgList* args, Config* config, std::string* err);
+
+    enum { kExportBatch = 64 }; // source files per worker and round of Export
+    enum { kMergeShardsPerJob = 4 };
+    enum { kRunsPerJob = 4 }; // runs of inputs per thread in ParseFiles()
+    static constexpr RecordHandler kHandlers_[LcovRecordType::LAST_RECORD_TYPE] = {
+        nullptr, // UNKNOWN
+        nullptr, // TN
+        HandlerSF,
+        HandlerVER,
+        HandlerFN,
+        HandlerFNDA,
+        HandlerNFNH, //HandlerFNF,
+        HandlerNFNH, //HandlerFNH,
+        HandlerDA,
+        HandlerBRDA,
+        HandlerNFNH, //HandlerBRF,
+        HandlerNFNH, //HandlerBRH,
+        HandlerNFNH, //HandlerLF,
+        HandlerNFNH, //HandlerLH,
+        HandlerEOR,
+    };
+
+    LcovTestRecord* current_test_ = nullptr;
+    std::unordered_map<std::string_view,LcovTestRecord*> tests_;
+    bool skipping_ = false; // in a source file which is filtered out or outside of the shard range
+    std::string mapped_path_; // the remapped path of the current SF record
+    // Parsing a part of a tracefile which doesn't begin at the start of the file,
+    // source files before the first TN record are collected in inherited_.
+    bool continuation_ = false;
+    LcovTestRecord* inherited_ = nullptr;
+    std::unordered_map<std::string_view, SourceFileSummary*> summaries_; // summary mode only
+    SourceFileSummary* cursummary_ = nullptr;
+    // In keep-going mode SF blocks are parsed into staging_ and merged into
+    // staged_test_ once they are complete, inputs are parsed by an isolated_
+    // parser of their own first.
+    LcovTestRecord* staging_ = nullptr;
+    LcovTestRecord* staged_test_ = nullptr;
+    uint32_t block_lineno_ = 0; // 0 if not in a block
+    bool isolated_ = false;
+    std::vector<QuarantineRecord> quarantine_;
+    uint64_t records_[LcovRecordType::LAST_RECORD_TYPE] = {};
+    Config cfg_;
+    std::unique_ptr<Arena> arena_;
+};
+
+// Offsets of the structural characters of a line, relative to its beginning.
+struct LineFields {
+    enum { kMaxCommas = 4 };
+
+    void Reset() { colon_ = -1; ncommas_ = 0; }
+
+    int32_t colon_ = -1;          // the first colon, -1 if there's none
+    uint32_t ncommas_ = 0;        // number of commas after the first colon
+    uint32_t commas_[kMaxCommas]; // offsets of the first kMaxCommas of them
+};
+
+// Splits a tracefile into lines. The input is either a view of the whole file,
+// or a stream consumed in chunks through a read-ahead buffer, in which case
+// only the line being parsed and the rest of the current chunk are in memory.
+// The input is classified in blocks of kScanBlockSize bytes, a single pass
+// finds the line terminators as well as the fields of every line.
+struct LineReader {
+
+    enum { kChunkSize = 1 << 20, kMaxLineLength = 1 << 24 };
+
+    LineReader(std::string_view data) : data_(data), bytes_read_(data.size()), scan_(data.data()) {}
+    LineReader(IFilesystem::InputStream* stream, size_t chunk_size = kChunkSize)
+        : stream_(stream), chunk_size_(chunk_size) {}
+
+    // Returns 1 and the next line without its line terminator, 0 at the end of
+    // the input or -1 on error.
+    int NextLine(std::string_view* line, LineFields* fields, std::string* err);
+    uint64_t GetBytesRead() const { return bytes_read_; }
+
+private:
+    bool Refill(std::string* err);
+
+    std::string_view data_;                      // unconsumed input
+    IFilesystem::InputStream* stream_ = nullptr;
+    size_t chunk_size_ = 0;
+    std::vector<char> buffer_;                  // backing storage of data_ in streaming mode
+    bool eof_ = false;
+    uint64_t bytes_read_ = 0;
+
+    const char* scan_ = nullptr;  // the first byte which is not classified yet
+    const char* block_ = nullptr; // the block mask_ belongs to
+    uint64_t mask_ = 0;           // structural characters of block_ not consumed yet
+};
+
+struct LineParser {
+
+    LineParser(std::string_view line, const LineFields& fields) : line_(line), fields_(fields) {}
+
+    LcovRecordType ParseRecordType();
+    bool ParseRecordArguments(LcovRecordArgList* args, std::string* err);
+
+private:
+    std::string_view line_;
+    const LineFields& fields_;
+    size_t pos_ = 0; // beginning of the arguments
+};
@@ -0,0 +1,157 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "liblcovmerge.h"
+
+#include <cstdarg>
+#include <mutex>
+
+#include "lcovmerge.h"
+#include "parallel.h"
+
+namespace {
+
+std::mutex error_lock;
+std::function<void(std::string_view)> error_handler;
+thread_local std::string last_error;
+
+} // namespace
+
+void ReportError(const char* format, ...)
+{
+    char buf[1024];
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+
+    std::string message;
+    if (static_cast<size_t>(len) < sizeof(buf))
+        message.assign(buf, len);
+    else {
+        message.resize(len);
+        va_start(ap, format);
+        vsnprintf(&message[0], len + 1, format, ap);
+        va_end(ap);
+    }
+
+    last_error.assign(message, 0, message.size() - (!message.empty() && message.back() == '\n'));
+    std::lock_guard<std::mutex> guard(error_lock);
+    if (!error_handler) {
+        fputs(message.c_str(), stderr);
+        return;
+    }
+    error_handler(last_error);
+}
+
+const std::string& GetLastReportedError()
+{
+    return last_error;
+}
+
+void SetErrorHandler(std::function<void(std::string_view message)> handler)
+{
+    std::lock_guard<std::mutex> guard(error_lock);
+    error_handler = std::move(handler);
+}
+
+struct LcovMerger::Impl {
+    Impl(IFilesystem* fs, const LcovParser::Config& config) : overlay_(fs), config_(config), report_(config_) {}
+    // The contents read through the overlay stay with the records retaining them.
+    ~Impl() { SourceCache::Instance().Forget(&overlay_); }
+
+    // Fold a parsed input into the report unless it conflicts with it.
+    bool Fold(LcovParser* delta) {
+        std::string err;
+        if (!report_.CheckMerge(*delta, &err) || !report_.Merge(delta, &err)) {
+            ERROR("E: %s\n", err.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    MemoryFilesystem overlay_;
+    LcovParser::Config config_;
+    LcovParser report_;
+    unsigned jobs_ = 1;
+};
+
+LcovMerger::LcovMerger(IFilesystem* fs, const Options& options)
+{
+    LcovParser::Config config;
+    config.discard_checksum_ = options.discard_checksum_;
+    config.generate_checksum_ = options.generate_checksum_;
+    config.lazy_source_ = options.lazy_source_;
+    config.sorted_output_ = options.sorted_output_;
+    config.max_lines_per_file_ = options.max_lines_per_file_;
+    config.max_branches_per_line_ = options.max_branches_per_line_;
+    config.parse_jobs_ = ResolveJobCount(options.jobs_);
+    // As with the command line tool, see main.cc.
+    if (config.parse_jobs_ > 1)
+        config.sorted_output_ = true;
+    impl_.reset(new Impl(fs, config));
+    impl_->jobs_ = config.parse_jobs_;
+}
+
+LcovMerger::~LcovMerger() = default;
+
+bool LcovMerger::Add(const char* path)
+{
+    LcovParser delta(impl_->config_);
+    return delta.Parse(&impl_->overlay_, path) && impl_->Fold(&delta);
+}
+
+bool LcovMerger::AddData(const std::string& name, std::string data)
+{
+    impl_->overlay_.PutFile(name, std::move(data));
+    bool ok = Add(name.c_str());
+    impl_->overlay_.RemoveFile(name);
+    return ok;
+}
+
+bool LcovMerger::Merge(LcovMerger* other)
+{
+    return impl_->Fold(&other->impl_->report_);
+}
+
+void LcovMerger::Reset()
+{
+    impl_->report_ = LcovParser(impl_->config_);
+}
+
+bool LcovMerger::Export(OutputSink* out)
+{
+    if (impl_->report_.Export(out, impl_->jobs_) && out->Flush())
+        return true;
+    ERROR("E: failed to export the report: %s\n", out->GetError().c_str());
+    return false;
+}
+
+bool LcovMerger::ExportSnapshot(OutputSink* out)
+{
+    if (impl_->report_.ExportSnapshot(out) && out->Flush())
+        return true;
+    ERROR("E: failed to export the snapshot: %s\n", out->GetError().c_str());
+    return false;
+}
+
+bool LcovMerger::ExportToString(std::string* report)
+{
+    MemoryOutputSink out;
+    if (!Export(&out))
+        return false;
+    *report = std::move(out.GetContent());
+    return true;
+}
@@ -0,0 +1,82 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "filesystem.h"
+#include "filesystem_memory.h"
+#include "output.h"
+
+// Embeddable interface of lcovmerge, built as liblcovmerge. Tracefiles and
+// snapshots are parsed and merged in-process, without fork/exec and without
+// temporary files, and the merged report is written to any OutputSink.
+//
+// Inputs are read through an IFilesystem: HostFilesystem (filesystem_host.h)
+// reads from disk, MemoryFilesystem serves buffers such as the output of an
+// instrumented binary. AddData() stores a buffer in an overlay of the given
+// filesystem, through which the sources named by the buffer are still read.
+struct LcovMerger {
+
+    // The equivalents of the command line options of the same name.
+    struct Options {
+        bool discard_checksum_ = false;  // -d
+        bool generate_checksum_ = false; // -g
+        bool lazy_source_ = false;       // -l
+        bool sorted_output_ = false;     // -S
+        unsigned jobs_ = 1;              // -j, 0 means one thread per CPU, more than one implies -S
+        uint32_t max_lines_per_file_ = 0;    // --max-lines, 0 means no limit
+        uint32_t max_branches_per_line_ = 0; // --max-branches
+    };
+
+    // `fs` is not owned, it must outlive the merger.
+    LcovMerger(IFilesystem* fs, const Options& options);
+    LcovMerger(IFilesystem* fs) : LcovMerger(fs, Options()) {}
+    LcovMerger(const LcovMerger&) = delete;
+    LcovMerger& operator=(const LcovMerger&) = delete;
+    ~LcovMerger();
+
+    // Parse a tracefile or snapshot and fold it into the report. The report is
+    // left untouched if the input can't be parsed or conflicts with it, the
+    // reason is reported to the error handler.
+    bool Add(const char* path);
+    // The same for an in-memory input, `name` is used in messages.
+    bool AddData(const std::string& name, std::string data);
+    // Fold the report of `other` into this one, `other` is left empty.
+    bool Merge(LcovMerger* other);
+    // Drop every record.
+    void Reset();
+
+    // Write the report as lcov text or as a binary snapshot, which Add() and
+    // the lcovmerge tool load without parsing. `out` is flushed, not finished.
+    // Failures are reported to the error handler.
+    bool Export(OutputSink* out);
+    bool ExportSnapshot(OutputSink* out);
+    bool ExportToString(std::string* report);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Diagnostics of lcovmerge are written to the standard error unless a handler
+// is set, which receives them without their trailing newline. The handler is
+// process-wide, it may be called from any thread but calls are serialized by a
+// lock, so it must not call back into lcovmerge (including SetErrorHandler()).
+// An empty handler restores the default.
+void SetErrorHandler(std::function<void(std::string_view message)> handler);
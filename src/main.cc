@@ -0,0 +1,829 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "lcovmerge.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#include "compress.h"
+#include "diff.h"
+#include "filesystem_host.h"
+#include "getopt.h"
+#include "parallel.h"
+#include "server.h"
+
+[[noreturn]] static void usage(const char* program, int exitcode)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS] <inputfile1>[inputfileN...]\n\n", program);
+    fprintf(stderr, "Options:\n"
+                    "   -h,--help               Print this help message and exit.\n"
+                    "   -b,--base=FILE          Merge the input files into FILE, a report\n"
+                    "                           merged by lcovmerge before. Its checksums\n"
+                    "                           are trusted and its sources are not read.\n"
+                    "   -d,--discard-checksum   Discard and ignore line checksums,\n"
+                    "                           checksums will not longer be validated.\n"
+                    "   -g,--generate-checksum  Generate checksum for each line record.\n"
+                    "                           If -d is specified, then the existing\n"
+                    "                           checksums from files will be ignored and\n"
+                    "                           replaced by new generated checksums.\n"
+                    "   -f,--format=FORMAT      Write the merged report as 'lcov' text (the\n"
+                    "                           default) or as a binary 'snapshot', which\n"
+                    "                           loads without parsing. Input files are\n"
+                    "                           recognized as snapshots unless streamed.\n"
+                    "   -l,--lazy-source        Only read the source files of which line\n"
+                    "                           checksums are validated or generated.\n"
+                    "   -p,--prefetch=N         Read the sources named by an input file on N\n"
+                    "                           threads ahead of parsing it, which hides the\n"
+                    "                           latency of network filesystems.\n"
+                    "   -s,--streaming          Read input files in fixed-size chunks instead\n"
+                    "                           of loading them as a whole, this is always\n"
+                    "                           the case for the standard input ('-').\n"
+                    "   -S,--sort               Write tests, source files and functions in\n"
+                    "                           sorted order, the output only depends on\n"
+                    "                           the contents of the input files.\n"
+                    "   -j,--jobs=N             Parse input files and serialize the output\n"
+                    "                           on N threads, 0 means one thread per CPU.\n"
+                    "                           Large files are split at end_of_record\n"
+                    "                           lines when there are more threads than\n"
+                    "                           input files. The order in which the\n"
+                    "                           threads merge records varies, thus -j N\n"
+                    "                           with N other than 1 implies -S.\n"
+                    "   -o,--output-file=FILE   Write the merged report to FILE instead of\n"
+                    "                           the standard output.\n"
+                    "   -P,--partition=N        Split the merged report by the hash of the\n"
+                    "                           source file paths into N shards, written to\n"
+                    "                           FILE.0 ... FILE.<N-1>.\n"
+                    "   -R,--shard-range=I[-J]/N\n"
+                    "                           Only merge the source files in shards I to J\n"
+                    "                           of N, the others are skipped while parsing.\n"
+                    "   -z,--compress=FORMAT[:LEVEL]\n"
+                    "                           Compress the output with 'gzip' or 'zstd'.\n"
+                    "                           Compressed input files are always detected.\n"
+                    "   --include=PATTERN       Only merge the source files of which the path\n"
+                    "                           matches one of the given glob patterns.\n"
+                    "   --exclude=PATTERN       Drop the source files of which the path matches\n"
+                    "                           the glob pattern, may be given several times.\n"
+                    "   --map-prefix=OLD=NEW    Replace the prefix OLD of source file paths by\n"
+                    "                           NEW, before they are filtered and read. The\n"
+                    "                           first matching rule applies.\n"
+                    "   --stats[=FILE]          Write timings, I/O and table statistics as JSON\n"
+                    "                           to FILE, or to the standard error.\n"
+                    "   --summary[=FORMAT]      Only count the lines, functions and branches\n"
+                    "                           found and hit per source file and in total,\n"
+                    "                           printed as a 'table' (the default) or 'json'.\n"
+                    "                           No report is merged, which is much faster.\n"
+                    "   --diff=FILE             Print the lines, functions and branches of\n"
+                    "                           which the hit status differs between FILE, a\n"
+                    "                           merged report, and the merged input files.\n"
+                    "                           Lines are matched by their checksums, moved\n"
+                    "                           lines are compared with their old location\n"
+                    "                           and edited lines are not compared.\n"
+                    "   --keep-going[=REPORT]   Drop the SF blocks with bad records and the\n"
+                    "                           input files which can't be read completely,\n"
+                    "                           instead of failing, and merge the rest. What\n"
+                    "                           has been dropped is written to REPORT as JSON.\n"
+                    "   --max-lines=N           Reject source files with more than N lines of\n"
+                    "                           coverage in an input file.\n"
+                    "   --max-branches=N        Reject lines with more than N branches in an\n"
+                    "                           input file, counting skipped branch numbers.\n"
+                    "   --serve=SOCKET          Keep the merged input files in memory and serve\n"
+                    "                           MERGE FILE..., EXPORT FILE, INVALIDATE, RESET,\n"
+                    "                           STATS and SHUTDOWN requests on a Unix socket.\n"
+                    "   --send=SOCKET           Send the request given by the arguments to the\n"
+                    "                           server on SOCKET and print its reply.\n");
+    exit(exitcode);
+}
+
+// Parses FIRST[-LAST]/N
+static bool ParseShardRange(const char* arg, LcovParser::Config* config)
+{
+    std::string_view str(arg);
+    size_t slash = str.find('/');
+    if (slash == std::string_view::npos)
+        return false;
+    std::string_view range = str.substr(0, slash);
+    size_t dash = range.find('-');
+    std::string_view last = dash == std::string_view::npos ? range : range.substr(dash + 1);
+
+    return ::ParseUnsigned32(range.substr(0, dash), &config->shard_first_) &&
+           ::ParseUnsigned32(last, &config->shard_last_) &&
+           ::ParseUnsigned32(str.substr(slash + 1), &config->nshards_) &&
+           config->shard_first_ <= config->shard_last_ && config->shard_last_ < config->nshards_;
+}
+
+struct OutputFormat {
+    bool snapshot_ = false;
+    Compression compression_ = Compression::NONE;
+    int level_ = 0;
+};
+
+// Export `items` to `out` in the given format and complete the output. The
+// error is the one of the compressing sink if there's one, `out` may not know
+// about it.
+static bool WriteReport(LcovParser* parser, const std::vector<LcovParser::ExportItem>& items,
+                        const OutputFormat& format, unsigned jobs, OutputSink* out, std::string* err)
+{
+    std::unique_ptr<CompressingOutputSink> compressed;
+    if (format.compression_ != Compression::NONE) {
+        compressed.reset(new CompressingOutputSink(out, format.compression_, format.level_, jobs));
+        out = compressed.get();
+    }
+    if ((format.snapshot_ ? parser->ExportSnapshot(out, items) : parser->Export(out, items, jobs)) &&
+        out->Finish())
+        return true;
+    *err = out->GetError();
+    return false;
+}
+
+static void WriteJsonString(OutputSink* out, std::string_view str)
+{
+    out->Put('"');
+    for (unsigned char ch : str) {
+        if (ch == '"' || ch == '\\') {
+            out->Put('\\');
+            out->Put(ch);
+        } else if (ch < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out->Write(buf, 6);
+        } else
+            out->Put(ch);
+    }
+    out->Put('"');
+}
+
+// Writes the "lines", "functions" and "branches" members of an object.
+static void WriteJsonCounts(OutputSink* out, const CoverageCounts& counts)
+{
+    const std::pair<const char*, std::pair<uint64_t, uint64_t>> kinds[] = {
+        { "lines", { counts.lines_found_, counts.lines_hit_ } },
+        { "functions", { counts.functions_found_, counts.functions_hit_ } },
+        { "branches", { counts.branches_found_, counts.branches_hit_ } },
+    };
+    for (size_t i = 0; i < 3; i++) {
+        out->Write(i ? ", \"" : "\"");
+        out->Write(kinds[i].first);
+        out->Write("\": {\"found\": ");
+        out->WriteUnsigned(kinds[i].second.first);
+        out->Write(", \"hit\": ");
+        out->WriteUnsigned(kinds[i].second.second);
+        out->Put('}');
+    }
+}
+
+// Formats "hit/found percent" for a column of the summary table.
+static std::string FormatCoverage(uint64_t found, uint64_t hit)
+{
+    char buf[64];
+    if (!found)
+        return "-";
+    snprintf(buf, sizeof(buf), "%" PRIu64 "/%" PRIu64 " %5.1f%%", hit, found, 100.0 * hit / found);
+    return buf;
+}
+
+// Write the merged counts per source file and in total, as a table or JSON.
+static bool WriteSummary(const LcovParser* parser, bool json, OutputSink* out)
+{
+    auto files = parser->GetSummary();
+    CoverageCounts total;
+    for (const auto& file : files)
+        total.Add(file.second);
+
+    if (json) {
+        out->Write("{\"files\": [");
+        for (size_t i = 0; i < files.size(); i++) {
+            out->Write(i ? ",\n  {\"path\": " : "\n  {\"path\": ");
+            WriteJsonString(out, files[i].first);
+            out->Write(", ");
+            WriteJsonCounts(out, files[i].second);
+            out->Put('}');
+        }
+        out->Write("\n], \"total\": {");
+        WriteJsonCounts(out, total);
+        out->Write("}}\n");
+        return out->Finish();
+    }
+
+    int width = 5; // "Total"
+    for (const auto& file : files)
+        width = std::max(width, static_cast<int>(file.first.size()));
+    auto write_row = [&](std::string_view path, const std::string& lines, const std::string& functions,
+                         const std::string& branches) {
+        std::string row(path);
+        row.resize(std::max(row.size(), static_cast<size_t>(width)), ' ');
+        char buf[128];
+        snprintf(buf, sizeof(buf), "  %22s  %22s  %22s\n", lines.c_str(), functions.c_str(), branches.c_str());
+        out->Write(row);
+        out->Write(buf);
+    };
+    write_row("Path", "Lines", "Functions", "Branches");
+    for (const auto& file : files) {
+        const auto& c = file.second;
+        write_row(file.first, FormatCoverage(c.lines_found_, c.lines_hit_),
+                  FormatCoverage(c.functions_found_, c.functions_hit_),
+                  FormatCoverage(c.branches_found_, c.branches_hit_));
+    }
+    write_row("Total", FormatCoverage(total.lines_found_, total.lines_hit_),
+              FormatCoverage(total.functions_found_, total.functions_hit_),
+              FormatCoverage(total.branches_found_, total.branches_hit_));
+    return out->Finish();
+}
+
+// Write what has been dropped in keep-going mode to `path` as JSON.
+static bool WriteQuarantine(const std::vector<QuarantineRecord>& quarantine, const char* path)
+{
+    FdOutputSink out(-1);
+    std::string err;
+    if (!out.Open(path, &err)) {
+        ERROR("E: failed to open '%s': %s\n", path, err.c_str());
+        return false;
+    }
+    out.Write("{\"quarantined\": [");
+    for (size_t i = 0; i < quarantine.size(); i++) {
+        const auto& rec = quarantine[i];
+        out.Write(i ? ",\n  {\"input\": " : "\n  {\"input\": ");
+        WriteJsonString(&out, rec.input_);
+        out.Write(", \"line\": ");
+        out.WriteUnsigned(rec.lineno_);
+        out.Write(", \"source_file\": ");
+        WriteJsonString(&out, rec.source_file_);
+        out.Write(", \"error\": ");
+        WriteJsonString(&out, rec.error_);
+        out.Put('}');
+    }
+    out.Write("\n]}\n");
+    if (!out.Finish()) {
+        ERROR("E: failed to write '%s': %s\n", path, out.GetError().c_str());
+        return false;
+    }
+    return true;
+}
+
+// Write shard i of the result to <prefix>.<i>, the shards written so far are
+// removed again if one of them fails.
+static bool ExportPartitions(LcovParser* parser, const char* prefix, uint32_t nshards,
+                             const OutputFormat& format, unsigned jobs)
+{
+    auto parts = parser->GetExportItems(nshards);
+    std::string errmsg;
+
+    for (uint32_t i = 0; i < nshards; i++) {
+        std::string path = std::string(prefix) + "." + std::to_string(i);
+        FdOutputSink out(-1);
+        bool ok = out.Open(path.c_str(), &errmsg) && WriteReport(parser, parts[i], format, jobs, &out, &errmsg);
+        Stats::Add(Stats::OUTPUT_BYTES, out.GetBytesWritten());
+        if (!ok) {
+            ERROR("E: failed to write '%s': %s\n", path.c_str(), errmsg.c_str());
+            for (uint32_t j = 0; j <= i; j++)
+                std::remove((std::string(prefix) + "." + std::to_string(j)).c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keeps a merged report resident for --serve, so that a job only pays for
+// parsing its own tracefiles. The sources read for the report stay cached as
+// long as its records refer to them. Requests:
+//   MERGE FILE...  parse the files and fold them into the report, which is
+//                  left untouched if any of them fails or conflicts with it
+//   EXPORT FILE    write the report to FILE in the output format
+//   INVALIDATE     forget the sources changed on disk and drop their records,
+//                  the reply lists the dropped source files
+//   RESET          drop every record
+//   STATS          count the tests, source files and lines of the report
+//   SHUTDOWN       stop the server
+struct MergeService {
+
+    MergeService(LcovParser* report, const LcovParser::Config& config, IFilesystem* fs,
+                 const OutputFormat& format, unsigned jobs)
+        : report_(report), config_(config), fs_(fs), format_(format), jobs_(jobs) {}
+
+    // Returns false once the server should stop.
+    bool Handle(const std::vector<std::string>& args, std::string* reply);
+
+private:
+    void Merge(const std::vector<std::string>& args, std::string* reply);
+    void Export(const char* path, std::string* reply);
+
+    LcovParser* report_;
+    LcovParser::Config config_;
+    IFilesystem* fs_;
+    OutputFormat format_;
+    unsigned jobs_;
+};
+
+bool MergeService::Handle(const std::vector<std::string>& args, std::string* reply)
+{
+    const std::string& command = args[0];
+    if (command == "MERGE" && args.size() > 1)
+        Merge(args, reply);
+    else if (command == "EXPORT" && args.size() == 2)
+        Export(args[1].c_str(), reply);
+    else if (command == "INVALIDATE" && args.size() == 1) {
+        std::vector<std::string> paths;
+        report_->DropChangedSources(fs_, &paths);
+        *reply = "OK " + std::to_string(paths.size());
+        for (const auto& path : paths)
+            *reply += "\t" + path;
+    } else if (command == "RESET" && args.size() == 1) {
+        *report_ = LcovParser(config_);
+        *reply = "OK";
+    } else if (command == "STATS" && args.size() == 1) {
+        RecordTableStats ts = report_->GetTableStats();
+        *reply = "OK tests=" + std::to_string(ts.tests_.size_) + " source_files=" +
+                 std::to_string(ts.source_files_.size_) + " lines=" + std::to_string(ts.lines_);
+    } else if (command == "SHUTDOWN" && args.size() == 1) {
+        *reply = "OK";
+        return false;
+    } else
+        *reply = "ERROR unknown command or wrong number of arguments";
+    return true;
+}
+
+void MergeService::Merge(const std::vector<std::string>& args, std::string* reply)
+{
+    std::vector<char*> inputs;
+    for (size_t i = 1; i < args.size(); i++)
+        inputs.push_back(const_cast<char*>(args[i].c_str()));
+    unsigned jobs = std::min<size_t>(jobs_, inputs.size());
+    config_.parse_jobs_ = std::max<unsigned>(1, jobs_ / inputs.size());
+
+    LcovParser delta(config_);
+    bool ok = true;
+    if (jobs > 1)
+        ok = delta.ParseFiles(fs_, inputs.data(), inputs.size(), jobs);
+    else {
+        for (size_t i = 0; ok && i < inputs.size(); i++)
+            ok = delta.Parse(fs_, inputs[i]);
+    }
+    if (!ok) {
+        *reply = "ERROR failed to parse the input files, see the server log";
+        return;
+    }
+
+    std::string err;
+    if (!report_->CheckMerge(delta, &err) || !report_->Merge(&delta, &err)) {
+        *reply = "ERROR " + err;
+        return;
+    }
+    *reply = "OK";
+}
+
+void MergeService::Export(const char* path, std::string* reply)
+{
+    FdOutputSink out(-1);
+    std::string err;
+    if (!out.Open(path, &err) || !WriteReport(report_, report_->GetExportItems()[0], format_, jobs_, &out, &err)) {
+        *reply = "ERROR failed to write '" + std::string(path) + "': " + err;
+        std::remove(path);
+        return;
+    }
+    *reply = "OK";
+}
+
+// Serve requests on the Unix domain socket `path` until SHUTDOWN.
+static bool Serve(LcovParser* report, const LcovParser::Config& config, IFilesystem* fs, const char* path,
+                  const OutputFormat& format, unsigned jobs)
+{
+    CommandServer server;
+    std::string err;
+    if (!server.Listen(path, &err)) {
+        ERROR("E: failed to listen on '%s': %s\n", path, err.c_str());
+        return false;
+    }
+    MergeService service(report, config, fs, format, jobs);
+    if (!server.Run([&](const std::vector<std::string>& args, std::string* reply) {
+            return service.Handle(args, reply);
+        }, &err)) {
+        ERROR("E: failed to serve on '%s': %s\n", path, err.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Send a request to the server on `path` and print its reply, relative paths
+// among the arguments are resolved against the current directory first.
+static int SendRequest(const char* program, const char* path, char** words, int nwords)
+{
+    std::vector<std::string> args(words, words + nwords);
+    for (size_t i = 1; i < args.size(); i++) {
+        std::error_code ec;
+        auto absolute = std::filesystem::absolute(args[i], ec);
+        if (ec) {
+            fprintf(stderr, "%s: failed to resolve '%s': %s\n", program, args[i].c_str(), ec.message().c_str());
+            return EXIT_FAILURE;
+        }
+        args[i] = absolute.string();
+    }
+
+    std::string reply, err;
+    if (!SendCommand(path, args, &reply, &err)) {
+        fprintf(stderr, "%s: failed to talk to '%s': %s\n", program, path, err.c_str());
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", reply.c_str());
+    return reply.compare(0, 2, "OK") ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+enum Phase { PHASE_PARSE, PHASE_BASE, PHASE_MERGE, PHASE_EXPORT, kNumPhases };
+
+static void WriteTableStats(FILE* f, const char* name, const HashTableStats& hs)
+{
+    fprintf(f, "    \"%s\": {\"tables\": %" PRIu64 ", \"size\": %" PRIu64 ", \"buckets\": %" PRIu64
+               ", \"load_factor\": %.3f},\n", name, hs.tables_, hs.size_, hs.buckets_, hs.GetLoadFactor());
+}
+
+static void WriteStats(FILE* f, const LcovParser* parser, const PhaseTimer* phases)
+{
+    static const char* kPhaseNames[kNumPhases] = { "parse", "base", "merge", "export" };
+    auto seconds = [](uint64_t ns) { return ns / 1e9; };
+
+    fprintf(f, "{\n  \"phases\": {\n");
+    for (int i = 0; i < kNumPhases; i++) {
+        fprintf(f, "    \"%s\": {\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f}%s\n", kPhaseNames[i],
+                seconds(phases[i].wall_ns_), seconds(phases[i].cpu_ns_), i + 1 < kNumPhases ? "," : "");
+    }
+    // Summed up over all threads, these overlap with the parse phases.
+    fprintf(f, "  },\n  \"source_load_seconds\": %.6f,\n  \"checksum_seconds\": %.6f,\n",
+            seconds(Stats::Get(Stats::SOURCE_LOAD_NS)), seconds(Stats::Get(Stats::CHECKSUM_NS)));
+    fprintf(f, "  \"input\": {\"tracefiles\": %" PRIu64 ", \"tracefile_bytes\": %" PRIu64
+               ", \"source_files\": %" PRIu64 ", \"source_bytes\": %" PRIu64 "},\n",
+            Stats::Get(Stats::TRACEFILE_FILES), Stats::Get(Stats::TRACEFILE_BYTES),
+            Stats::Get(Stats::SOURCE_FILES), Stats::Get(Stats::SOURCE_BYTES));
+
+    fprintf(f, "  \"records\": {");
+    const uint64_t* records = parser->GetRecordCounts();
+    for (int i = LcovRecordType::TN; i < LcovRecordType::LAST_RECORD_TYPE; i++) {
+        std::string_view name = RecordType2Str(static_cast<LcovRecordType>(i));
+        name = name.substr(1, name.size() - 2); // without the brackets
+        fprintf(f, "%s\"%.*s\": %" PRIu64, i > LcovRecordType::TN ? ", " : "",
+                static_cast<int>(name.size()), name.data(), records[i]);
+    }
+
+    RecordTableStats ts = parser->GetTableStats();
+    fprintf(f, "},\n  \"tables\": {\n");
+    WriteTableStats(f, "tests", ts.tests_);
+    WriteTableStats(f, "source_files", ts.source_files_);
+    WriteTableStats(f, "functions", ts.functions_);
+    fprintf(f, "    \"lines\": %" PRIu64 ", \"dense_line_tables\": %" PRIu64 ", \"branches\": %" PRIu64 "\n  },\n",
+            ts.lines_, ts.dense_line_tables_, ts.branches_);
+    fprintf(f, "  \"output_bytes\": %" PRIu64 ",\n  \"peak_rss_bytes\": %" PRIu64 "\n}\n",
+            Stats::Get(Stats::OUTPUT_BYTES), Stats::GetPeakRss());
+}
+
+int main(int argc, char** argv)
+{
+    enum { OPT_STATS = 0x100, OPT_INCLUDE, OPT_EXCLUDE, OPT_MAP_PREFIX, OPT_SERVE, OPT_SEND,
+           OPT_SUMMARY, OPT_DIFF, OPT_KEEP_GOING, OPT_MAX_LINES, OPT_MAX_BRANCHES }; // long only
+    LcovParser::Config config;
+    const option kLongOptions[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "base", required_argument, NULL, 'b' },
+        { "discard-checksum", no_argument, NULL, 'd' },
+        { "format", required_argument, NULL, 'f' },
+        { "generate-checksum", no_argument, NULL, 'g'},
+        { "lazy-source", no_argument, NULL, 'l'},
+        { "prefetch", required_argument, NULL, 'p'},
+        { "streaming", no_argument, NULL, 's'},
+        { "sort", no_argument, NULL, 'S'},
+        { "jobs", required_argument, NULL, 'j'},
+        { "output-file", required_argument, NULL, 'o'},
+        { "partition", required_argument, NULL, 'P'},
+        { "shard-range", required_argument, NULL, 'R'},
+        { "stats", OPTIONAL_ARG, NULL, OPT_STATS},
+        { "compress", required_argument, NULL, 'z'},
+        { "include", required_argument, NULL, OPT_INCLUDE},
+        { "exclude", required_argument, NULL, OPT_EXCLUDE},
+        { "map-prefix", required_argument, NULL, OPT_MAP_PREFIX},
+        { "serve", required_argument, NULL, OPT_SERVE},
+        { "send", required_argument, NULL, OPT_SEND},
+        { "summary", OPTIONAL_ARG, NULL, OPT_SUMMARY},
+        { "diff", required_argument, NULL, OPT_DIFF},
+        { "keep-going", OPTIONAL_ARG, NULL, OPT_KEEP_GOING},
+        { "max-lines", required_argument, NULL, OPT_MAX_LINES},
+        { "max-branches", required_argument, NULL, OPT_MAX_BRANCHES},
+        { NULL, 0, NULL, 0 },
+    };
+    int opt, exitcode = EXIT_SUCCESS;
+    const char* ofile = nullptr;
+    const char* basefile = nullptr;
+    const char* difffile = nullptr;
+    const char* reportfile = nullptr;
+    const char* statsfile = nullptr;
+    const char* serve_socket = nullptr;
+    const char* send_socket = nullptr;
+    bool stats = false;
+    bool summary = false, summary_json = false;
+    PhaseTimer phases[kNumPhases];
+    PathFilter filter;
+    OutputFormat format;
+    uint32_t npartitions = 0;
+    const char* program = argv[0];
+    unsigned jobs = 1;
+    HostFilesystem fs;
+    FdOutputSink out(fileno(stdout));
+    std::string errmsg;
+
+    while (-1 != (opt = getopt_long(argc, argv, "b:df:ghj:lo:p:P:R:sSz:", kLongOptions, NULL))) {
+        switch (opt) {
+            case 'h':
+                usage(program, EXIT_SUCCESS);
+                /*UNREACHABLE*/
+            case 'b':
+                basefile = optarg;
+                break;
+            case 'd':
+                config.discard_checksum_ = true;
+                break;
+            case 'f':
+                if (!strcmp(optarg, "snapshot"))
+                    format.snapshot_ = true;
+                else if (strcmp(optarg, "lcov")) {
+                    fprintf(stderr, "%s: unknown output format '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'g':
+                config.generate_checksum_ = true;
+                break;
+            case 'z':
+                if (!ParseCompression(optarg, &format.compression_, &format.level_)) {
+                    fprintf(stderr, "%s: invalid compression '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                if (!IsCompressionSupported(format.compression_)) {
+                    fprintf(stderr, "%s: %s compression is not supported by this build\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                config.lazy_source_ = true;
+                break;
+            case 'p':
+                if (!::ParseUnsigned32(optarg, &config.prefetch_jobs_) || config.prefetch_jobs_ > UINT8_MAX) {
+                    fprintf(stderr, "%s: invalid number of prefetch threads '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                config.streaming_ = true;
+                break;
+            case 'S':
+                config.sorted_output_ = true;
+                break;
+            case 'j': {
+                uint32_t n;
+                if (!::ParseUnsigned32(optarg, &n) || n > UINT16_MAX) {
+                    fprintf(stderr, "%s: invalid number of jobs '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                jobs = ResolveJobCount(n);
+                break;
+            }
+            case 'o':
+                ofile = optarg;
+                break;
+            case 'P':
+                if (!::ParseUnsigned32(optarg, &npartitions) || npartitions == 0) {
+                    fprintf(stderr, "%s: invalid number of partitions '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'R':
+                if (!ParseShardRange(optarg, &config)) {
+                    fprintf(stderr, "%s: invalid shard range '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_INCLUDE:
+                filter.AddInclude(optarg);
+                config.path_filter_ = &filter;
+                break;
+            case OPT_EXCLUDE:
+                filter.AddExclude(optarg);
+                config.path_filter_ = &filter;
+                break;
+            case OPT_MAP_PREFIX:
+                if (!filter.AddPrefixMap(optarg)) {
+                    fprintf(stderr, "%s: invalid prefix mapping '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                config.path_filter_ = &filter;
+                break;
+            case OPT_STATS:
+                stats = true;
+                statsfile = optarg;
+                break;
+            case OPT_SERVE:
+                serve_socket = optarg;
+                break;
+            case OPT_SEND:
+                send_socket = optarg;
+                break;
+            case OPT_SUMMARY:
+                summary = true;
+                if (optarg && !strcmp(optarg, "json"))
+                    summary_json = true;
+                else if (optarg && strcmp(optarg, "table")) {
+                    fprintf(stderr, "%s: unknown summary format '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                config.summary_only_ = true;
+                break;
+            case OPT_DIFF:
+                difffile = optarg;
+                break;
+            case OPT_KEEP_GOING:
+                config.keep_going_ = true;
+                reportfile = optarg;
+                break;
+            case OPT_MAX_LINES:
+                if (!::ParseUnsigned32(optarg, &config.max_lines_per_file_)) {
+                    fprintf(stderr, "%s: invalid number of lines '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case OPT_MAX_BRANCHES:
+                if (!::ParseUnsigned32(optarg, &config.max_branches_per_line_)) {
+                    fprintf(stderr, "%s: invalid number of branches '%s'\n", program, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(program, EXIT_FAILURE);
+                /*UNREACHABLE*/
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (send_socket) {
+        if (!argc) {
+            fprintf(stderr, "%s: --send requires a command\n", program);
+            return EXIT_FAILURE;
+        }
+        return SendRequest(program, send_socket, argv, argc);
+    }
+    if (serve_socket && (ofile || npartitions)) {
+        fprintf(stderr, "%s: --serve writes reports on request only, -o and -P don't apply\n", program);
+        return EXIT_FAILURE;
+    }
+    if (summary && (serve_socket || npartitions || format.snapshot_ || format.compression_ != Compression::NONE)) {
+        fprintf(stderr, "%s: --summary writes no report, --serve, -P, -f and -z don't apply\n", program);
+        return EXIT_FAILURE;
+    }
+    if (difffile && (summary || basefile || serve_socket || npartitions || format.snapshot_ ||
+                     format.compression_ != Compression::NONE)) {
+        fprintf(stderr, "%s: --diff writes no report, --summary, -b, --serve, -P, -f and -z don't apply\n", program);
+        return EXIT_FAILURE;
+    }
+    if (config.keep_going_ && (summary || serve_socket)) {
+        fprintf(stderr, "%s: --keep-going doesn't apply to --summary and --serve\n", program);
+        return EXIT_FAILURE;
+    }
+    if (!argc && !basefile && !serve_socket) {
+        fprintf(stderr, "%s: no input files\n", program);
+        return EXIT_FAILURE;
+    }
+
+    if (npartitions && !ofile) {
+        fprintf(stderr, "%s: -P requires an output file\n", program);
+        return EXIT_FAILURE;
+    }
+    if (ofile && !npartitions && !out.Open(ofile, &errmsg)) {
+        fprintf(stderr, "%s: failed to open '%s': %s\n", program, ofile, errmsg.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (stats)
+        Stats::Enable();
+    // Records are inserted in the order the threads get to them, only sorted
+    // output is the same from run to run.
+    if (jobs > 1)
+        config.sorted_output_ = true;
+    // Threads left over by fewer inputs than jobs split the inputs themselves.
+    config.parse_jobs_ = std::max(1u, jobs / std::max(1, argc));
+
+    LcovParser parser(config);
+    LcovParser::Config base_config = config;
+    base_config.trusted_ = true;
+    LcovParser base(base_config);
+    LcovParser* result = &parser;
+    // Serializing the output isn't bounded by the number of inputs.
+    unsigned export_jobs = jobs;
+    if (jobs > static_cast<unsigned>(argc))
+        jobs = argc;
+    phases[PHASE_PARSE].Start();
+    if (jobs > 1) {
+        if (!parser.ParseFiles(&fs, argv, argc, jobs)) {
+            exitcode = EXIT_FAILURE;
+            goto finished;
+        }
+    } else {
+        for (int i = 0; i < argc; i++) {
+            if (!parser.Parse(&fs, argv[i])) {
+                exitcode = EXIT_FAILURE;
+                goto finished;
+            }
+        }
+    }
+    phases[PHASE_PARSE].Stop();
+    if (basefile || difffile) {
+        phases[PHASE_BASE].Start();
+        if (!base.Parse(&fs, basefile ? basefile : difffile)) {
+            exitcode = EXIT_FAILURE;
+            goto finished;
+        }
+        phases[PHASE_BASE].Stop();
+    }
+    // Only the state of the new inputs is folded into the base, the records of
+    // the base are neither verified nor copied again.
+    if (basefile) {
+        phases[PHASE_MERGE].Start();
+        if (!base.Merge(&parser, &errmsg)) {
+            ERROR("E: %s\n", errmsg.c_str());
+            exitcode = EXIT_FAILURE;
+            goto finished;
+        }
+        phases[PHASE_MERGE].Stop();
+        result = &base;
+    }
+    if (serve_socket) {
+        if (!Serve(result, config, &fs, serve_socket, format, export_jobs))
+            exitcode = EXIT_FAILURE;
+        goto finished;
+    }
+    if (config.keep_going_) {
+        size_t inputs = 0, blocks = 0;
+        for (const auto& rec : result->GetQuarantine()) {
+            if (!rec.lineno_ && !rec.input_.empty())
+                inputs++;
+            else
+                blocks++;
+        }
+        if (!result->GetQuarantine().empty())
+            ERROR("W: dropped %zu SF blocks or lines and %zu input files\n", blocks, inputs);
+        if (reportfile && !WriteQuarantine(result->GetQuarantine(), reportfile)) {
+            exitcode = EXIT_FAILURE;
+            goto finished;
+        }
+    }
+    phases[PHASE_EXPORT].Start();
+    if (difffile) {
+        WriteDiff(&out, DiffReports(base, parser));
+        if (!out.Finish()) {
+            ERROR("E: failed to write the differences: %s\n", out.GetError().c_str());
+            exitcode = EXIT_FAILURE;
+        }
+    } else if (summary) {
+        if (!WriteSummary(result, summary_json, &out)) {
+            ERROR("E: failed to write the summary: %s\n", out.GetError().c_str());
+            exitcode = EXIT_FAILURE;
+        }
+    } else if (npartitions) {
+        if (!ExportPartitions(result, ofile, npartitions, format, export_jobs))
+            exitcode = EXIT_FAILURE;
+        ofile = nullptr; // nothing to remove
+    } else if (!WriteReport(result, result->GetExportItems()[0], format, export_jobs, &out, &errmsg)) {
+        ERROR("E: failed to export test record: %s\n", errmsg.c_str());
+        exitcode = EXIT_FAILURE;
+    }
+    phases[PHASE_EXPORT].Stop();
+    if (!npartitions)
+        Stats::Add(Stats::OUTPUT_BYTES, out.GetBytesWritten());
+
+    if (stats) {
+        FILE* f = statsfile ? fopen(statsfile, "w") : stderr;
+        if (!f) {
+            ERROR("E: failed to open '%s': %s\n", statsfile, strerror(errno));
+            exitcode = EXIT_FAILURE;
+        } else {
+            WriteStats(f, result, phases);
+            if (f != stderr && fclose(f)) {
+                ERROR("E: failed to write '%s': %s\n", statsfile, strerror(errno));
+                exitcode = EXIT_FAILURE;
+            }
+        }
+    }
+finished:
+    if (exitcode == EXIT_FAILURE && ofile)
+        std::remove(ofile);
+
+    return exitcode;
+}
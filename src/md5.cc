@@ -18,6 +18,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "base64.h"
 #include "md5.h"
 
 /*
@@ -144,9 +145,95 @@ void MD5Hash::Finalize(uint8_t* result)
     }
 }
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MD5_HAVE_LANES 1
+
+// 4 lanes, SSE2 on x86-64 and NEON on AArch64 are part of the baseline.
+#define MD5_LANES 4
+#define MD5_LANES_FN HashLanes4
+#include "md5_lanes.inc"
+#undef MD5_LANES
+#undef MD5_LANES_FN
+
+#if defined(__x86_64__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define MD5_LANES 8
+#define MD5_LANES_FN HashLanes8
+#include "md5_lanes.inc"
+#undef MD5_LANES
+#undef MD5_LANES_FN
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define MD5_LANES 16
+#define MD5_LANES_FN HashLanes16
+#include "md5_lanes.inc"
+#undef MD5_LANES
+#undef MD5_LANES_FN
+#pragma GCC pop_options
+#endif // __x86_64__
+#endif // __ORDER_LITTLE_ENDIAN__
+
+namespace {
+
+using HashLanesFn = void (*)(const uint32_t*, const std::string_view*, size_t, uint8_t (*)[MD5Hash::Length]);
+struct HashLanesImpl {
+    HashLanesFn fn;
+    const char* name;
+};
+
+HashLanesImpl SelectHashLanes()
+{
+#if defined(MD5_HAVE_LANES) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return { HashLanes16, "avx512f" };
+    if (__builtin_cpu_supports("avx2"))
+        return { HashLanes8, "avx2" };
+    return { HashLanes4, "sse2" };
+#elif defined(MD5_HAVE_LANES)
+    return { HashLanes4, "generic-4" };
+#else
+    return { nullptr, "scalar" };
+#endif
+}
+
+const HashLanesImpl kHashLanes = SelectHashLanes();
+
+} // namespace
+
+void MD5Hash::HashMany(const std::string_view* msgs, size_t n, uint8_t (*out)[Length])
+{
+    if (kHashLanes.fn && n > 1) {
+        static constexpr const uint32_t kInit[4] = { A, B, C, D };
+        kHashLanes.fn(kInit, msgs, n, out);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        MD5Hash md5hash;
+        md5hash.Update(msgs[i].data(), msgs[i].size());
+        md5hash.Finalize(out[i]);
+    }
+}
+
+const char* MD5Hash::GetHashManyName()
+{
+    return kHashLanes.name;
+}
+
 bool MD5Hash::Base64ToMD5(const char *base64, uint8_t *buf, size_t base64_len)
 {
-    return true;
+    size_t len = Length;
+    if (base64_len != Base64PaddedLength)
+        return false;
+    return Base64Decode(base64, base64_len, buf, &len) && len == Length;
+}
+
+void MD5Hash::ToBase64(const uint8_t* hash, char* output)
+{
+    output[Base64Encode(hash, Length, output)] = '\0';
 }
 
 void MD5Hash::Step(uint32_t* input)
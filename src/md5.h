@@ -17,17 +17,35 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <string_view>
 
 struct MD5Hash {
-    enum { Length = 16, Base64Length = 22 };
+    // Base64Length doesn't count the "==" padding lcov checksums end with.
+    enum { Length = 16, Base64Length = 22, Base64PaddedLength = 24 };
     MD5Hash() { Init(); }
 
     void Init();
     void Update(const char* in, size_t len);
     void Finalize(uint8_t* result);
 
+    // Hash `n` independent messages, several of them at once with SIMD lanes
+    // (SSE2/NEON, AVX2 or AVX-512 depending on the CPU).
+    static void HashMany(const std::string_view* msgs, size_t n, uint8_t (*out)[Length]);
+    // Name of the implementation selected by HashMany().
+    static const char* GetHashManyName();
+
+    // Decodes a padded base64 checksum into `buf` (Length bytes).
     static bool Base64ToMD5(const char* base64, uint8_t* buf, size_t base64_len);
+    // Writes the padded base64 form of `hash` to `output`, followed by a NUL,
+    // `output` must hold Base64PaddedLength + 1 characters.
     static void ToBase64(const uint8_t* hash, char* output);
+    static bool Equals(const uint8_t* a, const uint8_t* b) {
+        uint64_t x[2], y[2];
+        (void)memcpy(x, a, Length);
+        (void)memcpy(y, b, Length);
+        return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
+    }
 
 private:
     enum { A = 0x67452301, B = 0xefcdab89, C = 0x98badcfe, D = 0x10325476 };
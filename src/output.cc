@@ -0,0 +1,145 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "output.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <climits>
+
+static constexpr const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void OutputSink::WriteUnsigned(uint64_t value)
+{
+    char buf[20];
+    char* p = buf + sizeof(buf);
+
+    while (value >= 100) {
+        unsigned pair = value % 100;
+        value /= 100;
+        *--p = kDigitPairs[pair * 2 + 1];
+        *--p = kDigitPairs[pair * 2];
+    }
+    if (value >= 10) {
+        *--p = kDigitPairs[value * 2 + 1];
+        *--p = kDigitPairs[value * 2];
+    } else
+        *--p = '0' + value;
+    Write(p, buf + sizeof(buf) - p);
+}
+
+void OutputSink::FlushBuffer(const char* data, size_t len)
+{
+    struct iovec iov[2];
+    int iovcnt = 0;
+
+    if (pos_) {
+        iov[iovcnt].iov_base = buffer_.get();
+        iov[iovcnt++].iov_len = pos_;
+    }
+    if (len) {
+        iov[iovcnt].iov_base = const_cast<char*>(data);
+        iov[iovcnt++].iov_len = len;
+    }
+    if (iovcnt && !failed_ && !WriteBuffers(iov, iovcnt, &error_))
+        failed_ = true;
+    written_ += pos_ + len;
+    pos_ = 0;
+}
+
+bool OutputSink::Flush()
+{
+    FlushBuffer(nullptr, 0);
+    return !failed_;
+}
+
+FdOutputSink::~FdOutputSink()
+{
+    if (owned_)
+        (void)close(fd_);
+}
+
+bool FdOutputSink::Open(const char* path, std::string* err)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        err->assign(strerror(errno));
+        return false;
+    }
+    if (owned_)
+        (void)close(fd_);
+    fd_ = fd;
+    owned_ = true;
+    return true;
+}
+
+bool FdOutputSink::WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err)
+{
+    struct iovec pending[2];
+    assert(iovcnt <= 2);
+    (void)memcpy(pending, iov, iovcnt * sizeof(*iov));
+
+    for (struct iovec* p = pending; iovcnt > 0; ) {
+        ssize_t wlen = writev(fd_, p, iovcnt);
+        if (wlen == -1) {
+            if (errno == EINTR)
+                continue;
+            err->assign(strerror(errno));
+            return false;
+        }
+        // Skip what has been written, writev() may stop in the middle.
+        size_t done = wlen;
+        while (iovcnt > 0 && done >= p->iov_len) {
+            done -= p->iov_len;
+            p++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            p->iov_base = static_cast<char*>(p->iov_base) + done;
+            p->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+bool FileOutputSink::WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err)
+{
+    for (int i = 0; i < iovcnt; i++) {
+        if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, fp_) != iov[i].iov_len) {
+            err->assign(strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MemoryOutputSink::WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err)
+{
+    for (int i = 0; i < iovcnt; i++)
+        content_.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    return true;
+}
@@ -0,0 +1,117 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Buffered writer for reports. Records are formatted into a large user-space
+// buffer and the backend only sees writes of whole buffers. Errors are sticky,
+// check Flush() once everything has been written.
+struct OutputSink {
+
+    enum { kBufferSize = 1 << 20 };
+
+    OutputSink() : buffer_(new char[kBufferSize]) {}
+    virtual ~OutputSink() {}
+
+    void Put(char ch) {
+        if (pos_ == kBufferSize)
+            FlushBuffer(nullptr, 0);
+        buffer_[pos_++] = ch;
+    }
+    void Write(const char* data, size_t len) {
+        if (len <= static_cast<size_t>(kBufferSize) - pos_) {
+            (void)memcpy(buffer_.get() + pos_, data, len);
+            pos_ += len;
+        } else
+            FlushBuffer(data, len);
+    }
+    void Write(std::string_view str) { Write(str.data(), str.size()); }
+    void WriteUnsigned(uint64_t value);
+
+    // Writes everything that is buffered, returns false if any write failed.
+    bool Flush();
+    // Flushes and completes the output, nothing may be written afterwards.
+    virtual bool Finish() { return Flush(); }
+    bool HasFailed() const { return failed_; }
+    const std::string& GetError() const { return error_; }
+    // Number of bytes written so far, including the buffered ones.
+    uint64_t GetBytesWritten() const { return written_ + pos_; }
+
+protected:
+    // Drop everything buffered and start counting from zero again.
+    void Reset() { pos_ = 0; written_ = 0; }
+    // Records an error unless there's one already, returns false.
+    bool Fail(const std::string& err) {
+        if (!failed_) {
+            failed_ = true;
+            error_ = err;
+        }
+        return false;
+    }
+    // Write all the given buffers in order, returns false and sets the error
+    // message on failure.
+    virtual bool WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err) = 0;
+
+private:
+    // Writes the buffer followed by data[0, len).
+    void FlushBuffer(const char* data, size_t len);
+
+    std::unique_ptr<char[]> buffer_;
+    size_t pos_ = 0;
+    uint64_t written_ = 0;
+    bool failed_ = false;
+    std::string error_;
+};
+
+// Writes to a file descriptor with writev(2), the descriptor is not closed.
+struct FdOutputSink : public OutputSink {
+    FdOutputSink(int fd) : fd_(fd) {}
+    ~FdOutputSink() override;
+    // Creates or truncates `path` and writes to it instead, the file is
+    // closed when the sink is destroyed.
+    bool Open(const char* path, std::string* err);
+protected:
+    bool WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err) override;
+private:
+    int fd_;
+    bool owned_ = false;
+};
+
+// Writes to a stdio stream, the stream is not closed.
+struct FileOutputSink : public OutputSink {
+    FileOutputSink(FILE* fp) : fp_(fp) {}
+protected:
+    bool WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err) override;
+private:
+    FILE* fp_;
+};
+
+// Collects the output in memory.
+struct MemoryOutputSink : public OutputSink {
+    std::string& GetContent() { Flush(); return content_; }
+    void Clear() { Reset(); content_.clear(); }
+protected:
+    bool WriteBuffers(const struct iovec* iov, int iovcnt, std::string* err) override;
+private:
+    std::string content_;
+};
@@ -0,0 +1,100 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+unsigned ResolveJobCount(unsigned jobs)
+{
+    if (jobs)
+        return jobs;
+    unsigned ncpus = std::thread::hardware_concurrency();
+    return ncpus ? ncpus : 1;
+}
+
+void ParallelFor(size_t count, unsigned nworkers, const std::function<void(unsigned, size_t)>& fn)
+{
+    if (nworkers > count)
+        nworkers = count;
+    if (nworkers <= 1) {
+        for (size_t i = 0; i < count; i++)
+            fn(0, i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned id) {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+            fn(id, i);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nworkers - 1);
+    for (unsigned id = 1; id < nworkers; id++)
+        threads.emplace_back(worker, id);
+    worker(0);
+    for (auto& t : threads)
+        t.join();
+}
+
+WorkQueue::WorkQueue(unsigned nthreads)
+{
+    threads_.reserve(nthreads);
+    for (unsigned i = 0; i < nthreads; i++)
+        threads_.emplace_back(&WorkQueue::Run, this);
+}
+
+WorkQueue::~WorkQueue()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+        tasks_.clear();
+    }
+    cond_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+bool WorkQueue::Submit(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (stopping_)
+            return false;
+        tasks_.push_back(std::move(fn));
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void WorkQueue::Run()
+{
+    for (;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            cond_.wait(guard, [this]() { return stopping_ || !tasks_.empty(); });
+            if (stopping_)
+                return;
+            fn = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        fn();
+    }
+}
@@ -0,0 +1,53 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns the number of workers to use when the user asked for `jobs` threads,
+// 0 means one worker per available CPU.
+unsigned ResolveJobCount(unsigned jobs);
+
+// Run fn(worker, index) for every index in [0, count) on at most `nworkers`
+// threads. Indices are handed out dynamically, `worker` identifies the thread
+// running the call (in [0, nworkers)) so callers can keep per-worker state.
+// Returns once every index has been processed.
+void ParallelFor(size_t count, unsigned nworkers, const std::function<void(unsigned, size_t)>& fn);
+
+// Runs submitted tasks on a fixed set of threads in submission order. The
+// destructor drops the tasks that have not started yet and waits for the
+// running ones.
+struct WorkQueue {
+
+    WorkQueue(unsigned nthreads);
+    ~WorkQueue();
+
+    // Returns false once the queue is being destroyed, `fn` is dropped then.
+    bool Submit(std::function<void()> fn);
+
+private:
+    void Run();
+
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,54 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "pathfilter.h"
+
+#include <fnmatch.h>
+
+bool PathFilter::AddPrefixMap(std::string_view rule)
+{
+    size_t eq = rule.find('=');
+    if (eq == std::string_view::npos || eq == 0)
+        return false;
+    prefixes_.emplace_back(rule.substr(0, eq), rule.substr(eq + 1));
+    return true;
+}
+
+std::string_view PathFilter::Map(std::string_view path, std::string* buf) const
+{
+    for (const auto& rule : prefixes_) {
+        if (path.substr(0, rule.first.size()) == rule.first) {
+            buf->assign(rule.second);
+            buf->append(path.substr(rule.first.size()));
+            return *buf;
+        }
+    }
+    return path;
+}
+
+static bool MatchesAny(const std::vector<std::string>& patterns, const char* path)
+{
+    for (const auto& pattern : patterns) {
+        if (!fnmatch(pattern.c_str(), path, 0))
+            return true;
+    }
+    return false;
+}
+
+bool PathFilter::Accepts(std::string_view path) const
+{
+    if (includes_.empty() && excludes_.empty())
+        return true;
+    std::string str(path); // fnmatch() wants a NUL-terminated string
+    return (includes_.empty() || MatchesAny(includes_, str.c_str())) && !MatchesAny(excludes_, str.c_str());
+}
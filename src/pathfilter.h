@@ -0,0 +1,42 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Selects and rewrites the paths of source files while parsing. Patterns are
+// fnmatch(3) globs without FNM_PATHNAME, so '*' also matches '/' like in
+// lcov --extract/--remove.
+struct PathFilter {
+
+    void AddInclude(std::string pattern) { includes_.push_back(std::move(pattern)); }
+    void AddExclude(std::string pattern) { excludes_.push_back(std::move(pattern)); }
+    // Parses OLD=NEW, paths starting with OLD get NEW instead of it. The
+    // first matching rule applies.
+    bool AddPrefixMap(std::string_view rule);
+
+    // Returns `path` with its prefix substituted, the result may point into `buf`.
+    std::string_view Map(std::string_view path, std::string* buf) const;
+    // A path is kept if it matches one of the include patterns, or if there
+    // are none, and none of the exclude patterns.
+    bool Accepts(std::string_view path) const;
+
+private:
+    std::vector<std::string> includes_;
+    std::vector<std::string> excludes_;
+    std::vector<std::pair<std::string, std::string>> prefixes_;
+};
@@ -0,0 +1,133 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "scanner.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SCANNER_NEON 1
+#endif
+
+static inline bool IsStructural(char ch)
+{
+    return ch == '\n' || ch == ':' || ch == ',';
+}
+
+uint64_t ScanStructuralBlockScalar(const char* p)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < kScanBlockSize; i++)
+        mask |= static_cast<uint64_t>(IsStructural(p[i])) << i;
+    return mask;
+}
+
+#ifdef SCANNER_X86
+static inline uint32_t ScanSSE2x16(const char* p)
+{
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                          _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    return static_cast<uint32_t>(_mm_movemask_epi8(m)) & 0xffff;
+}
+
+static uint64_t ScanBlockSSE2(const char* p)
+{
+    return static_cast<uint64_t>(ScanSSE2x16(p)) |
+           static_cast<uint64_t>(ScanSSE2x16(p + 16)) << 16 |
+           static_cast<uint64_t>(ScanSSE2x16(p + 32)) << 32 |
+           static_cast<uint64_t>(ScanSSE2x16(p + 48)) << 48;
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t ScanAVX2x32(const char* p)
+{
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(m));
+}
+
+__attribute__((target("avx2")))
+static uint64_t ScanBlockAVX2(const char* p)
+{
+    return static_cast<uint64_t>(ScanAVX2x32(p)) | static_cast<uint64_t>(ScanAVX2x32(p + 32)) << 32;
+}
+#endif // SCANNER_X86
+
+#ifdef SCANNER_NEON
+static inline uint8x16_t ScanNEONx16(const char* p)
+{
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    return vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')),
+                    vorrq_u8(vceqq_u8(v, vdupq_n_u8(':')), vceqq_u8(v, vdupq_n_u8(','))));
+}
+
+static uint64_t ScanBlockNEON(const char* p)
+{
+    // NEON has no movemask, weight each byte by its bit and add the lanes up.
+    static const uint8_t kWeights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t weights = vld1q_u8(kWeights);
+    uint8x16_t t0 = vandq_u8(ScanNEONx16(p), weights);
+    uint8x16_t t1 = vandq_u8(ScanNEONx16(p + 16), weights);
+    uint8x16_t t2 = vandq_u8(ScanNEONx16(p + 32), weights);
+    uint8x16_t t3 = vandq_u8(ScanNEONx16(p + 48), weights);
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(t0, t1), vpaddq_u8(t2, t3));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+#endif // SCANNER_NEON
+
+struct ScannerImpl {
+    ScanBlockFn fn;
+    const char* name;
+};
+
+static ScannerImpl SelectScanner()
+{
+#if defined(SCANNER_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return { ScanBlockAVX2, "avx2" };
+    return { ScanBlockSSE2, "sse2" }; // always available on x86-64
+#elif defined(SCANNER_NEON)
+    return { ScanBlockNEON, "neon" };
+#else
+    return { ScanStructuralBlockScalar, "scalar" };
+#endif
+}
+
+static const ScannerImpl kScanner = SelectScanner();
+const ScanBlockFn ScanStructuralBlock = kScanner.fn;
+
+const char* GetScannerName()
+{
+    return kScanner.name;
+}
+
+uint64_t ScanStructuralTail(const char* p, size_t len)
+{
+    if (len >= kScanBlockSize)
+        return ScanStructuralBlock(p);
+    // Never read past the end of the buffer, it may be the end of a mapping.
+    char block[kScanBlockSize] = {};
+    (void)memcpy(block, p, len);
+    return ScanStructuralBlock(block) & ((UINT64_C(1) << len) - 1);
+}
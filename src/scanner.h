@@ -0,0 +1,39 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Structural characters of lcov records: line terminators, the colon ending
+// the record type and the commas separating arguments.
+enum { kScanBlockSize = 64 };
+
+using ScanBlockFn = uint64_t (*)(const char* p);
+// Classifies a whole block, implemented with SSE2, AVX2 or NEON when the
+// running CPU supports it.
+extern const ScanBlockFn ScanStructuralBlock;
+// Portable implementation, also the reference for the vectorized ones.
+uint64_t ScanStructuralBlockScalar(const char* p);
+// Name of the selected implementation.
+const char* GetScannerName();
+
+// Returns a mask where bit i is set if p[i] is '\n', ':' or ',', for every
+// i < min(len, kScanBlockSize).
+uint64_t ScanStructuralTail(const char* p, size_t len);
+
+inline uint64_t ScanStructural(const char* p, size_t len)
+{
+    return len >= kScanBlockSize ? ScanStructuralBlock(p) : ScanStructuralTail(p, len);
+}
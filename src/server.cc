@@ -0,0 +1,241 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "server.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+bool MakeAddress(const char* path, struct sockaddr_un* addr, std::string* err)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        err->assign("socket path is too long");
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+int Connect(const struct sockaddr_un& addr, std::string* err)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        err->assign(strerror(errno));
+        return -1;
+    }
+    int rc;
+    do {
+        rc = connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr));
+    } while (rc == -1 && errno == EINTR);
+    if (rc == -1) {
+        int error = errno;
+        err->assign(strerror(error));
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+bool SendAll(int fd, const std::string& data)
+{
+    for (size_t off = 0; off < data.size(); ) {
+        // A client that went away must not take the server down with SIGPIPE.
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        off += n;
+    }
+    return true;
+}
+
+uint64_t NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Reads up to the next newline, which is consumed but not returned. Returns
+// false at the end of the stream, on errors, or if the line is not complete
+// within `timeout_ms` (-1 waits forever).
+bool ReceiveLine(int fd, std::string* buffer, std::string* line, int timeout_ms = -1)
+{
+    size_t nl;
+    uint64_t deadline = NowMs() + timeout_ms;
+    while ((nl = buffer->find('\n')) == std::string::npos) {
+        if (buffer->size() > CommandServer::kMaxRequestSize)
+            return false;
+        if (timeout_ms >= 0) {
+            uint64_t now = NowMs();
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int rc = now < deadline ? poll(&pfd, 1, static_cast<int>(deadline - now)) : 0;
+            if (rc == -1 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                return false;
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer->append(chunk, n);
+    }
+    line->assign(*buffer, 0, nl);
+    buffer->erase(0, nl + 1);
+    return true;
+}
+
+void SplitWords(const std::string& line, std::vector<std::string>* words)
+{
+    words->clear();
+    size_t begin = 0;
+    for (;;) {
+        size_t tab = line.find('\t', begin);
+        words->push_back(line.substr(begin, tab - begin));
+        if (tab == std::string::npos)
+            break;
+        begin = tab + 1;
+    }
+}
+
+} // namespace
+
+CommandServer::~CommandServer()
+{
+    if (fd_ != -1) {
+        close(fd_);
+        unlink(path_.c_str());
+    }
+}
+
+bool CommandServer::Listen(const char* path, std::string* err)
+{
+    struct sockaddr_un addr;
+    if (!MakeAddress(path, &addr, err))
+        return false;
+
+    int fd = Connect(addr, err);
+    if (fd != -1) {
+        close(fd);
+        err->assign("another server is listening on the socket");
+        return false;
+    }
+    // connect() is refused by any file, only a socket is ours to replace.
+    struct stat st;
+    if (errno == ECONNREFUSED && lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            err->assign("path exists and is not a socket");
+            return false;
+        }
+        (void)unlink(path);
+    }
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ == -1 || bind(fd_, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        listen(fd_, 16) == -1) {
+        err->assign(strerror(errno));
+        if (fd_ != -1)
+            close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    path_ = path;
+    return true;
+}
+
+bool CommandServer::Run(const Handler& handler, std::string* err)
+{
+    for (;;) {
+        int fd = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            err->assign(strerror(errno));
+            return false;
+        }
+        // A client which does not read its replies is dropped as well.
+        struct timeval tv = {idle_timeout_ms_ / 1000, (idle_timeout_ms_ % 1000) * 1000};
+        (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        bool more = ServeClient(fd, handler);
+        close(fd);
+        if (!more)
+            return true;
+    }
+}
+
+bool CommandServer::ServeClient(int fd, const Handler& handler)
+{
+    std::string buffer, line, reply;
+    std::vector<std::string> args;
+
+    while (ReceiveLine(fd, &buffer, &line, idle_timeout_ms_)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty())
+            continue;
+        SplitWords(line, &args);
+        reply.clear();
+        bool more = handler(args, &reply);
+        reply.push_back('\n');
+        if (!SendAll(fd, reply) || !more)
+            return more;
+    }
+    return true;
+}
+
+bool SendCommand(const char* path, const std::vector<std::string>& args, std::string* reply, std::string* err)
+{
+    struct sockaddr_un addr;
+    if (!MakeAddress(path, &addr, err))
+        return false;
+    int fd = Connect(addr, err);
+    if (fd == -1)
+        return false;
+
+    std::string request;
+    for (const auto& arg : args) {
+        if (arg.find_first_of("\t\n") != std::string::npos) {
+            err->assign("arguments must not contain tabs or newlines");
+            close(fd);
+            return false;
+        }
+        if (!request.empty())
+            request.push_back('\t');
+        request += arg;
+    }
+    request.push_back('\n');
+
+    std::string buffer;
+    bool ok = SendAll(fd, request) && ReceiveLine(fd, &buffer, reply);
+    if (!ok)
+        err->assign("the server closed the connection");
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,59 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Line-oriented request/reply protocol over a Unix domain socket. A request is
+// a line of tab-separated words, the first of which names the command, and it
+// is answered by a single line starting with "OK" or "ERROR". A connection may
+// carry any number of requests.
+struct CommandServer {
+
+    enum { kMaxRequestSize = 1 << 20 };
+    // Clients are served one at a time, one which sends no complete request
+    // for this long is disconnected so that it cannot stall the others.
+    enum { kIdleTimeoutMs = 30000 };
+
+    // Fills `reply` (without the newline) and returns false to stop serving
+    // once the reply has been sent.
+    using Handler = std::function<bool(const std::vector<std::string>& args, std::string* reply)>;
+
+    CommandServer() = default;
+    CommandServer(const CommandServer&) = delete;
+    CommandServer& operator=(const CommandServer&) = delete;
+    // Closes the socket and removes it from the filesystem.
+    ~CommandServer();
+
+    // Bind to `path`. A socket left behind by a server which is gone is
+    // replaced, one which still accepts connections or a file which is not
+    // a socket is an error.
+    bool Listen(const char* path, std::string* err);
+    // Serve the clients one after another until the handler asks to stop.
+    bool Run(const Handler& handler, std::string* err);
+    void SetIdleTimeout(int timeout_ms) { idle_timeout_ms_ = timeout_ms; }
+
+private:
+    // Returns false if the handler asked to stop.
+    bool ServeClient(int fd, const Handler& handler);
+
+    int fd_ = -1;
+    int idle_timeout_ms_ = kIdleTimeoutMs;
+    std::string path_;
+};
+
+// Send a request to the server listening on `path` and wait for its reply.
+bool SendCommand(const char* path, const std::vector<std::string>& args, std::string* reply, std::string* err);
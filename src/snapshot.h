@@ -0,0 +1,112 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "output.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "snapshots are stored in little-endian byte order"
+#endif
+
+// Binary snapshots of the merged coverage state. A snapshot begins with
+// kSnapshotMagic and the format version, followed by fixed-width integers
+// and arrays of them prefixed with their number of elements, so loading one
+// is a matter of copying the arrays.
+static constexpr char kSnapshotMagic[8] = { 'L', 'C', 'O', 'V', 'S', 'N', 'A', 'P' };
+enum { kSnapshotVersion = 1 };
+
+struct SnapshotWriter {
+
+    SnapshotWriter(OutputSink* out) : out_(out) {}
+
+    void WriteHeader() {
+        out_->Write(kSnapshotMagic, sizeof(kSnapshotMagic));
+        WriteU32(kSnapshotVersion);
+    }
+    void WriteU32(uint32_t value) { out_->Write(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void WriteString(std::string_view str) {
+        WriteU32(str.size());
+        out_->Write(str);
+    }
+    template<typename Tvec>
+    void WriteArray(const Tvec& vec) {
+        WriteU32(vec.size());
+        if (!vec.empty())
+            out_->Write(reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(vec[0]));
+    }
+
+private:
+    OutputSink* out_;
+};
+
+// Reads a snapshot from memory, every read fails once the data is exhausted.
+struct SnapshotReader {
+
+    SnapshotReader(std::string_view data) : data_(data) {}
+
+    static bool IsSnapshot(std::string_view data) {
+        return data.size() >= sizeof(kSnapshotMagic) && !memcmp(data.data(), kSnapshotMagic, sizeof(kSnapshotMagic));
+    }
+    // Returns false if the data is not a snapshot of the current version.
+    bool ReadHeader() {
+        uint32_t version;
+        const char* p;
+        return Take(sizeof(kSnapshotMagic), &p) && !memcmp(p, kSnapshotMagic, sizeof(kSnapshotMagic)) &&
+               ReadU32(&version) && version == kSnapshotVersion;
+    }
+    bool ReadU32(uint32_t* value) {
+        const char* p;
+        if (!Take(sizeof(*value), &p))
+            return false;
+        (void)memcpy(value, p, sizeof(*value));
+        return true;
+    }
+    // The string points into the snapshot.
+    bool ReadString(std::string_view* str) {
+        uint32_t len;
+        const char* p;
+        if (!ReadU32(&len) || !Take(len, &p))
+            return false;
+        *str = std::string_view(p, len);
+        return true;
+    }
+    template<typename Tvec>
+    bool ReadArray(Tvec* vec) {
+        uint32_t n;
+        const char* p;
+        if (!ReadU32(&n) || !Take(static_cast<size_t>(n) * sizeof((*vec)[0]), &p))
+            return false;
+        vec->resize(n);
+        if (n)
+            (void)memcpy(vec->data(), p, static_cast<size_t>(n) * sizeof((*vec)[0]));
+        return true;
+    }
+    bool AtEnd() const { return data_.empty(); }
+
+private:
+    bool Take(size_t n, const char** p) {
+        if (n > data_.size())
+            return false;
+        *p = data_.data();
+        data_.remove_prefix(n);
+        return true;
+    }
+
+    std::string_view data_;
+};
@@ -0,0 +1,43 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "stats.h"
+
+#include <sys/resource.h>
+#include <time.h>
+
+static uint64_t ReadClock(clockid_t clock)
+{
+    struct timespec ts;
+    if (clock_gettime(clock, &ts))
+        return 0;
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t Stats::GetWallTime()
+{
+    return ReadClock(CLOCK_MONOTONIC);
+}
+
+uint64_t Stats::GetCpuTime()
+{
+    return ReadClock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+uint64_t Stats::GetPeakRss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+}
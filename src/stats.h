@@ -0,0 +1,100 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Process-wide counters reported by --stats. They are only added to once per
+// file, and the clocks are only read while collection is enabled, so the
+// counters cost next to nothing otherwise.
+struct Stats {
+
+    enum Counter {
+        TRACEFILE_FILES, TRACEFILE_BYTES,
+        SOURCE_FILES, SOURCE_BYTES,
+        SOURCE_LOAD_NS,  // time spent mapping sources and indexing their lines
+        CHECKSUM_NS,     // time spent hashing source lines
+        OUTPUT_BYTES,
+        kNumCounters
+    };
+
+    // Must be called before any worker thread starts.
+    static void Enable() { enabled_ = true; }
+    static bool IsEnabled() { return enabled_; }
+
+    static void Add(Counter c, uint64_t n) { counters_[c].fetch_add(n, std::memory_order_relaxed); }
+    static uint64_t Get(Counter c) { return counters_[c].load(std::memory_order_relaxed); }
+
+    static uint64_t GetWallTime(); // nanoseconds of a monotonic clock
+    static uint64_t GetCpuTime();  // nanoseconds of CPU time used by all threads of the process
+    static uint64_t GetPeakRss();  // bytes
+
+private:
+    static inline bool enabled_ = false;
+    static inline std::atomic<uint64_t> counters_[kNumCounters];
+};
+
+// Adds the time the scope takes to a counter if collection is enabled.
+struct ScopedStatsTimer {
+    ScopedStatsTimer(Stats::Counter c) : counter_(c), start_(Stats::IsEnabled() ? Stats::GetWallTime() : 0) {}
+    ~ScopedStatsTimer() {
+        if (start_)
+            Stats::Add(counter_, Stats::GetWallTime() - start_);
+    }
+
+private:
+    Stats::Counter counter_;
+    uint64_t start_;
+};
+
+// Wall and CPU time of a phase of the program, accumulated over Start()/Stop()
+// pairs while collection is enabled.
+struct PhaseTimer {
+    void Start() {
+        if (!Stats::IsEnabled())
+            return;
+        wall_start_ = Stats::GetWallTime();
+        cpu_start_ = Stats::GetCpuTime();
+    }
+    void Stop() {
+        if (!Stats::IsEnabled())
+            return;
+        wall_ns_ += Stats::GetWallTime() - wall_start_;
+        cpu_ns_ += Stats::GetCpuTime() - cpu_start_;
+    }
+
+    uint64_t wall_ns_ = 0;
+    uint64_t cpu_ns_ = 0;
+
+private:
+    uint64_t wall_start_ = 0;
+    uint64_t cpu_start_ = 0;
+};
+
+// Sizes of a family of hash tables, e.g. the function tables of all source files.
+struct HashTableStats {
+    template<typename Map>
+    void Add(const Map& map) {
+        tables_++;
+        size_ += map.size();
+        buckets_ += map.bucket_count();
+    }
+    double GetLoadFactor() const { return buckets_ ? static_cast<double>(size_) / buckets_ : 0.0; }
+
+    uint64_t tables_ = 0;
+    uint64_t size_ = 0;
+    uint64_t buckets_ = 0;
+};
@@ -0,0 +1,81 @@
+// Copyright 2024 Weihao Feng. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// 64-bit FNV-1a hash, stable across runs and hosts.
+inline uint64_t Fnv1a64(std::string_view str)
+{
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+    for (unsigned char ch : str) {
+        h ^= ch;
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+// Converts 8 ASCII digits loaded as a little-endian word, see IsEightDigits().
+inline uint32_t ParseEightDigits(uint64_t v)
+{
+    v -= UINT64_C(0x3030303030303030);
+    v = (v * 10) + (v >> 8); // pairs of digits
+    v = (((v & UINT64_C(0x000000FF000000FF)) * (100 + (UINT64_C(1000000) << 32))) +
+         (((v >> 16) & UINT64_C(0x000000FF000000FF)) * (1 + (UINT64_C(10000) << 32)))) >> 32;
+    return static_cast<uint32_t>(v);
+}
+
+inline bool IsEightDigits(uint64_t v)
+{
+    return !(((v & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+              (((v + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) ^
+             UINT64_C(0x3333333333333333));
+}
+
+// Parses a decimal number which must consist of digits only and fit into 32
+// bits. Only the bytes of `str` are read, it doesn't have to be NUL terminated.
+inline bool ParseUnsigned32(std::string_view str, uint32_t* value)
+{
+    const char* p = str.data();
+    size_t len = str.size();
+    uint64_t res = 0;
+
+    if (len == 0 || len > 10)
+        return false;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Large execution counts take the 8-digits-at-a-time path.
+    if (len >= 8) {
+        uint64_t word;
+        (void)memcpy(&word, p, sizeof(word));
+        if (!IsEightDigits(word))
+            return false;
+        res = ParseEightDigits(word);
+        p += 8;
+        len -= 8;
+    }
+#endif
+    for (; len; len--, p++) {
+        unsigned digit = static_cast<unsigned char>(*p) - '0';
+        if (digit > 9)
+            return false;
+        res = res * 10 + digit;
+    }
+    if (res > UINT32_MAX)
+        return false;
+    *value = static_cast<uint32_t>(res);
+    return true;
+}
@@ -35,12 +35,25 @@ EmuFilesystem::Status EmuFilesystem::ReadFile(const char* path, std::string* con
     return NOT_FOUND;
 }
 
+EmuFilesystem::Status EmuFilesystem::GetModificationTime(const char* path, int64_t* mtime, std::string* err)
+{
+    auto it = files_.find(path);
+    err->clear();
+    if (it == files_.cend()) {
+        err->assign(strerror(ENOENT));
+        return NOT_FOUND;
+    }
+    *mtime = it->second.version_;
+    return SUCCESS;
+}
+
 void EmuFilesystem::PushFile(const std::string& path, const std::string& content)
 {
     auto it = files_.find(path);
     if (it != files_.cend()) {
         it->second.content_.assign(content);
         it->second.errno_ = 0;
+        it->second.version_++;
     } else {
         files_.emplace(path, FileEntry{content});
         it = files_.end();
@@ -20,6 +20,8 @@
 struct EmuFilesystem : public IFilesystem {
 
     Status ReadFile(const char* path, std::string* content, std::string* err) override;
+    // Counts the times a file has been pushed.
+    Status GetModificationTime(const char* path, int64_t* mtime, std::string* err) override;
 
     void PushFile(const std::string& path, const std::string& content);
     void SetIOError(int errno);
@@ -29,6 +31,7 @@ private:
         FileEntry(const std::string& content) : content_(content), errno_(0) {}
         std::string content_;
         int errno_;
+        int64_t version_ = 1;
     };
 
     FileEntry* current_file_ = nullptr;
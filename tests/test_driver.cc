@@ -13,16 +13,30 @@
 // limitations under the License.
 
 #include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
 #include <string>
+#include <thread>
 
 #include "efs.h"
-#define LCOVMERGE_DEFINITION_ONLY
-#include "../src/lcovmerge.cc"
+#include "../src/base64.h"
+#include "../src/compress.h"
+#include "../src/diff.h"
+#include "../src/lcovmerge.h"
+#include "../src/liblcovmerge.h"
+#include "../src/parallel.h"
+#include "../src/scanner.h"
+#include "../src/server.h"
 
 static void SetupAndVerifyFile(EmuFilesystem* efs, const char* testname,
                                const std::string& fname, const char** linedata, size_t lines)
 {
-    SourceFileInfo sf(fname);
+    Arena arena;
+    SourceFileInfo sf(&arena, fname);
     std::string err;
     std::string content;
 
@@ -37,7 +51,7 @@ static void SetupAndVerifyFile(EmuFilesystem* efs, const char* testname,
     EXPECT_FALSE(sf.IsLineNumberInRange(lines + 1));
     EXPECT_FALSE(sf.IsLineNumberInRange(0));
 
-    for (int i = 1; i <= lines; i++) {
+    for (size_t i = 1; i <= lines; i++) {
         auto line = sf.ReadLineData(i, false);
         EXPECT_EQ(line.compare(linedata[i - 1]), 0) << testname << ": line " << i << " mismatch";
     }
@@ -73,3 +87,1213 @@ TEST(LineMapTest, SingleLineFile)
     };
     SetupAndVerifyFile(&efs, "SingleLineFile", "/test2.c", lines, 1);
 }
+
+TEST(MergeTest, SourceFileCounters)
+{
+    Arena arena;
+    SourceFileInfo a(&arena, "/merge.c"), b(&arena, "/merge.c");
+    std::string err;
+
+    a.GetLineCoverage()->AddCount(a.GetLineCoverage()->Define(3), 2);
+    b.GetLineCoverage()->AddCount(b.GetLineCoverage()->Define(3), 5);
+    b.GetLineCoverage()->Define(7);
+    a.AddBranchCoverage(3, 0, 1, 4);
+    b.AddBranchCoverage(3, 0, 1, BranchCoverageTable::NEVER_EXECUTED);
+    b.AddBranchCoverage(3, 1, 0, 1);
+
+    EXPECT_TRUE(a.Merge(b, &err)) << err;
+    uint32_t xcount;
+    EXPECT_TRUE(a.GetLineCoverage()->Lookup(3, &xcount));
+    EXPECT_EQ(xcount, 7u);
+    EXPECT_TRUE(a.GetLineCoverage()->Lookup(7, &xcount));
+    EXPECT_EQ(xcount, 0u);
+    EXPECT_TRUE(a.LookupBranchCoverage(3, 0, 1, &xcount));
+    EXPECT_EQ(xcount, 4u);
+    EXPECT_TRUE(a.LookupBranchCoverage(3, 1, 0, &xcount));
+    EXPECT_EQ(xcount, 1u);
+    EXPECT_FALSE(a.LookupBranchCoverage(3, 0, 0, &xcount));
+}
+
+TEST(LineMapTest, SharedSourceContent)
+{
+    EmuFilesystem efs;
+    std::string err;
+    efs.PushFile("/shared.c", "int a;\nint b;\n");
+
+    Arena arena;
+    SourceFileInfo a(&arena, "/shared.c"), b(&arena, "/shared.c");
+    EXPECT_TRUE(a.LoadLineMap(&efs, &err)) << err;
+    EXPECT_TRUE(b.LoadLineMap(&efs, &err)) << err;
+    EXPECT_EQ(a.ReadLineData(2, false).data(), b.ReadLineData(2, false).data());
+    EXPECT_EQ(a.GetLineChecksum(1), b.GetLineChecksum(1));
+
+    SourceFileInfo missing(&arena, "/missing.c");
+    EXPECT_FALSE(missing.LoadLineMap(&efs, &err));
+    EXPECT_FALSE(err.empty());
+    EXPECT_FALSE(missing.IsLineDataAvailable());
+}
+
+TEST(LineReaderTest, LinesStraddlingChunks)
+{
+    EmuFilesystem efs;
+    std::unique_ptr<IFilesystem::InputStream> stream;
+    std::string err;
+    const char* lines[] = { "TN:test", "SF:/a/very/long/path/to/a/source/file.c", "", "DA:1,2", "end_of_record" };
+
+    efs.PushFile("/stream.info", "TN:test\nSF:/a/very/long/path/to/a/source/file.c\r\n\nDA:1,2\nend_of_record");
+    ASSERT_EQ(efs.OpenFile("/stream.info", &stream, &err), IFilesystem::SUCCESS);
+
+    LineReader reader(stream.get(), 8);
+    std::string_view line;
+    LineFields fields;
+    for (const char* expected : lines) {
+        ASSERT_EQ(reader.NextLine(&line, &fields, &err), 1) << err;
+        EXPECT_EQ(line, expected);
+    }
+    EXPECT_EQ(fields.colon_, -1);
+    EXPECT_EQ(reader.NextLine(&line, &fields, &err), 0);
+}
+
+TEST(ScannerTest, MatchesScalarScanner)
+{
+    std::mt19937 rng(42);
+    const char alphabet[] = "DA:12,\n\rSF/x";
+    char block[kScanBlockSize];
+
+    for (int round = 0; round < 1000; round++) {
+        for (auto& ch : block)
+            ch = alphabet[rng() % (sizeof(alphabet) - 1)];
+        EXPECT_EQ(ScanStructuralBlock(block), ScanStructuralBlockScalar(block)) << GetScannerName();
+        size_t len = rng() % kScanBlockSize;
+        EXPECT_EQ(ScanStructuralTail(block, len),
+                  ScanStructuralBlockScalar(block) & ((UINT64_C(1) << len) - 1));
+    }
+}
+
+TEST(LineReaderTest, FieldOffsets)
+{
+    std::string content = "BRDA:10,0,1,-\n" + std::string(100, '#') + "\nFN:3,a.c:main\n";
+    LineReader reader(content);
+    std::string_view line;
+    LineFields fields;
+    std::string err;
+
+    ASSERT_EQ(reader.NextLine(&line, &fields, &err), 1);
+    EXPECT_EQ(fields.colon_, 4);
+    ASSERT_EQ(fields.ncommas_, 3u);
+    EXPECT_EQ(fields.commas_[0], 7u);
+    EXPECT_EQ(fields.commas_[2], 11u);
+    ASSERT_EQ(reader.NextLine(&line, &fields, &err), 1);
+    EXPECT_EQ(line.size(), 100u);
+    ASSERT_EQ(reader.NextLine(&line, &fields, &err), 1);
+    EXPECT_EQ(line, "FN:3,a.c:main");
+    EXPECT_EQ(fields.colon_, 2);
+    EXPECT_EQ(fields.ncommas_, 1u);
+
+    LineParser lp(line, fields);
+    LcovRecordArgList args;
+    EXPECT_EQ(lp.ParseRecordType(), LcovRecordType::FN);
+    EXPECT_TRUE(lp.ParseRecordArguments(&args, &err));
+    ASSERT_EQ(args.size(), 2u);
+    EXPECT_EQ(args[1], "a.c:main");
+    EXPECT_EQ(reader.NextLine(&line, &fields, &err), 0);
+}
+
+TEST(StrUtilTest, ParseUnsigned32)
+{
+    const char* valid[] = { "0", "7", "20000", "12345678", "123456789", "0000000001", "4294967295" };
+    const char* invalid[] = { "", "-1", "+1", " 1", "1a", "1234567a", "4294967296", "9999999999", "12345678901" };
+    uint32_t v;
+
+    for (const char* str : valid) {
+        EXPECT_TRUE(ParseUnsigned32(str, &v)) << str;
+        EXPECT_EQ(v, strtoul(str, nullptr, 10)) << str;
+    }
+    for (const char* str : invalid)
+        EXPECT_FALSE(ParseUnsigned32(str, &v)) << str;
+    // Only the bytes of the view are considered.
+    EXPECT_TRUE(ParseUnsigned32(std::string_view("1234,5", 4), &v));
+    EXPECT_EQ(v, 1234u);
+}
+
+TEST(ParserTest, LazySourceLoading)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/lazy.info", "SF:/nosource.c\nDA:1,1\nDA:2,0\nend_of_record\n");
+
+    LcovParser::Config config;
+    LcovParser eager(config);
+    EXPECT_FALSE(eager.Parse(&efs, "/lazy.info"));
+
+    config.lazy_source_ = true;
+    LcovParser lazy(config);
+    EXPECT_TRUE(lazy.Parse(&efs, "/lazy.info"));
+
+    // A checksum still requires the source.
+    efs.PushFile("/lazy2.info", "SF:/nosource.c\nDA:1,1,AAAAAAAAAAAAAAAAAAAAAA==\nend_of_record\n");
+    LcovParser lazy2(config);
+    EXPECT_FALSE(lazy2.Parse(&efs, "/lazy2.info"));
+}
+
+TEST(MD5Test, HashManyMatchesMD5Hash)
+{
+    std::mt19937 rng(7);
+    std::vector<std::string> msgs;
+    for (size_t len = 0; len < 300; len++) {
+        std::string msg(len, '\0');
+        for (auto& ch : msg)
+            ch = static_cast<char>(rng());
+        msgs.push_back(msg);
+    }
+    std::shuffle(msgs.begin(), msgs.end(), rng);
+    std::vector<std::string_view> views(msgs.begin(), msgs.end());
+    std::vector<uint8_t> digests(views.size() * MD5Hash::Length);
+
+    MD5Hash::HashMany(views.data(), views.size(), reinterpret_cast<uint8_t (*)[MD5Hash::Length]>(digests.data()));
+    for (size_t i = 0; i < views.size(); i++) {
+        uint8_t expected[MD5Hash::Length];
+        MD5Hash md5hash;
+        md5hash.Update(views[i].data(), views[i].size());
+        md5hash.Finalize(expected);
+        EXPECT_EQ(memcmp(expected, &digests[i * MD5Hash::Length], MD5Hash::Length), 0)
+            << MD5Hash::GetHashManyName() << ": length " << views[i].size();
+    }
+}
+
+TEST(MD5Test, Base64RoundTrip)
+{
+    const char* line = "int main() { return 0; }\n";
+    uint8_t digest[MD5Hash::Length], decoded[MD5Hash::Length];
+    char encoded[MD5Hash::Base64PaddedLength + 1];
+    MD5Hash md5hash;
+
+    md5hash.Update(line, strlen(line));
+    md5hash.Finalize(digest);
+    MD5Hash::ToBase64(digest, encoded);
+    EXPECT_EQ(strlen(encoded), size_t(MD5Hash::Base64PaddedLength));
+    EXPECT_EQ(encoded[22], '=');
+
+    EXPECT_TRUE(MD5Hash::Base64ToMD5(encoded, decoded, strlen(encoded)));
+    EXPECT_TRUE(MD5Hash::Equals(digest, decoded));
+    EXPECT_FALSE(MD5Hash::Base64ToMD5(encoded, decoded, 22));
+    encoded[5] = '!';
+    EXPECT_FALSE(MD5Hash::Base64ToMD5(encoded, decoded, strlen(encoded)));
+
+    uint8_t buf[8];
+    size_t len = sizeof(buf);
+    EXPECT_TRUE(Base64Decode("aGk=", 4, buf, &len));
+    EXPECT_EQ(len, 2u);
+    EXPECT_EQ(memcmp(buf, "hi", 2), 0);
+    len = sizeof(buf);
+    EXPECT_FALSE(Base64Decode("a=Gk", 4, buf, &len));
+}
+
+TEST(OutputSinkTest, BufferedWrites)
+{
+    MemoryOutputSink out;
+    std::string expected, large(OutputSink::kBufferSize + 7, 'x');
+    const uint64_t numbers[] = { 0, 9, 10, 99, 100, 12345, 4294967295u, UINT64_MAX };
+
+    for (uint64_t n : numbers) {
+        out.WriteUnsigned(n);
+        out.Put(',');
+        expected += std::to_string(n) + ",";
+    }
+    // Writes larger than the buffer go straight to the backend.
+    out.Write(large);
+    out.Write("end\n");
+    expected += large + "end\n";
+    EXPECT_EQ(out.GetBytesWritten(), expected.size());
+    EXPECT_EQ(out.GetContent(), expected);
+    EXPECT_FALSE(out.HasFailed());
+}
+
+TEST(MergeTest, BranchTableOrder)
+{
+    Arena arena;
+    BranchCoverageTable table(arena.GetResource());
+    // Rows and slots arriving out of order are inserted in between.
+    const uint32_t records[][4] = {
+        { 5, 0, 1, 3 }, { 9, 2, 0, 1 }, { 2, 0, 0, 7 }, { 5, 0, 0, BranchCoverageTable::NEVER_EXECUTED },
+        { 5, 1, 70, 2 }, { 5, 0, 3, 1 }, { 5, 0, 1, 4 }, { 2, 0, 0, BranchCoverageTable::NEVER_EXECUTED },
+    };
+    const uint32_t expected[][4] = {
+        { 2, 0, 0, 7 }, { 5, 0, 0, BranchCoverageTable::NEVER_EXECUTED }, { 5, 0, 1, 7 }, { 5, 0, 3, 1 },
+        { 5, 1, 70, 2 }, { 9, 2, 0, 1 },
+    };
+    std::vector<std::vector<uint32_t>> res;
+
+    for (const auto& r : records)
+        table.Add(r[0], r[1], r[2], r[3]);
+    table.ForEach([&](uint32_t lineno, uint32_t blkno, uint32_t brno, uint32_t xcount) {
+        res.push_back({ lineno, blkno, brno, xcount });
+    });
+    ASSERT_EQ(res.size(), sizeof(expected) / sizeof(*expected));
+    for (size_t i = 0; i < res.size(); i++)
+        EXPECT_EQ(res[i], std::vector<uint32_t>(expected[i], expected[i] + 4)) << i;
+}
+
+TEST(MergeTest, LineTableLayouts)
+{
+    Arena arena;
+    LineCoverageTable table(arena.GetResource());
+    uint8_t checksum[MD5Hash::Length] = { 1, 2, 3 };
+    uint32_t xcount;
+
+    // A single line far into the file stays sparse.
+    table.AddCount(table.Define(200000), 3);
+    EXPECT_FALSE(table.IsDense());
+    // Lines filling the beginning of the file switch to the dense layout.
+    for (uint32_t l = 200; l >= 1; l--)
+        table.AddCount(table.Define(l), l);
+    EXPECT_FALSE(table.IsDense());
+    table.Define(100000);
+    table.SetChecksum(table.Define(7), checksum);
+    EXPECT_FALSE(table.IsDense());
+
+    LineCoverageTable dense(arena.GetResource());
+    for (uint32_t l = 1; l <= 100; l++)
+        dense.AddCount(dense.Define(l), 1);
+    EXPECT_TRUE(dense.IsDense());
+    dense.SetChecksum(dense.Define(7), checksum);
+    // ...and back once it would mostly be empty.
+    dense.AddCount(dense.Define(200000), 3);
+    EXPECT_FALSE(dense.IsDense());
+
+    for (LineCoverageTable* t : { &table, &dense }) {
+        EXPECT_TRUE(t->Lookup(200000, &xcount));
+        EXPECT_EQ(xcount, 3u);
+        EXPECT_TRUE(t->Lookup(7, &xcount));
+        EXPECT_FALSE(t->Lookup(300, &xcount));
+        EXPECT_TRUE(MD5Hash::Equals(t->GetChecksum(t->Define(7)), checksum));
+        EXPECT_EQ(t->GetChecksum(t->Define(8)), nullptr);
+
+        uint32_t prev = 0, n = 0;
+        t->ForEach([&](uint32_t lineno, uint32_t, const uint8_t*) {
+            EXPECT_GT(lineno, prev);
+            prev = lineno;
+            n++;
+        });
+        EXPECT_EQ(n, t->GetLineCount());
+    }
+    EXPECT_EQ(table.GetLineCount(), 202u);
+    EXPECT_EQ(dense.GetLineCount(), 101u);
+}
+
+TEST(ParserTest, SortedParallelExport)
+{
+    EmuFilesystem efs;
+    std::string info[2];
+    for (int i = 0; i < 500; i++) {
+        std::string sf = "SF:/src/file" + std::to_string((i * 7919) % 500) + ".c\n";
+        info[i % 2] += sf + "FN:3,b\nFN:3,a\nFN:1,z\nFNDA:1,a\nDA:1,1\nBRDA:1,0,0,-\nend_of_record\n";
+    }
+    efs.PushFile("/a.info", "TN:second\n" + info[0] + "TN:first\n" + info[1]);
+    efs.PushFile("/b.info", "TN:first\n" + info[0] + "TN:second\n" + info[1]);
+
+    LcovParser::Config config;
+    config.discard_checksum_ = true;
+    config.sorted_output_ = true;
+    std::string outputs[2];
+    const char* inputs[2][2] = { { "/a.info", "/b.info" }, { "/b.info", "/a.info" } };
+    for (int i = 0; i < 2; i++) {
+        LcovParser parser(config);
+        MemoryOutputSink out;
+        EXPECT_TRUE(parser.Parse(&efs, inputs[i][0]));
+        EXPECT_TRUE(parser.Parse(&efs, inputs[i][1]));
+        EXPECT_TRUE(parser.Export(&out, i == 0 ? 1 : 4));
+        outputs[i] = out.GetContent();
+    }
+    EXPECT_EQ(outputs[0], outputs[1]);
+    EXPECT_EQ(outputs[0].compare(0, 41, "TN:first\nSF:/src/file0.c\nFN:1,z\nFN:3,a\nFN"), 0) << outputs[0].substr(0, 64);
+    EXPECT_NE(outputs[0].find("end_of_record\nTN:second\nSF:/src/file0.c\n"), std::string::npos);
+}
+
+TEST(ParserTest, TrustedBase)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/base.info", "SF:/gone.c\nDA:1,1,AAAAAAAAAAAAAAAAAAAAAA==\nDA:2,0\nend_of_record\n");
+    efs.PushFile("/delta.info", "SF:/gone.c\nDA:2,3\nend_of_record\n");
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    LcovParser delta(config);
+    EXPECT_TRUE(delta.Parse(&efs, "/delta.info"));
+
+    // The checksums of the base are kept without reading the source.
+    config.lazy_source_ = false;
+    config.trusted_ = true;
+    LcovParser base(config);
+    std::string err;
+    EXPECT_TRUE(base.Parse(&efs, "/base.info"));
+    EXPECT_TRUE(base.Merge(&delta, &err)) << err;
+
+    MemoryOutputSink out;
+    EXPECT_TRUE(base.Export(&out, 1));
+    EXPECT_NE(out.GetContent().find("DA:1,1,AAAAAAAAAAAAAAAAAAAAAA==\nDA:2,3\n"), std::string::npos) << out.GetContent();
+}
+
+TEST(ParserTest, SnapshotRoundTrip)
+{
+    EmuFilesystem efs;
+    std::string info = "TN:t\nSF:/gone.c\nFN:2,f\nFNDA:3,f\nDA:1,1,AAAAAAAAAAAAAAAAAAAAAA==\nDA:900,2\n"
+                       "BRDA:1,0,1,-\nBRDA:1,0,0,4\nend_of_record\n";
+    for (uint32_t l = 1; l <= 100; l++)
+        info += "SF:/dense.c\nDA:" + std::to_string(l) + ",1\nend_of_record\n";
+    efs.PushFile("/a.info", info);
+
+    LcovParser::Config config;
+    config.trusted_ = true;
+    config.sorted_output_ = true;
+    LcovParser text(config);
+    MemoryOutputSink snapshot, expected;
+    EXPECT_TRUE(text.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(text.ExportSnapshot(&snapshot));
+    EXPECT_TRUE(text.Export(&expected, 1));
+    efs.PushFile("/a.snap", snapshot.GetContent());
+
+    LcovParser loaded(config);
+    MemoryOutputSink actual;
+    EXPECT_TRUE(loaded.Parse(&efs, "/a.snap"));
+    EXPECT_TRUE(loaded.Export(&actual, 1));
+    EXPECT_EQ(actual.GetContent(), expected.GetContent());
+
+    // Truncated snapshots are rejected.
+    efs.PushFile("/b.snap", snapshot.GetContent().substr(0, snapshot.GetContent().size() - 1));
+    LcovParser truncated(config);
+    EXPECT_FALSE(truncated.Parse(&efs, "/b.snap"));
+
+    // So are branch bitmaps with bits past the last slot.
+    efs.PushFile("/c.info", "SF:/gone.c\nBRDA:1,0,0,4\nend_of_record\n");
+    LcovParser branch(config);
+    MemoryOutputSink branch_snapshot;
+    EXPECT_TRUE(branch.Parse(&efs, "/c.info"));
+    EXPECT_TRUE(branch.ExportSnapshot(&branch_snapshot));
+    std::string bitmaps("\1\0\0\0\1\0\0\0\0\0\0\0\1\0\0\0\1\0\0\0\0\0\0\0", 24);
+    std::string corrupt = branch_snapshot.GetContent();
+    size_t pos = corrupt.rfind(bitmaps);
+    ASSERT_NE(pos, std::string::npos);
+    corrupt[pos + 4] = 3;
+    efs.PushFile("/c.snap", corrupt);
+    LcovParser phantom(config);
+    EXPECT_FALSE(phantom.Parse(&efs, "/c.snap"));
+}
+
+TEST(ParserTest, ShardRange)
+{
+    EmuFilesystem efs;
+    std::string info = "TN:t\n";
+    size_t expected = 0;
+    for (int i = 0; i < 64; i++) {
+        std::string path = "/src/f" + std::to_string(i) + ".c";
+        info += "SF:" + path + "\nDA:1,1\nend_of_record\n";
+        expected += GetSourceFileShard(path, 4) == 2;
+    }
+    efs.PushFile("/a.info", info);
+
+    LcovParser::Config config;
+    config.discard_checksum_ = true;
+    LcovParser all(config);
+    EXPECT_TRUE(all.Parse(&efs, "/a.info"));
+    auto parts = all.GetExportItems(4);
+    ASSERT_EQ(parts.size(), 4u);
+    EXPECT_EQ(parts[2].size(), expected);
+
+    config.nshards_ = 4;
+    config.shard_first_ = config.shard_last_ = 2;
+    LcovParser shard(config);
+    EXPECT_TRUE(shard.Parse(&efs, "/a.info"));
+    auto items = shard.GetExportItems()[0];
+    EXPECT_EQ(items.size(), expected);
+    for (const auto& item : items)
+        EXPECT_EQ(GetSourceFileShard(item.sf->GetSourceFilePath(), 4), 2u);
+}
+
+TEST(ParserTest, RecordStats)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/a.info", "TN:t\nSF:/a.c\nFN:1,f\nFNDA:1,f\nDA:1,1\nDA:2,0\nBRDA:1,0,0,1\nend_of_record\n");
+    efs.PushFile("/b.info", "TN:t\nSF:/a.c\nDA:2,1\nend_of_record\nSF:/b.c\nDA:1,1\nend_of_record\n");
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    LcovParser a(config), b(config);
+    std::string err;
+    EXPECT_TRUE(a.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(b.Parse(&efs, "/b.info"));
+    EXPECT_TRUE(a.Merge(&b, &err)) << err;
+
+    const uint64_t* records = a.GetRecordCounts();
+    EXPECT_EQ(records[LcovRecordType::TN], 2u);
+    EXPECT_EQ(records[LcovRecordType::SF], 3u);
+    EXPECT_EQ(records[LcovRecordType::DA], 4u);
+    EXPECT_EQ(records[LcovRecordType::BRDA], 1u);
+    EXPECT_EQ(b.GetRecordCounts()[LcovRecordType::DA], 0u);
+
+    RecordTableStats ts = a.GetTableStats();
+    EXPECT_EQ(ts.tests_.size_, 1u);
+    EXPECT_EQ(ts.source_files_.size_, 2u);
+    EXPECT_EQ(ts.functions_.size_, 1u);
+    EXPECT_EQ(ts.lines_, 3u);
+    EXPECT_EQ(ts.branches_, 1u);
+}
+
+TEST(ParserTest, SourcePrefetch)
+{
+    EmuFilesystem efs;
+    std::string info;
+    for (int i = 0; i < 32; i++) {
+        std::string path = "/src/" + std::to_string(i) + ".c";
+        efs.PushFile(path, "int a;\r\nint b;\r\n");
+        info += "SF:" + path + "\r\nDA:2,1\r\nend_of_record\r\n";
+    }
+    info += "SF:/src/missing.c\nDA:1,1\nend_of_record\n";
+    efs.PushFile("/a.info", info);
+    efs.PushFile("/b.info", info.substr(0, info.find("SF:/src/missing.c")));
+
+    LcovParser::Config config;
+    config.generate_checksum_ = true;
+    config.sorted_output_ = true;
+    LcovParser plain(config);
+    config.prefetch_jobs_ = 4;
+    LcovParser prefetched(config), failing(config);
+    EXPECT_TRUE(plain.Parse(&efs, "/b.info"));
+    EXPECT_TRUE(prefetched.Parse(&efs, "/b.info"));
+    // Sources that fail to load are reported by the parser as usual.
+    EXPECT_FALSE(failing.Parse(&efs, "/a.info"));
+
+    // A single thread only reads sources, the tracefile is scanned on another.
+    config.prefetch_jobs_ = 1;
+    LcovParser single(config);
+    EXPECT_TRUE(single.Parse(&efs, "/b.info"));
+
+    MemoryOutputSink a, b, c;
+    EXPECT_TRUE(plain.Export(&a, 1));
+    EXPECT_TRUE(prefetched.Export(&b, 1));
+    EXPECT_TRUE(single.Export(&c, 1));
+    EXPECT_EQ(a.GetContent(), b.GetContent());
+    EXPECT_EQ(a.GetContent(), c.GetContent());
+}
+
+TEST(CompressTest, GzipRoundTrip)
+{
+    std::string info;
+    for (uint32_t l = 1; l <= 1000; l++)
+        info += "SF:/gone.c\nDA:" + std::to_string(l) + ",1\nend_of_record\n";
+
+    MemoryOutputSink gz;
+    CompressingOutputSink sink(&gz, Compression::GZIP, 0);
+    sink.Write(info);
+    EXPECT_TRUE(sink.Finish());
+    EXPECT_LT(gz.GetContent().size(), info.size() / 10);
+
+    // Two members decode as one stream, read in small pieces.
+    std::string members = gz.GetContent() + gz.GetContent(), decoded;
+    DecompressingInputStream in(members);
+    std::string err;
+    ASSERT_EQ(in.Open(&err), IFilesystem::SUCCESS) << err;
+    EXPECT_EQ(in.GetCompression(), Compression::GZIP);
+    char buf[100];
+    size_t nread;
+    do {
+        ASSERT_EQ(in.Read(buf, sizeof(buf), &nread, &err), IFilesystem::SUCCESS) << err;
+        decoded.append(buf, nread);
+    } while (nread);
+    EXPECT_EQ(decoded, info + info);
+
+    // Compressed tracefiles are detected by the parser, truncated ones fail.
+    EmuFilesystem efs;
+    efs.PushFile("/a.info.gz", gz.GetContent());
+    efs.PushFile("/b.info.gz", gz.GetContent().substr(0, gz.GetContent().size() / 2));
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    LcovParser parser(config);
+    EXPECT_TRUE(parser.Parse(&efs, "/a.info.gz"));
+    EXPECT_FALSE(parser.Parse(&efs, "/b.info.gz"));
+    MemoryOutputSink out;
+    EXPECT_TRUE(parser.Export(&out, 1));
+    EXPECT_NE(out.GetContent().find("DA:1000,1\n"), std::string::npos);
+}
+
+TEST(ParserTest, PathFilter)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/work/src/a.c", "int a;\n");
+    // The dropped blocks are neither handled nor loaded, or their bogus
+    // records and missing sources would fail the parse.
+    efs.PushFile("/a.info", "SF:/ci/src/a.c\nDA:1,1\nend_of_record\n"
+                            "SF:/ci/third_party/x.c\nDA:x,y\nend_of_record\n"
+                            "SF:/ci/src/gen/b.c\nDA:1,1\nend_of_record\n");
+
+    PathFilter filter;
+    EXPECT_FALSE(filter.AddPrefixMap("/ci"));
+    EXPECT_TRUE(filter.AddPrefixMap("/ci/=/work/"));
+    filter.AddInclude("/work/*");
+    filter.AddExclude("*/third_party/*");
+    filter.AddExclude("*/gen/*");
+    LcovParser::Config config;
+    config.generate_checksum_ = true;
+    config.path_filter_ = &filter;
+    LcovParser parser(config);
+    EXPECT_TRUE(parser.Parse(&efs, "/a.info"));
+
+    MemoryOutputSink out;
+    EXPECT_TRUE(parser.Export(&out, 1));
+    EXPECT_EQ(out.GetContent().find("SF:"), out.GetContent().rfind("SF:"));
+    EXPECT_NE(out.GetContent().find("SF:/work/src/a.c\n"), std::string::npos);
+    EXPECT_EQ(parser.GetRecordCounts()[LcovRecordType::DA], 1u);
+}
+
+TEST(ParserTest, SplitParts)
+{
+    std::string info = "SF:/a.c\nDA:1,1\nend_of_record\n";
+    for (int t = 0; t < 3; t++) {
+        info += "TN:t" + std::to_string(t) + "\n";
+        for (int f = 0; f < 20; f++)
+            info += "SF:/" + std::to_string(f) + ".c\nDA:" + std::to_string(t + 1) + ",1\nend_of_record\n";
+    }
+    // Another end_of_record of the last test without a TN.
+    info += "SF:/a.c\nDA:9,1\nend_of_record\r\n";
+
+    auto parts = SplitAtRecords(info, 7);
+    EXPECT_EQ(parts.size(), 7u);
+    std::string joined;
+    for (auto part : parts) {
+        EXPECT_GE(part.size(), 15u);
+        EXPECT_NE(part.substr(part.size() - 15).find("end_of_record"), std::string::npos);
+        joined += part;
+    }
+    EXPECT_EQ(joined, info);
+    EXPECT_EQ(SplitAtRecords(info, 1).size(), 1u);
+    EXPECT_EQ(SplitAtRecords("SF:/a.c\nend_of_record_x\n", 4).size(), 1u);
+
+    EmuFilesystem efs;
+    efs.PushFile("/a.info", info);
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.sorted_output_ = true;
+    LcovParser whole(config);
+    EXPECT_TRUE(whole.Parse(&efs, "/a.info"));
+    config.parse_jobs_ = 5;
+    config.min_part_size_ = 64;
+    LcovParser split(config);
+    EXPECT_TRUE(split.Parse(&efs, "/a.info"));
+
+    MemoryOutputSink a, b;
+    EXPECT_TRUE(whole.Export(&a, 1));
+    EXPECT_TRUE(split.Export(&b, 1));
+    EXPECT_EQ(a.GetContent(), b.GetContent());
+    auto pos = b.GetContent().find("TN:t2\n");
+    EXPECT_NE(b.GetContent().find("SF:/a.c\nFNF:0\nFNH:0\nDA:9,1\n", pos), std::string::npos);
+    EXPECT_EQ(split.GetRecordCounts()[LcovRecordType::DA], whole.GetRecordCounts()[LcovRecordType::DA]);
+
+    // A bogus record in any of the parts fails the parse.
+    efs.PushFile("/b.info", info + "SF:/b.c\nDA:x\nend_of_record\n");
+    LcovParser bogus(config);
+    EXPECT_FALSE(bogus.Parse(&efs, "/b.info"));
+}
+
+TEST(ParserTest, ParseFiles)
+{
+    // The inputs without a TN continue the test of the ones before them.
+    EmuFilesystem efs;
+    std::vector<std::string> paths;
+    for (int i = 0; i < 10; i++) {
+        std::string info = i == 0 ? "TN:bar\n" : "";
+        for (int f = 0; f < 8; f++)
+            info += "SF:/" + std::to_string(f) + ".c\nDA:" + std::to_string(i + 1) + ",1\nend_of_record\n";
+        if (i == 5)
+            info += "TN:baz\nSF:/a.c\nDA:1,1\nend_of_record\n";
+        paths.push_back("/" + std::to_string(i) + ".info");
+        efs.PushFile(paths.back(), info);
+    }
+    std::vector<char*> inputs;
+    for (auto& path : paths)
+        inputs.push_back(path.data());
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.sorted_output_ = true;
+    LcovParser serial(config);
+    for (auto* input : inputs)
+        EXPECT_TRUE(serial.Parse(&efs, input));
+    MemoryOutputSink expected;
+    EXPECT_TRUE(serial.Export(&expected, 1));
+    EXPECT_EQ(serial.GetTestRecords().size(), 2u);
+    auto baz = expected.GetContent().find("TN:baz\n");
+    EXPECT_NE(expected.GetContent().find("SF:/0.c\nFNF:0\nFNH:0\nDA:7,1\nDA:8,1\nDA:9,1\nDA:10,1\n", baz),
+              std::string::npos);
+
+    // Also with the inputs split into parts and in keep-going mode.
+    for (int mode = 0; mode < 3; mode++) {
+        config.parse_jobs_ = mode > 0 ? 3 : 1;
+        config.min_part_size_ = 64;
+        config.keep_going_ = mode == 2;
+        for (unsigned jobs : {2u, 3u, 16u}) {
+            LcovParser parallel(config);
+            EXPECT_TRUE(parallel.ParseFiles(&efs, inputs.data(), inputs.size(), jobs));
+            MemoryOutputSink out;
+            EXPECT_TRUE(parallel.Export(&out, 1));
+            EXPECT_EQ(out.GetContent(), expected.GetContent()) << "mode " << mode << ", " << jobs << " jobs";
+            EXPECT_EQ(parallel.GetRecordCounts()[LcovRecordType::DA], serial.GetRecordCounts()[LcovRecordType::DA]);
+        }
+    }
+
+    // A bogus input fails the parse.
+    efs.PushFile("/bogus.info", "SF:/b.c\nDA:x\nend_of_record\n");
+    inputs.insert(inputs.begin() + 4, const_cast<char*>("/bogus.info"));
+    config.keep_going_ = false;
+    LcovParser bogus(config);
+    EXPECT_FALSE(bogus.ParseFiles(&efs, inputs.data(), inputs.size(), 3));
+}
+
+TEST(ParserTest, Summary)
+{
+    EmuFilesystem efs;
+    std::string info = "TN:t1\nSF:/a.c\nFN:1,f\nFN:5,g\nFNDA:0,f\nDA:1,0\nDA:2,3\nDA:100,0\nDA:4000000000,0\n"
+                       "BRDA:2,0,0,-\nBRDA:2,0,1,0\nend_of_record\n"
+                       "TN:t2\nSF:/a.c\nFN:1,f\nFNDA:2,f\nDA:1,1\nDA:3,0\nDA:4000000000,2\nBRDA:2,0,1,1\nBRDA:2,0,2,0\nend_of_record\n";
+    for (int f = 0; f < 20; f++)
+        info += "SF:/" + std::to_string(f) + ".c\nDA:" + std::to_string(f + 1) + ",1\nend_of_record\n";
+    efs.PushFile("/a.info", info);
+
+    LcovParser::Config config;
+    config.trusted_ = true;
+    LcovParser full(config);
+    MemoryOutputSink snapshot;
+    EXPECT_TRUE(full.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(full.ExportSnapshot(&snapshot));
+    efs.PushFile("/b.snap", snapshot.GetContent());
+
+    // Records which are covered by more than one test are counted once.
+    config.summary_only_ = true;
+    LcovParser text(config);
+    EXPECT_TRUE(text.Parse(&efs, "/a.info"));
+    auto summary = text.GetSummary();
+    ASSERT_EQ(summary.size(), 21u);
+    EXPECT_EQ(summary[20].first, "/a.c");
+    const auto& a = summary[20].second;
+    // Far beyond the bitmaps, which a full merge accepts too.
+    EXPECT_EQ(a.lines_found_, 5u);
+    EXPECT_EQ(a.lines_hit_, 3u);
+    EXPECT_EQ(a.functions_found_, 2u);
+    EXPECT_EQ(a.functions_hit_, 1u);
+    EXPECT_EQ(a.branches_found_, 3u);
+    EXPECT_EQ(a.branches_hit_, 1u);
+
+    // Snapshots and split parses add up the same.
+    config.parse_jobs_ = 4;
+    config.min_part_size_ = 64;
+    LcovParser mixed(config);
+    EXPECT_TRUE(mixed.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(mixed.Parse(&efs, "/b.snap"));
+    auto merged = mixed.GetSummary();
+    ASSERT_EQ(merged.size(), summary.size());
+    for (size_t i = 0; i < merged.size(); i++) {
+        EXPECT_EQ(merged[i].first, summary[i].first);
+        EXPECT_EQ(merged[i].second.lines_hit_, summary[i].second.lines_hit_);
+        EXPECT_EQ(merged[i].second.functions_hit_, summary[i].second.functions_hit_);
+        EXPECT_EQ(merged[i].second.branches_found_, summary[i].second.branches_found_);
+    }
+
+    efs.PushFile("/c.info", "SF:/c.c\nFNDA:1,h\nend_of_record\n");
+    LcovParser bogus(config);
+    EXPECT_FALSE(bogus.Parse(&efs, "/c.info"));
+}
+
+TEST(DiffTest, MovedAndEditedLines)
+{
+    EmuFilesystem efs;
+    LcovParser::Config config;
+    config.generate_checksum_ = true;
+    config.sorted_output_ = true;
+    efs.PushFile("/a.c", "int a;\nint b;\nint c;\nint d;\n");
+    efs.PushFile("/base.info", "SF:/a.c\nFN:1,f\nFNDA:1,f\nDA:1,1\nDA:2,0\nDA:3,5\nDA:4,0\n"
+                               "BRDA:3,0,0,1\nBRDA:3,0,1,0\nBRDA:4,0,0,0\nend_of_record\n");
+    LcovParser base(config);
+    EXPECT_TRUE(base.Parse(&efs, "/base.info"));
+
+    // A line is inserted at the top and "int c;" is edited, in another checkout.
+    EmuFilesystem efs2;
+    efs2.PushFile("/a.c", "int z;\nint a;\nint b;\nint cc;\nint d;\n");
+    efs2.PushFile("/new.info", "SF:/a.c\nFN:2,f\nFNDA:0,f\nDA:1,0\nDA:2,0\nDA:3,1\nDA:4,0\nDA:5,1\n"
+                              "BRDA:4,0,0,1\nBRDA:4,0,1,1\nBRDA:5,0,0,1\nend_of_record\n");
+    LcovParser candidate(config);
+    EXPECT_TRUE(candidate.Parse(&efs2, "/new.info"));
+
+    MemoryOutputSink out;
+    WriteDiff(&out, DiffReports(base, candidate));
+    EXPECT_EQ(out.GetContent(), "SF:/a.c\n-DA:2@1\n+DA:3@2\n+DA:5@4\n-FN:2,f@1\n+BRDA:5,0,0@4\nend_of_record\n");
+    EXPECT_TRUE(DiffReports(candidate, candidate).empty());
+}
+
+TEST(ParserTest, KeepGoing)
+{
+    EmuFilesystem efs;
+    std::string info = "TN:t\nSF:/a.c\nFN:1,f\nDA:1,1\nDA:2,x\nend_of_record\n";
+    for (int f = 0; f < 20; f++)
+        info += "SF:/" + std::to_string(f) + ".c\nDA:" + std::to_string(f + 1) + ",1\nend_of_record\n";
+    info += "SF:/a.c\nFN:2,f\nDA:3,1\nend_of_record\n";
+    efs.PushFile("/a.info", info);
+    // The function moved, which conflicts with the records of /a.info.
+    efs.PushFile("/b.info", "TN:t\nSF:/a.c\nFN:5,f\nDA:3,2\nend_of_record\nSF:/b.c\nDA:1,1\nend_of_record\n");
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.sorted_output_ = true;
+    LcovParser strict(config);
+    EXPECT_FALSE(strict.Parse(&efs, "/a.info"));
+
+    config.keep_going_ = true;
+    LcovParser parser(config);
+    EXPECT_TRUE(parser.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(parser.Parse(&efs, "/missing.info"));
+    EXPECT_TRUE(parser.Parse(&efs, "/b.info"));
+    const auto& quarantine = parser.GetQuarantine();
+    ASSERT_EQ(quarantine.size(), 3u);
+    EXPECT_EQ(quarantine[0].input_, "/a.info");
+    EXPECT_EQ(quarantine[0].lineno_, 2u);
+    EXPECT_EQ(quarantine[0].source_file_, "/a.c");
+    EXPECT_EQ(quarantine[0].error_, "/a.info:5: <DA> invalid execution count");
+    EXPECT_EQ(quarantine[1].input_, "/missing.info");
+    EXPECT_EQ(quarantine[1].lineno_, 0u);
+    EXPECT_EQ(quarantine[2].input_, "/b.info");
+    EXPECT_EQ(quarantine[2].source_file_, "/a.c");
+
+    // Only the good blocks are merged, however the tracefile is split.
+    MemoryOutputSink out;
+    EXPECT_TRUE(parser.Export(&out, 1));
+    EXPECT_NE(out.GetContent().find("SF:/a.c\nFN:2,f\nFNDA:0,f\nFNF:1\nFNH:0\nDA:3,1\n"), std::string::npos);
+    EXPECT_NE(out.GetContent().find("SF:/b.c\n"), std::string::npos);
+    config.parse_jobs_ = 4;
+    config.min_part_size_ = 64;
+    LcovParser split(config);
+    MemoryOutputSink split_out;
+    EXPECT_TRUE(split.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(split.Parse(&efs, "/b.info"));
+    EXPECT_TRUE(split.Export(&split_out, 1));
+    EXPECT_EQ(split_out.GetContent(), out.GetContent());
+    EXPECT_EQ(split.GetQuarantine().size(), 2u);
+
+    // A block without end_of_record is dropped, the next one is kept.
+    efs.PushFile("/c.info", "TN:t\nSF:/c.c\nDA:1,1\nSF:/d.c\nDA:6,1\nend_of_record\n");
+    LcovParser unterminated(config);
+    EXPECT_TRUE(unterminated.Parse(&efs, "/c.info"));
+    ASSERT_EQ(unterminated.GetQuarantine().size(), 1u);
+    EXPECT_EQ(unterminated.GetQuarantine()[0].source_file_, "/c.c");
+    EXPECT_EQ(unterminated.GetQuarantine()[0].lineno_, 2u);
+    MemoryOutputSink unterminated_out;
+    EXPECT_TRUE(unterminated.Export(&unterminated_out, 1));
+    EXPECT_EQ(unterminated_out.GetContent().find("SF:/c.c\n"), std::string::npos);
+    EXPECT_NE(unterminated_out.GetContent().find("SF:/d.c\nFNF:0\nFNH:0\nDA:6,1\n"), std::string::npos);
+}
+
+TEST(ParserTest, HostileInputs)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/a.info", "SF:/a.c\nDA:1,1\nDA:2,1\nDA:3,1\nend_of_record\n");
+    efs.PushFile("/b.info", "SF:/a.c\nDA:1,1\nBRDA:1,0,0,1\nBRDA:1,0,1,1\nBRDA:1,1,0,1\nend_of_record\n");
+    efs.PushFile("/c.info", "SF:/a.c\nBRDA:1,4294967295,0,1\nend_of_record\n");
+    efs.PushFile("/d.info", "SF::/a.c\nend_of_record\n");
+    std::vector<std::string> errors;
+    SetErrorHandler([&errors](std::string_view message) { errors.emplace_back(message); });
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.max_lines_per_file_ = 2;
+    config.max_branches_per_line_ = 2;
+    for (const char* input : {"/a.info", "/b.info", "/c.info", "/d.info"}) {
+        LcovParser parser(config);
+        EXPECT_FALSE(parser.Parse(&efs, input));
+    }
+    SetErrorHandler(nullptr);
+    ASSERT_EQ(errors.size(), 4u);
+    EXPECT_EQ(errors[0], "/a.info:4: <DA> too many lines in the source file");
+    EXPECT_EQ(errors[1], "/b.info:5: <BRDA> too many branches on the line");
+    EXPECT_EQ(errors[2], "/c.info:2: <BRDA> arguments contains non-integers");
+    EXPECT_EQ(errors[3], "/d.info:1: unexpected ':' after the record type");
+
+    // A test without a name is exported first, or it reads back as part of the previous test.
+    efs.PushFile("/e.info", "TN:t\nSF:/a.c\nDA:1,1\nend_of_record\n");
+    efs.PushFile("/g.info", "SF:/a.c\nDA:2,1\nend_of_record\n");
+    LcovParser::Config plain;
+    plain.lazy_source_ = true;
+    LcovParser named(plain), reparsed(plain);
+    EXPECT_TRUE(named.Parse(&efs, "/g.info"));
+    EXPECT_TRUE(named.Parse(&efs, "/e.info"));
+    MemoryOutputSink out, again;
+    EXPECT_TRUE(named.Export(&out, 1));
+    efs.PushFile("/f.info", out.GetContent());
+    EXPECT_TRUE(reparsed.Parse(&efs, "/f.info"));
+    EXPECT_TRUE(reparsed.Export(&again, 1));
+    EXPECT_EQ(out.GetContent().compare(0, 8, "SF:/a.c\n"), 0);
+    EXPECT_EQ(again.GetContent(), out.GetContent());
+}
+
+TEST(MergeTest, ParallelMerge)
+{
+    EmuFilesystem efs;
+    std::mt19937 rng(7);
+    for (int i = 0; i < 8; i++) {
+        std::string info;
+        for (int t = 0; t < 2; t++) {
+            info += "TN:t" + std::to_string((i + t) % 3) + "\n";
+            for (int f = 0; f < 50; f++) {
+                if (rng() % 2)
+                    continue;
+                info += "SF:/src/" + std::to_string(f) + ".c\nFN:1,f" + std::to_string(f) + "\nFNDA:" +
+                        std::to_string(rng() % 3) + ",f" + std::to_string(f) + "\nDA:" + std::to_string(rng() % 8 + 1) +
+                        ",1\nBRDA:2,0,0," + std::to_string(rng() % 3) + "\nend_of_record\n";
+            }
+        }
+        efs.PushFile("/" + std::to_string(i) + ".info", info);
+    }
+
+    LcovParser::Config config;
+    config.lazy_source_ = true;
+    config.sorted_output_ = true;
+    LcovParser sequential(config), parallel(config);
+    std::vector<LcovParser*> others;
+    std::string err;
+    for (int i = 0; i < 8; i++) {
+        std::string path = "/" + std::to_string(i) + ".info";
+        LcovParser other(config);
+        EXPECT_TRUE(other.Parse(&efs, path.c_str()));
+        EXPECT_TRUE(sequential.Merge(&other, &err)) << err;
+        others.push_back(new LcovParser(config));
+        EXPECT_TRUE(others.back()->Parse(&efs, path.c_str()));
+    }
+    EXPECT_TRUE(parallel.MergeParallel(others, 3, &err)) << err;
+
+    MemoryOutputSink a, b;
+    EXPECT_TRUE(sequential.Export(&a, 1));
+    EXPECT_TRUE(parallel.Export(&b, 1));
+    EXPECT_EQ(a.GetContent(), b.GetContent());
+    EXPECT_EQ(parallel.GetRecordCounts()[LcovRecordType::SF], sequential.GetRecordCounts()[LcovRecordType::SF]);
+
+    // Conflicts between the inputs are still reported.
+    efs.PushFile("/c.info", "TN:x\nSF:/src/0.c\nFN:9,f0\nend_of_record\n");
+    efs.PushFile("/d.info", "TN:x\nSF:/src/0.c\nFN:1,f0\nend_of_record\n");
+    EXPECT_TRUE(others[0]->Parse(&efs, "/c.info"));
+    EXPECT_TRUE(others[1]->Parse(&efs, "/d.info"));
+    EXPECT_FALSE(parallel.MergeParallel(others, 3, &err));
+    EXPECT_NE(err.find("conflicting function definitions"), std::string::npos) << err;
+    for (auto* other : others)
+        delete other;
+}
+
+TEST(MergeTest, DropChangedSources)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/a.c", "int a;\nint b;\n");
+    efs.PushFile("/b.c", "int c;\n");
+    efs.PushFile("/a.info", "TN:t\nSF:/a.c\nDA:1,1\nend_of_record\nSF:/b.c\nDA:1,1\nend_of_record\n");
+    efs.PushFile("/b.info", "TN:t\nSF:/a.c\nFN:2,f\nDA:1,1,AAAAAAAAAAAAAAAAAAAAAA==\nend_of_record\n");
+
+    LcovParser::Config config;
+    config.generate_checksum_ = true;
+    LcovParser report(config);
+    EXPECT_TRUE(report.Parse(&efs, "/a.info"));
+    std::vector<std::string> paths;
+    report.DropChangedSources(&efs, &paths);
+    EXPECT_TRUE(paths.empty());
+
+    // A conflict is found without touching the report.
+    LcovParser::Config trusted = config;
+    trusted.trusted_ = true;
+    LcovParser delta(trusted);
+    EXPECT_TRUE(delta.Parse(&efs, "/b.info"));
+    std::string err;
+    EXPECT_FALSE(report.CheckMerge(delta, &err));
+    EXPECT_EQ(err, "/a.c: conflicting checksum");
+    EXPECT_EQ(report.GetTableStats().functions_.size_, 0u);
+
+    efs.PushFile("/a.c", "int a;\nint c;\n");
+    report.DropChangedSources(&efs, &paths);
+    EXPECT_EQ(paths, std::vector<std::string>{"/a.c"});
+    EXPECT_TRUE(report.CheckMerge(delta, &err)) << err;
+
+    // The changed source is read again by the next parse.
+    LcovParser again(config);
+    EXPECT_TRUE(again.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(report.Merge(&again, &err)) << err;
+    MemoryOutputSink out;
+    EXPECT_TRUE(report.Export(&out, 1));
+    EXPECT_NE(out.GetContent().find("SF:/a.c\nFNF:0\nFNH:0\nDA:1,1,"), std::string::npos);
+    EXPECT_NE(out.GetContent().find("SF:/b.c\nFNF:0\nFNH:0\nDA:1,2,"), std::string::npos);
+}
+
+TEST(MergeTest, ParallelMergeKeepsSources)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/a.c", "int a;\n");
+    efs.PushFile("/b.c", "int b;\n");
+    efs.PushFile("/a.info", "TN:t\nSF:/a.c\nDA:1,1\nend_of_record\nSF:/b.c\nDA:1,1\nend_of_record\n");
+
+    LcovParser::Config config;
+    config.generate_checksum_ = true;
+    LcovParser report(config), a(config), b(config);
+    EXPECT_TRUE(a.Parse(&efs, "/a.info"));
+    EXPECT_TRUE(b.Parse(&efs, "/a.info"));
+    std::string err;
+    EXPECT_TRUE(report.MergeParallel({&a, &b}, 2, &err)) << err;
+    for (const auto& t : report.GetTestRecords()) {
+        for (auto* sf : t.second->GetSourceFiles(false))
+            EXPECT_NE(sf->GetSourceContent(), nullptr) << sf->GetSourceFilePath();
+    }
+
+    // The copies made for the duplicates are dropped like any other record.
+    std::vector<std::string> paths;
+    efs.PushFile("/b.c", "int c;\n");
+    report.DropChangedSources(&efs, &paths);
+    EXPECT_EQ(paths, std::vector<std::string>{"/b.c"});
+}
+
+TEST(ServerTest, RoundTrip)
+{
+    std::string path = "/tmp/lcovmerge-test-" + std::to_string(getpid()) + ".sock";
+    std::string reply, err;
+    std::vector<std::vector<std::string>> requests;
+    {
+        CommandServer server, other;
+        ASSERT_TRUE(server.Listen(path.c_str(), &err)) << err;
+        EXPECT_FALSE(other.Listen(path.c_str(), &err));
+
+        std::thread thread([&server, &requests]() {
+            std::string err;
+            EXPECT_TRUE(server.Run([&](const std::vector<std::string>& args, std::string* reply) {
+                requests.push_back(args);
+                *reply = "OK " + std::to_string(args.size());
+                return args[0] != "SHUTDOWN";
+            }, &err)) << err;
+        });
+        EXPECT_TRUE(SendCommand(path.c_str(), {"MERGE", "/a b.info", "/c.info"}, &reply, &err)) << err;
+        EXPECT_EQ(reply, "OK 3");
+        EXPECT_FALSE(SendCommand(path.c_str(), {"MERGE", "/a\tb.info"}, &reply, &err));
+        EXPECT_TRUE(SendCommand(path.c_str(), {"SHUTDOWN"}, &reply, &err)) << err;
+        thread.join();
+    }
+
+    ASSERT_EQ(requests.size(), 2u);
+    EXPECT_EQ(requests[0][1], "/a b.info");
+    // The socket is gone together with the server.
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+    EXPECT_FALSE(SendCommand(path.c_str(), {"STATS"}, &reply, &err));
+}
+
+TEST(ServerTest, DropsIdleClients)
+{
+    std::string path = "/tmp/lcovmerge-test-" + std::to_string(getpid()) + "-idle.sock";
+    std::string reply, err;
+    CommandServer server;
+    server.SetIdleTimeout(100);
+    ASSERT_TRUE(server.Listen(path.c_str(), &err)) << err;
+    std::thread thread([&server]() {
+        std::string err;
+        EXPECT_TRUE(server.Run([](const std::vector<std::string>& args, std::string* reply) {
+            *reply = "OK";
+            return args[0] != "SHUTDOWN";
+        }, &err)) << err;
+    });
+
+    // Half a request keeps the server busy until the client is dropped.
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(send(fd, "STA", 3, 0), 3);
+    EXPECT_TRUE(SendCommand(path.c_str(), {"SHUTDOWN"}, &reply, &err)) << err;
+    EXPECT_EQ(reply, "OK");
+    thread.join();
+    char c;
+    EXPECT_EQ(recv(fd, &c, 1, 0), 0);
+    close(fd);
+}
+
+TEST(ServerTest, KeepsOtherFiles)
+{
+    std::string path = "/tmp/lcovmerge-test-" + std::to_string(getpid()) + ".txt";
+    std::string err;
+    FILE* file = fopen(path.c_str(), "w");
+    ASSERT_NE(file, nullptr);
+    fputs("data\n", file);
+    fclose(file);
+    {
+        CommandServer server;
+        EXPECT_FALSE(server.Listen(path.c_str(), &err));
+        EXPECT_EQ(err, "path exists and is not a socket");
+    }
+    EXPECT_EQ(access(path.c_str(), F_OK), 0);
+    unlink(path.c_str());
+}
+
+static std::string ExportString(LcovMerger* merger)
+{
+    std::string report;
+    EXPECT_TRUE(merger->ExportToString(&report));
+    return report;
+}
+
+struct FailingOutputSink : OutputSink {
+    bool WriteBuffers(const struct iovec*, int, std::string* err) override {
+        *err = "No space left on device";
+        return false;
+    }
+};
+
+TEST(LibraryTest, InMemoryInputs)
+{
+    EmuFilesystem efs;
+    efs.PushFile("/a.c", "int a;\nint b;\n");
+    std::vector<std::string> errors;
+    SetErrorHandler([&errors](std::string_view message) { errors.emplace_back(message); });
+
+    LcovMerger::Options options;
+    options.generate_checksum_ = true;
+    LcovMerger merger(&efs, options), other(&efs, options);
+    EXPECT_TRUE(merger.AddData("a.info", "SF:/a.c\nDA:1,1\nend_of_record\n"));
+    EXPECT_TRUE(other.AddData("b.info", "SF:/a.c\nDA:1,2\nDA:2,1\nend_of_record\n"));
+    EXPECT_TRUE(merger.Merge(&other));
+    EXPECT_EQ(ExportString(&other), "");
+
+    // Neither a bogus input nor a conflicting one changes the report.
+    std::string report = ExportString(&merger);
+    EXPECT_FALSE(merger.AddData("c.info", "SF:/a.c\nDA:3,1\nend_of_record\n"));
+    EXPECT_FALSE(merger.AddData("d.info", "SF:/a.c\nFN:1,f\nend_of_record\nSF:/a.c\nFN:2,f\nend_of_record\n"));
+    EXPECT_TRUE(other.AddData("d.info", "SF:/a.c\nFN:1,f\nDA:1,0\nend_of_record\n"));
+    EXPECT_TRUE(merger.AddData("e.info", "SF:/a.c\nFN:2,f\nend_of_record\n"));
+    EXPECT_FALSE(merger.Merge(&other));
+    SetErrorHandler(nullptr);
+    ASSERT_EQ(errors.size(), 3u);
+    EXPECT_EQ(errors[0], "c.info:2: <DA> invalid line number");
+    EXPECT_EQ(errors[2], "E: /a.c: conflicting function definitions");
+
+    // Snapshots are loaded from memory as well.
+    MemoryOutputSink snapshot;
+    EXPECT_TRUE(merger.ExportSnapshot(&snapshot));
+    LcovMerger loaded(&efs);
+    EXPECT_TRUE(loaded.AddData("report.snap", snapshot.GetContent()));
+    EXPECT_EQ(ExportString(&loaded), ExportString(&merger));
+    EXPECT_NE(report.find("DA:1,3,"), std::string::npos);
+    loaded.Reset();
+    EXPECT_EQ(ExportString(&loaded), "");
+
+    errors.clear();
+    SetErrorHandler([&errors](std::string_view message) { errors.emplace_back(message); });
+    FailingOutputSink full;
+    EXPECT_FALSE(merger.Export(&full));
+    SetErrorHandler(nullptr);
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0], "E: failed to export the report: No space left on device");
+}
+
+TEST(LibraryTest, ShortLivedMergers)
+{
+    EmuFilesystem efs;
+    LcovMerger::Options options;
+    options.generate_checksum_ = true;
+    std::vector<std::unique_ptr<LcovMerger>> reports;
+    std::string report;
+    // Mergers allocated one after another are likely to reuse addresses, the
+    // contents the first one read are still alive in the report it was merged into.
+    for (const char* source : {"int a;\n", "int b;\n"}) {
+        efs.PushFile("/a.c", source);
+        auto merger = std::make_unique<LcovMerger>(&efs, options);
+        EXPECT_TRUE(merger->AddData("a.info", "SF:/a.c\nDA:1,1\nend_of_record\n"));
+        reports.emplace_back(new LcovMerger(&efs, options));
+        EXPECT_TRUE(reports.back()->Merge(merger.get()));
+        EXPECT_NE(ExportString(reports.back().get()), report);
+        report = ExportString(reports.back().get());
+    }
+}
+
+// Synthetic tracefile with `n` elements along one dimension of the input.
+static std::string ScaledInfo(int dim, int n)
+{
+    std::string info;
+    auto add_file = [&info](const std::string& name, int lines, int branches) {
+        info += "SF:/" + name + ".c\nFN:1,f\nFNDA:1,f\n";
+        for (int l = 1; l <= lines; l++) {
+            info += "DA:" + std::to_string(l) + "," + std::to_string(l % 3) + "\n";
+            for (int b = 0; b < branches; b++)
+                info += "BRDA:" + std::to_string(l) + ",0," + std::to_string(b) + ",1\n";
+        }
+        info += "end_of_record\n";
+    };
+    switch (dim) {
+    case 0: for (int f = 0; f < n; f++) add_file(std::to_string(f), 4, 1); break;
+    case 1: add_file("a", n, 1); break;
+    case 2:
+        for (int t = 0; t < n; t++) {
+            info += "TN:t" + std::to_string(t) + "\n";
+            add_file("a", 4, 1);
+        }
+        break;
+    default: add_file("a", 4, n / 4); break;
+    }
+    return info;
+}
+
+struct ScaledRun {
+    uint64_t nanos_;
+    uint64_t rss_;
+};
+
+// Parses, merges and exports in a child process, so that the peak RSS is its own.
+static ScaledRun RunScaled(int dim, int n)
+{
+    ScaledRun run = {~0ull, 0};
+    int fds[2];
+    if (pipe(fds))
+        return run;
+    pid_t pid = fork();
+    if (pid == 0) {
+        EmuFilesystem efs;
+        efs.PushFile("/a.info", ScaledInfo(dim, n));
+        efs.PushFile("/b.info", ScaledInfo(dim, n));
+        uint64_t base = Stats::GetPeakRss();
+        LcovParser::Config config;
+        config.lazy_source_ = true;
+        for (int i = 0; i < 3; i++) {
+            auto start = std::chrono::steady_clock::now();
+            LcovParser parser(config), other(config);
+            std::string err;
+            MemoryOutputSink out;
+            if (!parser.Parse(&efs, "/a.info") || !other.Parse(&efs, "/b.info") ||
+                !parser.Merge(&other, &err) || !parser.Export(&out, 1))
+                _exit(1);
+            uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            run.nanos_ = std::min(run.nanos_, nanos);
+        }
+        run.rss_ = Stats::GetPeakRss() - base;
+        _exit(write(fds[1], &run, sizeof(run)) == sizeof(run) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0 || read(fds[0], &run, sizeof(run)) != sizeof(run))
+        run.nanos_ = ~0ull;
+    close(fds[0]);
+    if (pid > 0)
+        waitpid(pid, nullptr, 0);
+    return run;
+}
+
+TEST(ScalingTest, SubquadraticGrowth)
+{
+    const char* dims[] = {"files", "lines", "tests", "branches"};
+    const int sizes[] = {1024, 8192, 1024, 8192};
+
+    for (int dim = 0; dim < 4; dim++) {
+        int n = sizes[dim];
+        ScaledRun small = RunScaled(dim, n), large = RunScaled(dim, 8 * n);
+        ASSERT_NE(small.nanos_, ~0ull) << dims[dim];
+        ASSERT_NE(large.nanos_, ~0ull) << dims[dim];
+        // 8^1.6: linear or n*log(n) with some noise passes, quadratic does not.
+        EXPECT_LT(large.nanos_, 28 * std::max<uint64_t>(small.nanos_, 1000000))
+            << dims[dim] << ": " << n << " -> " << 8 * n << ": " << small.nanos_ << "ns -> " << large.nanos_ << "ns";
+        // Below a few megabytes the peak is dominated by the allocator.
+        EXPECT_LT(large.rss_, 16 * std::max<uint64_t>(small.rss_, 4 << 20))
+            << dims[dim] << ": " << n << " -> " << 8 * n << ": " << small.rss_ << "B -> " << large.rss_ << "B";
+    }
+}